@@ -0,0 +1,162 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Compares the slab allocator the heap allocates objects from with malloc and free, for the mix of object sizes a Lox
+// program allocates. The sweep compares walking the blocks' mark bitmaps with the linked list of objects the collector
+// used to follow, where every object carried a pointer to the next one and its own mark flag.
+
+#include "benchmark.h"
+
+#include "object.h"
+#include "slab_allocator.h"
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+static constexpr uint32_t OBJECT_COUNT = 1'000'000;
+static constexpr uint32_t REPETITIONS = 5;
+
+// Roughly what the benchmark scripts allocate: mostly instances and strings, then closures, upvalues and bound methods
+static constexpr auto SIZE_MIX = std::array {
+    sizeof(InstanceObject),
+    sizeof(StringObject),
+    sizeof(InstanceObject),
+    sizeof(ClosureObject),
+    sizeof(StringObject),
+    sizeof(UpvalueObject),
+    sizeof(InstanceObject),
+    sizeof(BoundMethodObject),
+};
+
+// The header of an object in the old malloc-backed heap
+struct ListedObject {
+    ListedObject* next;
+    bool marked;
+};
+
+// Every tenth object in "survivors_per_ten" of ten survives the collection
+[[nodiscard]] static auto Survives(uint32_t index, uint32_t survivors_per_ten) -> bool
+{
+    return index % 10 < survivors_per_ten;
+}
+
+[[nodiscard]] static auto TimeSince(std::chrono::steady_clock::time_point start) -> std::chrono::nanoseconds
+{
+    return std::chrono::steady_clock::now() - start;
+}
+
+struct Timings {
+    std::chrono::nanoseconds allocate = std::chrono::nanoseconds::max();
+    std::chrono::nanoseconds sweep = std::chrono::nanoseconds::max();
+};
+
+static auto RunSlab(uint32_t survivors_per_ten) -> Timings
+{
+    auto timings = Timings {};
+    auto cells = std::vector<void*>(OBJECT_COUNT);
+    for (uint32_t repetition = 0; repetition < REPETITIONS; ++repetition) {
+        SlabAllocator allocator;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < OBJECT_COUNT; ++i) {
+            cells[i] = allocator.Allocate(SIZE_MIX[i % SIZE_MIX.size()]);
+        }
+        timings.allocate = std::min(timings.allocate, TimeSince(start));
+        for (uint32_t i = 0; i < OBJECT_COUNT; ++i) {
+            if (Survives(i, survivors_per_ten)) {
+                (void)SlabAllocator::TryMark(cells[i]);
+            }
+        }
+        start = std::chrono::steady_clock::now();
+        for (auto* block : allocator.Blocks()) {
+            block->ForEachCell([block](uint32_t word) { return block->allocated[word] & ~block->mark_state->marked[word].load(std::memory_order_relaxed); },
+                [&allocator](void* cell) { allocator.Free(cell); });
+            for (auto& word : block->mark_state->marked) {
+                word.store(0, std::memory_order_relaxed);
+            }
+        }
+        timings.sweep = std::min(timings.sweep, TimeSince(start));
+        for (auto* block : allocator.Blocks()) {
+            block->ForEachCell([block](uint32_t word) { return block->allocated[word]; }, [&allocator](void* cell) { allocator.Free(cell); });
+        }
+    }
+    return timings;
+}
+
+static auto RunMalloc(uint32_t survivors_per_ten) -> Timings
+{
+    auto timings = Timings {};
+    auto objects = std::vector<ListedObject*>(OBJECT_COUNT);
+    for (uint32_t repetition = 0; repetition < REPETITIONS; ++repetition) {
+        ListedObject* list = nullptr;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < OBJECT_COUNT; ++i) {
+            auto* object = static_cast<ListedObject*>(std::malloc(SIZE_MIX[i % SIZE_MIX.size()]));
+            object->marked = false;
+            object->next = list;
+            list = object;
+            objects[i] = object;
+        }
+        timings.allocate = std::min(timings.allocate, TimeSince(start));
+        for (uint32_t i = 0; i < OBJECT_COUNT; ++i) {
+            objects[i]->marked = Survives(i, survivors_per_ten);
+        }
+        start = std::chrono::steady_clock::now();
+        ListedObject* survivors = nullptr;
+        while (list != nullptr) {
+            auto* next = list->next;
+            if (list->marked) {
+                list->marked = false;
+                list->next = survivors;
+                survivors = list;
+            } else {
+                std::free(list);
+            }
+            list = next;
+        }
+        timings.sweep = std::min(timings.sweep, TimeSince(start));
+        while (survivors != nullptr) {
+            auto* next = survivors->next;
+            std::free(survivors);
+            survivors = next;
+        }
+    }
+    return timings;
+}
+
+[[nodiscard]] static auto NanosecondsPerObject(std::chrono::nanoseconds duration) -> double
+{
+    return static_cast<double>(duration.count()) / OBJECT_COUNT;
+}
+
+int main()
+{
+    fmt::print("{:>10} {:>12} {:>16} {:>16}\n", "survivors", "allocator", "allocate(ns/op)", "sweep(ns/op)");
+    for (auto const survivors_per_ten : std::array { 1U, 5U, 9U }) {
+        auto const slab = RunSlab(survivors_per_ten);
+        auto const malloc = RunMalloc(survivors_per_ten);
+        fmt::print("{:>9}% {:>12} {:>16.2f} {:>16.2f}\n", survivors_per_ten * 10, "slab", NanosecondsPerObject(slab.allocate), NanosecondsPerObject(slab.sweep));
+        fmt::print("{:>9}% {:>12} {:>16.2f} {:>16.2f}\n", survivors_per_ten * 10, "malloc", NanosecondsPerObject(malloc.allocate), NanosecondsPerObject(malloc.sweep));
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Long running churn: every round(an "hour" of a server's day) allocates a batch of short-lived objects and keeps every
+// eighth of them for the next few rounds, like a cache with a fixed time to live. Rounds alternate between instances and
+// closures, the survivors of a round leave the blocks of their size classes sparsely used while the next round allocates
+// from the other ones. Reports the resident set size and the heap's bytes after every round with and without compaction
+// (VirtualMachine::SetGCCompaction), each configuration in a process of its own.
+
+#include "benchmark.h"
+
+#include <array>
+#include <chrono>
+#include <optional>
+#include <string>
+
+#ifdef __linux__
+static constexpr uint32_t ROUNDS = 24;
+static constexpr uint32_t BATCH_SIZE = 200'000;
+static constexpr uint32_t ARCHIVES = 4; // Rounds a batch's survivors are kept for
+
+static constexpr auto SETUP_SCRIPT = R"(
+class Node {
+  init(value, next) { this.value = value; this.next = next; }
+}
+fun make(value) {
+  fun get() { return value; }
+  return get;
+}
+var batch = nil;
+var archive0 = nil;
+var archive1 = nil;
+var archive2 = nil;
+var archive3 = nil;
+)";
+
+static auto RoundScript(uint32_t round) -> std::string
+{
+    return fmt::format(R"(
+batch = nil;
+for (var i = 0; i < {}; i = i + 1) {{
+  batch = Node({}, batch);
+}}
+var last = batch;
+var node = batch.next;
+var k = 1;
+while (node != nil) {{
+  if (k == 8) {{
+    last.next = node;
+    last = node;
+    k = 0;
+  }}
+  node = node.next;
+  k = k + 1;
+}}
+last.next = nil;
+archive{} = batch;
+batch = nil;
+)",
+        BATCH_SIZE, round % 2 == 0 ? "Node(i, nil)" : "make(i)", round % ARCHIVES);
+}
+
+struct RoundResult {
+    double resident_mb = 0;
+    double heap_mb = 0;
+};
+
+static auto Interpret(VirtualMachine& vm, std::string const& script) -> bool
+{
+    Source source;
+    source.Append(script);
+    if (auto result = vm.Interpret(source); !result) {
+        fmt::print(stderr, "Benchmark script failed: {}\n", result.error().error_message);
+        return false;
+    }
+    return true;
+}
+
+using RoundResults = std::array<RoundResult, ROUNDS>;
+
+// Runs every round, in a child process of its own(see RunInChild)
+static auto RunChild(bool compaction) -> std::optional<RoundResults>
+{
+    std::string output;
+    VirtualMachine vm(&output);
+    vm.SetGCCompaction(compaction);
+    if (!Interpret(vm, SETUP_SCRIPT)) {
+        return std::nullopt;
+    }
+    auto results = RoundResults {};
+    auto const start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < ROUNDS; ++round) {
+        if (!Interpret(vm, RoundScript(round))) {
+            return std::nullopt;
+        }
+        results[round] = RoundResult {
+            .resident_mb = static_cast<double>(ResidentBytes()) / (1024.0 * 1024.0),
+            .heap_mb = static_cast<double>(vm.HeapBytes()) / (1024.0 * 1024.0),
+        };
+    }
+    auto const& stats = vm.GarbageCollections();
+    fmt::print(stderr, "compaction {:>3}: {:.0f}ms, {} compactions moved {} objects and emptied {} blocks, longest major pause {:.2f}ms\n",
+        compaction ? "on" : "off", ToMilliseconds(std::chrono::steady_clock::now() - start), stats.compactions, stats.objects_moved,
+        stats.blocks_compacted, ToMilliseconds(stats.longest_major_pause));
+    return results;
+}
+
+int main()
+{
+    auto const without = RunInChild<RoundResults>([] { return RunChild(false); });
+    auto const with = RunInChild<RoundResults>([] { return RunChild(true); });
+    if (!without.has_value() || !with.has_value()) {
+        return 1;
+    }
+    fmt::print("{:>6} {:>10} {:>14} {:>14}\n", "round", "heap(MB)", "rss(MB) off", "rss(MB) on");
+    for (uint32_t round = 0; round < ROUNDS; ++round) {
+        fmt::print("{:>6} {:>10.1f} {:>14.1f} {:>14.1f}\n", round, (*with)[round].heap_mb, (*without)[round].resident_mb, (*with)[round].resident_mb);
+    }
+    return 0;
+}
+#else
+int main()
+{
+    fmt::print(stderr, "bench_churn needs fork() and /proc/self/statm\n");
+    return 0;
+}
+#endif
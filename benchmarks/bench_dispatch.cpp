@@ -0,0 +1,84 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Measures the per-instruction cost of the interpreter loop on the README's Fib and loop examples (scaled up so that
+// the dispatch loop dominates) and on the same loop accumulating into a global variable. Build once with -DLOX_THREADED_DISPATCH=ON and once with OFF to compare the two
+// dispatch engines.
+
+#include "benchmark.h"
+
+#include <array>
+
+static constexpr auto FIB_SCRIPT = R"(
+fun Fib(n) {
+    if( n<= 1) {
+        return n;
+    }
+    return Fib(n-2) + Fib(n-1);
+}
+print Fib(27);
+)";
+
+static constexpr auto LOOP_SCRIPT = R"(
+var sum = 0;
+{
+     for(var i = 1; i <= 3000000; i = i + 1){
+         sum = sum + i;
+     }
+     print sum;
+}
+)";
+
+static constexpr auto GLOBAL_LOOP_SCRIPT = R"(
+var sum = 0;
+for(var i = 1; i <= 3000000; i = i + 1){
+    sum = sum + i;
+}
+print sum;
+)";
+
+struct Benchmark {
+    std::string_view name;
+    std::string_view script;
+};
+
+static constexpr auto BENCHMARKS = std::array {
+    Benchmark { "fib", FIB_SCRIPT },
+    Benchmark { "loop", LOOP_SCRIPT },
+    Benchmark { "globals", GLOBAL_LOOP_SCRIPT },
+};
+
+int main()
+{
+#ifdef THREADED_DISPATCH
+    fmt::print("dispatch: threaded (LOX_THREADED_DISPATCH=ON)\n");
+#else
+    fmt::print("dispatch: switch (LOX_THREADED_DISPATCH=OFF)\n");
+#endif
+    fmt::print("{:<8} {:>14} {:>12} {:>16}\n", "script", "instructions", "best(ms)", "ns/instruction");
+    for (auto const& benchmark : BENCHMARKS) {
+        auto const run = BestOf(5, benchmark.script);
+        auto const ns_per_instruction = static_cast<double>(run.elapsed.count()) / static_cast<double>(run.instructions_executed);
+        fmt::print("{:<8} {:>14} {:>12.2f} {:>16.3f}\n", benchmark.name, run.instructions_executed, ToMilliseconds(run.elapsed), ns_per_instruction);
+    }
+    return 0;
+}
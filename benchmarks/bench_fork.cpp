@@ -0,0 +1,178 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Measures what a major collection costs a forked child that shares the parent's heap copy-on-write. The parent builds
+// a linked list of instances and collects once so that the whole heap is old and swept. The child then collects again
+// and reports how many of the shared pages it had to copy(its private dirty memory grows by the pages the collector
+// wrote to) and, where the kernel lets it, the cache misses of the collection. With the mark bits in the blocks' side
+// bitmaps marking does not write to the objects, only the bitmap pages of the blocks should be copied.
+
+#include "benchmark.h"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+
+#ifdef __linux__
+#    include <linux/perf_event.h>
+#    include <sys/ioctl.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+
+static auto ListScript(uint32_t instances) -> std::string
+{
+    return fmt::format(R"(
+class Node {{
+    init(next) {{ this.next = next; this.value = 0; }}
+}}
+var head = nil;
+for(var i = 0; i < {}; i = i + 1){{
+    head = Node(head);
+}}
+)",
+        instances);
+}
+
+// Private_Dirty of the process in kB, from /proc/self/smaps_rollup
+static auto PrivateDirtyKilobytes() -> uint64_t
+{
+    auto* file = std::fopen("/proc/self/smaps_rollup", "r");
+    if (file == nullptr) {
+        return 0;
+    }
+    auto kilobytes = uint64_t { 0 };
+    std::array<char, 256> line {};
+    while (std::fgets(line.data(), line.size(), file) != nullptr) {
+        unsigned long long value = 0;
+        if (std::sscanf(line.data(), "Private_Dirty: %llu kB", &value) == 1) {
+            kilobytes = value;
+            break;
+        }
+    }
+    std::fclose(file);
+    return kilobytes;
+}
+
+// Counts the hardware cache misses of this thread in user space, unavailable in most containers and virtual machines
+class CacheMissCounter {
+public:
+    CacheMissCounter()
+    {
+        perf_event_attr attributes {};
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.size = sizeof(attributes);
+        attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    CacheMissCounter(CacheMissCounter const&) = delete;
+    auto operator=(CacheMissCounter const&) -> CacheMissCounter& = delete;
+    ~CacheMissCounter()
+    {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+    [[nodiscard]] auto Read() const -> std::optional<uint64_t>
+    {
+        auto count = uint64_t { 0 };
+        if (m_fd < 0 || read(m_fd, &count, sizeof(count)) != sizeof(count)) {
+            return {};
+        }
+        return count;
+    }
+
+private:
+    int m_fd = -1;
+};
+
+struct ChildResult {
+    double collection_ms = 0;
+    uint64_t dirtied_kilobytes = 0;
+    int64_t cache_misses = -1; // Negative if the counter is unavailable
+};
+
+static auto Run(uint32_t instances) -> int
+{
+    std::string output;
+    VirtualMachine vm(&output);
+    vm.SetGCPauseBudget(std::chrono::microseconds { 0 });
+    Source source;
+    source.Append(ListScript(instances));
+    if (auto result = vm.Interpret(source); !result) {
+        fmt::print(stderr, "Benchmark script failed: {}\n", result.error().error_message);
+        return 1;
+    }
+    vm.CollectGarbage();
+    auto const heap_bytes = vm.HeapBytes();
+
+    // The child shares the heap the parent just collected copy-on-write
+    auto const result = RunInChild<ChildResult>([&vm] {
+        auto child_result = ChildResult {};
+        auto const dirty_before = PrivateDirtyKilobytes();
+        CacheMissCounter const cache_misses;
+        auto const start = std::chrono::steady_clock::now();
+        vm.CollectGarbage();
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+        if (auto misses = cache_misses.Read(); misses.has_value()) {
+            child_result.cache_misses = static_cast<int64_t>(*misses);
+        }
+        child_result.collection_ms = ToMilliseconds(elapsed);
+        child_result.dirtied_kilobytes = PrivateDirtyKilobytes() - dirty_before;
+        return std::optional { child_result };
+    });
+    if (!result.has_value()) {
+        return 1;
+    }
+    auto const heap_kilobytes = static_cast<double>(heap_bytes) / 1024.0;
+    auto const misses = result->cache_misses < 0 ? std::string { "n/a" } : fmt::format("{:.2f}", static_cast<double>(result->cache_misses) / instances);
+    fmt::print("{:>10} {:>10.1f} {:>12.2f} {:>14} {:>12.1f} {:>16}\n", instances, heap_kilobytes / 1024.0, result->collection_ms,
+        result->dirtied_kilobytes, 100.0 * static_cast<double>(result->dirtied_kilobytes) / heap_kilobytes, misses);
+    return 0;
+}
+
+int main()
+{
+    fmt::print("{:>10} {:>10} {:>12} {:>14} {:>12} {:>16}\n", "instances", "heap(MB)", "collect(ms)", "copied(kB)", "copied(%)", "misses/object");
+    for (auto const instances : std::array { 100000U, 400000U, 1000000U }) {
+        if (auto result = Run(instances); result != 0) {
+            return result;
+        }
+    }
+    return 0;
+}
+#else
+int main()
+{
+    fmt::print(stderr, "bench_fork needs fork() and /proc/self/smaps_rollup\n");
+    return 0;
+}
+#endif
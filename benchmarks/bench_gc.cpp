@@ -0,0 +1,113 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Measures collector pause times as the resident heap grows. Each run first builds a linked list of instances that
+// stays alive for the whole script and then allocates short-lived garbage. With a generational heap the minor pauses
+// should stay flat as the list grows, only the(rare) major collections have to mark the list. Every heap size is run
+// with stop-the-world, incremental and concurrent major collections. Incremental slices should stay close to the pause
+// budget while the stop-the-world pauses grow with the list. With the marker thread the interpreter only pauses for the
+// root snapshot, the remark and the sweep slices, plus the time it waits for the marker lock to store into old objects.
+// The stop-the-world runs also compare eager sweeping with lazy sweeping, with and without background freeing: the
+// post-mark pause and the time until the first allocation after a major collection should no longer grow with the list.
+
+#include "benchmark.h"
+
+#include <array>
+#include <chrono>
+#include <string>
+
+static auto ChurnScript(uint32_t resident_instances) -> std::string
+{
+    return fmt::format(R"(
+class Node {{
+    init(next) {{ this.next = next; }}
+}}
+var head = nil;
+for(var i = 0; i < {}; i = i + 1){{
+    head = Node(head);
+}}
+for(var i = 0; i < 300000; i = i + 1){{
+    var garbage = Node(nil);
+}}
+)",
+        resident_instances);
+}
+
+static auto ToMicroseconds(std::chrono::nanoseconds duration) -> double
+{
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+struct CollectorMode {
+    char const* name;
+    std::chrono::microseconds pause_budget;
+    bool concurrent;
+    bool lazy_sweeping = true;
+    bool background_freeing = false;
+};
+
+static auto Run(uint32_t resident_instances, CollectorMode const& mode) -> int
+{
+    std::string output;
+    VirtualMachine vm(&output);
+    vm.SetGCPauseBudget(mode.pause_budget);
+    vm.SetConcurrentGC(mode.concurrent);
+    vm.SetGCLazySweeping(mode.lazy_sweeping);
+    vm.SetGCBackgroundFreeing(mode.background_freeing);
+    Source source;
+    source.Append(ChurnScript(resident_instances));
+    auto const start = std::chrono::steady_clock::now();
+    if (auto result = vm.Interpret(source); !result) {
+        fmt::print(stderr, "Benchmark script failed: {}\n", result.error().error_message);
+        return 1;
+    }
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    auto const& collections = vm.GarbageCollections();
+    auto const mean_minor_pause = collections.minor_collections == 0 ? 0.0 : ToMicroseconds(collections.total_minor_pause) / static_cast<double>(collections.minor_collections);
+    fmt::print("{:>10} {:>12} {:>8} {:>16.1f} {:>16.1f} {:>8} {:>8} {:>16.1f} {:>16.1f} {:>16.1f} {:>12} {:>14.1f} {:>10.2f}\n", resident_instances,
+        mode.name, collections.minor_collections, mean_minor_pause, ToMicroseconds(collections.longest_minor_pause), collections.major_collections,
+        collections.incremental_steps, ToMicroseconds(collections.longest_major_pause), ToMicroseconds(collections.longest_post_mark_pause),
+        ToMicroseconds(collections.longest_time_to_first_allocation), collections.marker_lock_waits,
+        ToMicroseconds(collections.longest_marker_lock_wait), ToMilliseconds(elapsed));
+    return 0;
+}
+
+int main()
+{
+    auto const modes = std::array {
+        CollectorMode { "eager sweep", std::chrono::microseconds { 0 }, false, false },
+        CollectorMode { "lazy sweep", std::chrono::microseconds { 0 }, false },
+        CollectorMode { "background", std::chrono::microseconds { 0 }, false, true, true },
+        CollectorMode { "incremental", DEFAULT_GC_PAUSE_BUDGET, false },
+        CollectorMode { "concurrent", DEFAULT_GC_PAUSE_BUDGET, true },
+    };
+    fmt::print("{:>10} {:>12} {:>8} {:>16} {:>16} {:>8} {:>8} {:>16} {:>16} {:>16} {:>12} {:>14} {:>10}\n", "resident", "mode", "minor", "mean minor(us)",
+        "max minor(us)", "major", "slices", "max major(us)", "post-mark(us)", "first alloc(us)", "lock waits", "max wait(us)", "total(ms)");
+    for (auto const resident_instances : std::array { 10000U, 100000U, 400000U }) {
+        for (auto const& mode : modes) {
+            if (auto result = Run(resident_instances, mode); result != 0) {
+                return result;
+            }
+        }
+    }
+    return 0;
+}
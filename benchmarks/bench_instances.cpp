@@ -0,0 +1,110 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Memory per 1M small instances: builds a linked list of 1M instances with 2 fields and one of 1M instances with 6 fields
+// (two of them past the inline ones), each in a process of its own, and reports the size of an instance, the heap's bytes
+// and the growth of the resident set size per instance once a full collection has run. Re-configure with
+// -DLOX_POINTER_COMPRESSION=ON to compare 32 bit references into the heap cage with plain pointers.
+
+#include "benchmark.h"
+
+#include <array>
+#include <optional>
+#include <string_view>
+
+#ifdef __linux__
+static constexpr auto NUMBER_OF_INSTANCES = 1000000U;
+
+struct Script {
+    std::string_view name;
+    std::string_view source;
+};
+
+static constexpr auto SCRIPTS = std::array<Script, 2> {
+    Script { "2 fields", R"(
+class Node {
+  init(next) { this.next = next; this.value = 1; }
+}
+var head = nil;
+for (var i = 0; i < 1000000; i = i + 1) {
+  head = Node(head);
+}
+)" },
+    Script { "6 fields", R"(
+class Node {
+  init(next) { this.next = next; this.a = 1; this.b = 2; this.c = 3; this.d = 4; this.e = 5; }
+}
+var head = nil;
+for (var i = 0; i < 1000000; i = i + 1) {
+  head = Node(head);
+}
+)" },
+};
+
+struct Result {
+    double heap_bytes = 0;
+    double resident_bytes = 0;
+};
+
+// Runs the script in a child process of its own(see RunInChild)
+static auto RunChild(std::string_view script) -> std::optional<Result>
+{
+    std::string output;
+    VirtualMachine vm(&output);
+    Source source;
+    source.Append(script);
+    auto const resident_before = ResidentBytes();
+    auto const heap_before = vm.HeapBytes();
+    if (auto result = vm.Interpret(source); !result) {
+        fmt::print(stderr, "Benchmark script failed: {}\n", result.error().error_message);
+        return std::nullopt;
+    }
+    vm.CollectGarbage();
+    return Result {
+        .heap_bytes = static_cast<double>(vm.HeapBytes() - heap_before),
+        .resident_bytes = static_cast<double>(ResidentBytes()) - static_cast<double>(resident_before),
+    };
+}
+
+int main()
+{
+    fmt::print("pointer compression {}, sizeof(InstanceObject) {}, heap cell {}\n", POINTER_COMPRESSION_ENABLED ? "on" : "off",
+        sizeof(InstanceObject), (SlabAllocator::SizeClassOf(sizeof(InstanceObject)) + 1) * SlabAllocator::GRANULE);
+    fmt::print("{:>9} {:>16} {:>15} {:>15}\n", "instances", "heap(MB per 1M)", "rss(MB per 1M)", "rss(B/instance)");
+    for (auto const& [name, script] : SCRIPTS) {
+        auto const result = RunInChild<Result>([script] { return RunChild(script); });
+        if (!result.has_value()) {
+            return 1;
+        }
+        auto const per_instance = result->resident_bytes / NUMBER_OF_INSTANCES;
+        fmt::print("{:>9} {:>16.1f} {:>15.1f} {:>15.1f}\n", name, result->heap_bytes / (1024.0 * 1024.0), result->resident_bytes / (1024.0 * 1024.0),
+            per_instance);
+    }
+    return 0;
+}
+#else
+int main()
+{
+    fmt::print(stderr, "bench_instances needs fork() and /proc/self/statm\n");
+    return 0;
+}
+#endif
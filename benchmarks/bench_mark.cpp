@@ -0,0 +1,144 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Measures the marking throughput of stop-the-world major collections as the number of marking threads grows. Each
+// graph is built once per thread count and then kept alive while garbage is allocated, which triggers the major
+// collections that trace it. A long linked list can only be traced one node after another, the wide trees of instances
+// and of closures give the other threads subgraphs to steal. The code graph is made of compiled functions and their
+// string constants alone, which are immortal and not traced at all.
+
+#include "benchmark.h"
+
+#include <array>
+#include <chrono>
+#include <string>
+
+static constexpr auto CHURN = R"(
+class Garbage {}
+for(var i = 0; i < 2000000; i = i + 1){
+    var garbage = Garbage();
+}
+)";
+
+// 1'000'000 instances in one chain
+static constexpr auto LINKED_LIST = R"(
+class Node {
+    init(next) { this.next = next; }
+}
+var head = nil;
+for(var i = 0; i < 1000000; i = i + 1){
+    head = Node(head);
+}
+)";
+
+// 8-ary tree of depth 6, 299'593 instances with half of their fields in the overflow array
+static constexpr auto WIDE_TREE = R"(
+class Node {}
+fun build(depth) {
+    var node = Node();
+    if (depth > 0) {
+        node.c0 = build(depth - 1); node.c1 = build(depth - 1); node.c2 = build(depth - 1); node.c3 = build(depth - 1);
+        node.c4 = build(depth - 1); node.c5 = build(depth - 1); node.c6 = build(depth - 1); node.c7 = build(depth - 1);
+    }
+    return node;
+}
+var root = build(6);
+)";
+
+// 4-ary tree of depth 9, 349'525 closures that each capture their children in upvalues
+static constexpr auto CLOSURE_TREE = R"(
+fun build(depth) {
+    var a = nil; var b = nil; var c = nil; var d = nil;
+    if (depth > 0) {
+        a = build(depth - 1); b = build(depth - 1); c = build(depth - 1); d = build(depth - 1);
+    }
+    fun node() {
+        if (a) return a;
+        if (b) return b;
+        if (c) return c;
+        return d;
+    }
+    return node;
+}
+var root = build(9);
+)";
+
+// 5'000 global functions with 20 string constants each, none of them is ever called
+static auto CodeSource() -> std::string
+{
+    std::string source;
+    for (uint32_t function = 0; function < 5000; ++function) {
+        source += fmt::format("fun f{}() {{\n", function);
+        for (uint32_t constant = 0; constant < 20; ++constant) {
+            source += fmt::format("    var s{} = \"constant {} of f{}\";\n", constant, constant, function);
+        }
+        source += "}\n";
+    }
+    return source;
+}
+
+struct Graph {
+    char const* name;
+    std::string script;
+};
+
+static auto Run(Graph const& graph, uint32_t threads) -> int
+{
+    std::string output;
+    VirtualMachine vm(&output);
+    vm.SetGCPauseBudget(std::chrono::microseconds { 0 });
+    vm.SetGCMarkThreads(threads, 0);
+    Source source;
+    source.Append(graph.script);
+    source.Append(CHURN);
+    if (auto result = vm.Interpret(source); !result) {
+        fmt::print(stderr, "Benchmark script failed: {}\n", result.error().error_message);
+        return 1;
+    }
+    auto const& collections = vm.GarbageCollections();
+    auto const marked_megabytes = static_cast<double>(collections.major_marked_bytes) / (1024.0 * 1024.0);
+    auto const mark_seconds = std::chrono::duration<double>(collections.total_major_mark_time).count();
+    fmt::print("{:>14} {:>8} {:>8} {:>14.1f} {:>14.1f} {:>10.1f} {:>16.1f}\n", graph.name, threads, collections.major_collections,
+        marked_megabytes, ToMilliseconds(collections.total_major_mark_time), ToMilliseconds(collections.longest_major_pause),
+        mark_seconds == 0.0 ? 0.0 : marked_megabytes / mark_seconds);
+    return 0;
+}
+
+int main()
+{
+    auto const graphs = std::array {
+        Graph { "linked list", LINKED_LIST },
+        Graph { "wide tree", WIDE_TREE },
+        Graph { "closure tree", CLOSURE_TREE },
+        Graph { "code", CodeSource() },
+    };
+    fmt::print("{:>14} {:>8} {:>8} {:>14} {:>14} {:>10} {:>16}\n", "graph", "threads", "major", "marked(MB)", "mark time(ms)", "max pause(ms)",
+        "throughput(MB/s)");
+    for (auto const& graph : graphs) {
+        for (auto const threads : std::array { 1U, 2U, 4U, 8U }) {
+            if (auto result = Run(graph, threads); result != 0) {
+                return result;
+            }
+        }
+    }
+    return 0;
+}
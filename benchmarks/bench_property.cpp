@@ -0,0 +1,145 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Measures instance memory and property access latency:
+//  - memory: the number of bytes allocated per instance for classes with a few and with many fields, computed from the
+//    difference between two runs that allocate different numbers of instances
+//  - access: a loop that reads and writes the fields of an instance
+//  - method: a loop that calls methods, each call looks up the method by name on the receiver
+
+#include "benchmark.h"
+
+#include <array>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+// Every allocation goes through the replaced global operator new so that the benchmark can count the bytes allocated
+static uint64_t g_bytes_allocated = 0;
+
+void* operator new(std::size_t size)
+{
+    g_bytes_allocated += size;
+    if (auto* pointer = std::malloc(size); pointer != nullptr) {
+        return pointer;
+    }
+    std::abort();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+static auto InstancesScript(uint32_t number_of_fields, uint32_t number_of_instances) -> std::string
+{
+    std::string initializer = "this.next = next;";
+    for (uint32_t i = 1; i < number_of_fields; ++i) {
+        initializer += fmt::format(" this.field{} = {};", i, i);
+    }
+    return fmt::format(R"(
+class Node {{
+    init(next) {{ {} }}
+}}
+var head = nil;
+for(var i = 0; i < {}; i = i + 1){{
+    head = Node(head);
+}}
+)",
+        initializer, number_of_instances);
+}
+
+static auto BytesPerInstance(uint32_t number_of_fields) -> double
+{
+    static constexpr auto SMALL_RUN = 10000U;
+    static constexpr auto LARGE_RUN = 20000U;
+    auto const measure = [number_of_fields](uint32_t number_of_instances) {
+        auto const script = InstancesScript(number_of_fields, number_of_instances);
+        auto const before = g_bytes_allocated;
+        static_cast<void>(RunScript(script));
+        return g_bytes_allocated - before;
+    };
+    auto const small = measure(SMALL_RUN);
+    auto const large = measure(LARGE_RUN);
+    return static_cast<double>(large - small) / static_cast<double>(LARGE_RUN - SMALL_RUN);
+}
+
+static constexpr auto ACCESS_SCRIPT = R"(
+class Point {
+    init(x, y) {
+        this.x = x;
+        this.y = y;
+    }
+}
+var point = Point(1, 2);
+{
+    var sum = 0;
+    for(var i = 0; i < 1000000; i = i + 1){
+        sum = sum + point.x * point.y;
+        point.x = point.x + 1;
+    }
+    print sum;
+}
+)";
+
+static constexpr auto METHOD_SCRIPT = R"(
+class Counter {
+    init() {
+        this.count = 0;
+    }
+    increment() {
+        this.count = this.count + 1;
+    }
+    value() {
+        return this.count;
+    }
+}
+var counter = Counter();
+{
+    for(var i = 0; i < 1000000; i = i + 1){
+        counter.increment();
+    }
+    print counter.value();
+}
+)";
+
+static auto Report(std::string_view name, std::string_view script) -> void
+{
+    auto const run = BestOf(5, script);
+    auto const ns_per_instruction = static_cast<double>(run.elapsed.count()) / static_cast<double>(run.instructions_executed);
+    fmt::print("{}: {} instructions, best {:.2f} ms, {:.3f} ns/instruction\n", name, run.instructions_executed, ToMilliseconds(run.elapsed), ns_per_instruction);
+}
+
+int main()
+{
+    for (auto const number_of_fields : std::array { 2U, 8U }) {
+        fmt::print("instance with {} fields: {:.1f} bytes allocated per instance\n", number_of_fields, BytesPerInstance(number_of_fields));
+    }
+    Report("property access", ACCESS_SCRIPT);
+    Report("method call", METHOD_SCRIPT);
+    return 0;
+}
@@ -0,0 +1,130 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// End-to-end wall time of a batch of short scripts, each one run by a VM of its own from construction to teardown like a
+// one-shot invocation of the interpreter would. Every script allocates a few MB and exits. Compares the default heap with
+// the region mode(HeapMode::REGION), which does not collect below its limit and allocates its blocks in arenas.
+
+#include "benchmark.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+static constexpr uint32_t RUNS_PER_BATCH = 20;
+static constexpr uint32_t REPETITIONS = 5;
+
+struct Script {
+    std::string_view name;
+    std::string_view source;
+};
+
+static constexpr auto SCRIPTS = std::array<Script, 3> {
+    // Builds a list of instances that survives until the end and walks it
+    Script { "list", R"(
+class Node {
+  init(value, next) { this.value = value; this.next = next; }
+}
+var list = nil;
+for (var i = 0; i < 20000; i = i + 1) {
+  list = Node(i, list);
+}
+var sum = 0;
+while (list != nil) {
+  sum = sum + list.value;
+  list = list.next;
+}
+)" },
+    // Short-lived closures
+    Script { "closures", R"(
+fun adder(n) {
+  fun add(x) { return x + n; }
+  return add;
+}
+var total = 0;
+for (var i = 0; i < 20000; i = i + 1) {
+  total = adder(i)(total);
+}
+)" },
+    // Short-lived instances with a few fields each
+    Script { "points", R"(
+class Point {
+  init(x, y) { this.x = x; this.y = y; }
+  add(other) { return Point(this.x + other.x, this.y + other.y); }
+}
+var p = Point(0, 0);
+for (var i = 0; i < 20000; i = i + 1) {
+  p = p.add(Point(i, i));
+}
+)" },
+};
+
+struct BatchResult {
+    std::chrono::nanoseconds elapsed {};
+    uint64_t collections = 0; // Of the whole batch
+};
+
+static auto RunBatch(std::string_view script, HeapOptions const& options) -> BatchResult
+{
+    auto result = BatchResult {};
+    auto const start = std::chrono::steady_clock::now();
+    for (uint32_t run = 0; run < RUNS_PER_BATCH; ++run) {
+        std::string output;
+        VirtualMachine vm(&output, options);
+        Source source;
+        source.Append(script);
+        if (auto interpreted = vm.Interpret(source); !interpreted) {
+            fmt::print(stderr, "Benchmark script failed: {}\n", interpreted.error().error_message);
+            std::exit(1);
+        }
+        result.collections += vm.GarbageCollections().minor_collections + vm.GarbageCollections().major_collections;
+    }
+    result.elapsed = std::chrono::steady_clock::now() - start;
+    return result;
+}
+
+static auto BestBatch(std::string_view script, HeapOptions const& options) -> BatchResult
+{
+    auto best = RunBatch(script, options);
+    for (uint32_t i = 1; i < REPETITIONS; ++i) {
+        auto const result = RunBatch(script, options);
+        if (result.elapsed < best.elapsed) {
+            best = result;
+        }
+    }
+    return best;
+}
+
+int main()
+{
+    fmt::print("{:>10} {:>14} {:>12} {:>14} {:>12}\n", "script", "heap", "batch(ms)", "per run(ms)", "collections");
+    for (auto const& [name, script] : SCRIPTS) {
+        for (auto const mode : { HeapMode::GENERATIONAL, HeapMode::REGION }) {
+            auto const result = BestBatch(script, HeapOptions { .mode = mode });
+            fmt::print("{:>10} {:>14} {:>12.1f} {:>14.3f} {:>12}\n", name, mode == HeapMode::REGION ? "region" : "generational",
+                ToMilliseconds(result.elapsed), ToMilliseconds(result.elapsed) / RUNS_PER_BATCH, result.collections);
+        }
+    }
+    return 0;
+}
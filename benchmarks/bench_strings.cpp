@@ -0,0 +1,121 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Concatenation-heavy scripts: one appends lines to a log string that ends up a few hundred KB long, the other builds
+// batches of 64KB strings, keeps them for a round and drops them. Reports the wall time, the peak and final resident set
+// size and the time spent in collections of each, every script in a process of its own. Re-configure with
+// -DLOX_LARGE_OBJECT_SPACE=OFF to compare the large object space with payloads allocated by malloc.
+
+#include "benchmark.h"
+
+#include <array>
+#include <chrono>
+#include <optional>
+#include <string_view>
+
+#ifdef __linux__
+#    include <sys/resource.h>
+
+struct Script {
+    std::string_view name;
+    std::string_view source;
+};
+
+static constexpr auto SCRIPTS = std::array<Script, 2> {
+    Script { "log", R"(
+var log = "";
+for (var i = 0; i < 4000; i = i + 1) {
+  log = log + "a line of the log that is about sixty characters long ......";
+}
+)" },
+    Script { "batches", R"(
+class Entry {
+  init(text, next) { this.text = text; this.next = next; }
+}
+var chunk = "0123456789abcdef";
+for (var i = 0; i < 12; i = i + 1) {
+  chunk = chunk + chunk;
+}
+var batch = nil;
+var tag = ""; // Makes every string of the batches a different one, equal strings are interned
+for (var round = 0; round < 20; round = round + 1) {
+  batch = nil;
+  for (var i = 0; i < 64; i = i + 1) {
+    tag = tag + ".";
+    batch = Entry(chunk + tag, batch);
+  }
+}
+)" },
+};
+
+struct Result {
+    double elapsed_ms = 0;
+    double gc_ms = 0;
+    double peak_resident_mb = 0;
+    double final_resident_mb = 0;
+};
+
+// Runs the script in a child process of its own(see RunInChild)
+static auto RunChild(std::string_view script) -> std::optional<Result>
+{
+    std::string output;
+    VirtualMachine vm(&output);
+    Source source;
+    source.Append(script);
+    auto const start = std::chrono::steady_clock::now();
+    if (auto result = vm.Interpret(source); !result) {
+        fmt::print(stderr, "Benchmark script failed: {}\n", result.error().error_message);
+        return std::nullopt;
+    }
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    auto usage = rusage {};
+    getrusage(RUSAGE_SELF, &usage);
+    auto const& stats = vm.GarbageCollections();
+    return Result {
+        .elapsed_ms = ToMilliseconds(elapsed),
+        .gc_ms = ToMilliseconds(stats.total_minor_pause + stats.total_major_pause),
+        .peak_resident_mb = static_cast<double>(usage.ru_maxrss) / 1024.0,
+        .final_resident_mb = static_cast<double>(ResidentBytes()) / (1024.0 * 1024.0),
+    };
+}
+
+int main()
+{
+    fmt::print("large object space {}\n", LARGE_OBJECT_SPACE_ENABLED ? "on" : "off");
+    fmt::print("{:>8} {:>10} {:>8} {:>14} {:>15}\n", "script", "time(ms)", "gc(ms)", "peak rss(MB)", "final rss(MB)");
+    for (auto const& [name, script] : SCRIPTS) {
+        auto const result = RunInChild<Result>([script] { return RunChild(script); });
+        if (!result.has_value()) {
+            return 1;
+        }
+        fmt::print("{:>8} {:>10.1f} {:>8.1f} {:>14.1f} {:>15.1f}\n", name, result->elapsed_ms, result->gc_ms, result->peak_resident_mb,
+            result->final_resident_mb);
+    }
+    return 0;
+}
+#else
+int main()
+{
+    fmt::print(stderr, "bench_strings needs fork() and /proc/self/statm\n");
+    return 0;
+}
+#endif
@@ -0,0 +1,90 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Measures the cost of the Value representation. Build once with -DLOX_NAN_BOXING=ON and once with OFF to compare
+// the NaN-boxed and the std::variant based Value:
+//  - arithmetic: a numeric loop that is dominated by pushing/popping doubles on the value stack
+//  - gc: keeps a linked list of instances alive while allocating garbage so that every collection re-marks the list
+//  - memory: the size of a Value and of an instance
+
+#include "benchmark.h"
+
+#include <array>
+
+#include "object.h"
+
+static constexpr auto ARITHMETIC_SCRIPT = R"(
+{
+    var a = 0;
+    var b = 1;
+    for(var i = 0; i < 1000000; i = i + 1){
+        a = a + b * 2 - i / 4;
+        b = -b;
+    }
+    print a;
+}
+)";
+
+static constexpr auto GC_SCRIPT = R"(
+class Node {
+    init(next, value) {
+        this.next = next;
+        this.value = value;
+    }
+}
+var head = nil;
+for(var i = 0; i < 2000; i = i + 1){
+    head = Node(head, i);
+}
+for(var i = 0; i < 200000; i = i + 1){
+    var garbage = "garbage" + "string";
+}
+print head.value;
+)";
+
+struct Benchmark {
+    std::string_view name;
+    std::string_view script;
+};
+
+static constexpr auto BENCHMARKS = std::array {
+    Benchmark { "arithmetic", ARITHMETIC_SCRIPT },
+    Benchmark { "gc", GC_SCRIPT },
+};
+
+int main()
+{
+#ifdef NAN_BOXING
+    fmt::print("value: NaN-boxed (LOX_NAN_BOXING=ON)\n");
+#else
+    fmt::print("value: std::variant (LOX_NAN_BOXING=OFF)\n");
+#endif
+    fmt::print("sizeof(Value)={} bytes, sizeof(InstanceObject)={} bytes({} inline fields)\n",
+        sizeof(Value), sizeof(InstanceObject), InstanceObject::INLINE_FIELD_CAPACITY);
+    fmt::print("{:<12} {:>14} {:>12} {:>16}\n", "script", "instructions", "best(ms)", "ns/instruction");
+    for (auto const& benchmark : BENCHMARKS) {
+        auto const run = BestOf(5, benchmark.script);
+        auto const ns_per_instruction = static_cast<double>(run.elapsed.count()) / static_cast<double>(run.instructions_executed);
+        fmt::print("{:<12} {:>14} {:>12.2f} {:>16.3f}\n", benchmark.name, run.instructions_executed, ToMilliseconds(run.elapsed), ns_per_instruction);
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_BENCHMARK_H
+#define LOX_CPP_BENCHMARK_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#ifdef __linux__
+#    include <sys/wait.h>
+#    include <unistd.h>
+#endif
+
+#include <fmt/core.h>
+
+#include "source.h"
+#include "virtual_machine.h"
+
+struct ScriptRun {
+    std::chrono::nanoseconds elapsed {};
+    uint64_t instructions_executed = 0;
+};
+
+// Compiles and runs the script on a fresh VM, the elapsed time includes compilation which is negligible for the
+// loop-heavy scripts these benchmarks use.
+[[nodiscard]] inline auto RunScript(std::string_view script) -> ScriptRun
+{
+    std::string output;
+    VirtualMachine vm(&output);
+    Source source;
+    source.Append(script);
+    auto const start = std::chrono::steady_clock::now();
+    auto result = vm.Interpret(source);
+    auto const end = std::chrono::steady_clock::now();
+    if (!result) {
+        fmt::print(stderr, "Benchmark script failed: {}\n", result.error().error_message);
+        std::exit(1);
+    }
+    return ScriptRun { .elapsed = end - start, .instructions_executed = vm.InstructionsExecuted() };
+}
+
+// Best-of-N timing, the minimum is the least noisy estimate on a shared machine
+[[nodiscard]] inline auto BestOf(uint32_t repetitions, std::string_view script) -> ScriptRun
+{
+    ScriptRun best = RunScript(script);
+    for (uint32_t i = 1; i < repetitions; ++i) {
+        auto run = RunScript(script);
+        if (run.elapsed < best.elapsed) {
+            best = run;
+        }
+    }
+    return best;
+}
+
+[[nodiscard]] inline auto ToMilliseconds(std::chrono::nanoseconds duration) -> double
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+#ifdef __linux__
+// Resident set size of the process in bytes, from /proc/self/statm
+[[nodiscard]] inline auto ResidentBytes() -> uint64_t
+{
+    auto* file = std::fopen("/proc/self/statm", "r");
+    if (file == nullptr) {
+        return 0;
+    }
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+    auto const fields = std::fscanf(file, "%llu %llu", &size, &resident);
+    std::fclose(file);
+    return fields == 2 ? static_cast<uint64_t>(resident) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+// Runs "child", which returns a std::optional<Result>, in a forked process and hands its result back through a pipe. A
+// measurement of memory or of what the process shares with its parent starts from a clean slate this way. Returns
+// std::nullopt if the child failed.
+template<typename Result, typename Child>
+[[nodiscard]] auto RunInChild(Child&& child) -> std::optional<Result>
+{
+    static_assert(std::is_trivially_copyable_v<Result>, "The result is copied through a pipe");
+    std::array<int, 2> fds {};
+    if (pipe(fds.data()) != 0) {
+        std::perror("pipe");
+        return std::nullopt;
+    }
+    std::fflush(stdout);
+    std::fflush(stderr);
+    auto const pid = fork();
+    if (pid < 0) {
+        std::perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return std::nullopt;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        auto const result = std::optional<Result> { child() };
+        auto const written = result.has_value() && write(fds[1], &*result, sizeof(Result)) == sizeof(Result);
+        close(fds[1]);
+        std::fflush(stdout);
+        std::fflush(stderr);
+        _exit(written ? 0 : 1);
+    }
+    close(fds[1]);
+    auto result = Result {};
+    auto received = size_t { 0 };
+    while (received < sizeof(Result)) {
+        auto const bytes = read(fds[0], reinterpret_cast<char*>(&result) + received, sizeof(Result) - received);
+        if (bytes <= 0) {
+            break;
+        }
+        received += static_cast<size_t>(bytes);
+    }
+    close(fds[0]);
+    auto status = 0;
+    waitpid(pid, &status, 0);
+    if (received != sizeof(Result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fmt::print(stderr, "The child process failed\n");
+        return std::nullopt;
+    }
+    return result;
+}
+#endif
+
+#endif // LOX_CPP_BENCHMARK_H
@@ -195,22 +195,52 @@ auto Disassemble_instruction(Chunk const& chunk, uint64_t offset) -> uint64_t
         return ++offset;
     }
     case OP_CLASS: {
-        fmt::print("{:#08x} OP_CLASS\n", offset);
-        return ++offset;
+        fmt::print("{:#08x} OP_CLASS {}\n", offset, getIndex(chunk.byte_code[offset + 1], chunk.byte_code[offset + 2]));
+        offset += 3;
+        return offset;
     }
     case OP_GET_PROPERTY: {
-        fmt::print("{:#08x} OP_GET_PROPERTY {}\n", offset, getIndex(chunk.byte_code[offset + 1], chunk.byte_code[offset + 2]));
-        offset += 3;
+        fmt::print("{:#08x} OP_GET_PROPERTY {} cache:{}\n", offset, getIndex(chunk.byte_code[offset + 1], chunk.byte_code[offset + 2]), getIndex(chunk.byte_code[offset + 3], chunk.byte_code[offset + 4]));
+        offset += 5;
         return offset;
     }
     case OP_SET_PROPERTY: {
-        fmt::print("{:#08x} OP_SET_PROPERTY {}\n", offset, getIndex(chunk.byte_code[offset + 1], chunk.byte_code[offset + 2]));
-        offset += 3;
+        fmt::print("{:#08x} OP_SET_PROPERTY {} cache:{}\n", offset, getIndex(chunk.byte_code[offset + 1], chunk.byte_code[offset + 2]), getIndex(chunk.byte_code[offset + 3], chunk.byte_code[offset + 4]));
+        offset += 5;
         return offset;
     }
     case OP_METHOD:
-        fmt::print("{:#08x} OP_METHOD\n", offset);
+        fmt::print("{:#08x} OP_METHOD {}\n", offset, getIndex(chunk.byte_code[offset + 1], chunk.byte_code[offset + 2]));
+        offset += 3;
+        return offset;
+    case OP_ADD_NUM:
+        fmt::print("{:#08x} OP_ADD_NUM\n", offset);
+        return ++offset;
+    case OP_SUBTRACT_NUM:
+        fmt::print("{:#08x} OP_SUBTRACT_NUM\n", offset);
         return ++offset;
+    case OP_MULTIPLY_NUM:
+        fmt::print("{:#08x} OP_MULTIPLY_NUM\n", offset);
+        return ++offset;
+    case OP_DIVIDE_NUM:
+        fmt::print("{:#08x} OP_DIVIDE_NUM\n", offset);
+        return ++offset;
+    case OP_LESS_NUM:
+        fmt::print("{:#08x} OP_LESS_NUM\n", offset);
+        return ++offset;
+    case OP_LESS_EQUAL_NUM:
+        fmt::print("{:#08x} OP_LESS_EQUAL_NUM\n", offset);
+        return ++offset;
+    case OP_GREATER_NUM:
+        fmt::print("{:#08x} OP_GREATER_NUM\n", offset);
+        return ++offset;
+    case OP_GREATER_EQUAL_NUM:
+        fmt::print("{:#08x} OP_GREATER_EQUAL_NUM\n", offset);
+        return ++offset;
+    case OP_INVOKE:
+        fmt::print("{:#08x} OP_INVOKE {} num_args:{} cache:{}\n", offset, getIndex(chunk.byte_code[offset + 1], chunk.byte_code[offset + 2]), getIndex(chunk.byte_code[offset + 3], chunk.byte_code[offset + 4]), getIndex(chunk.byte_code[offset + 5], chunk.byte_code[offset + 6]));
+        offset += 7;
+        return offset;
     }
     LOX_ASSERT(false);
 }
@@ -227,4 +257,5 @@ auto Chunk::Clear() -> void
     byte_code.clear();
     lines.clear();
     constant_pool.clear();
+    property_caches.clear();
 }
@@ -24,8 +24,10 @@
 #define LOX_CPP_CHUNK_H
 
 #include "error.h"
+#include "inline_cache.h"
 #include "value.h"
 
+#include <cstddef>
 #include <cstdint>
 #include <limits>
 #include <variant>
@@ -67,19 +69,33 @@ enum OpCode : uint8_t {
     OP_CLASS,
     OP_GET_PROPERTY,
     OP_SET_PROPERTY,
-    OP_METHOD
+    OP_METHOD,
+    OP_INVOKE,
+    // Number-only variants of the arithmetic and comparison instructions. The compiler never emits these, the VM
+    // rewrites(quickens) an instruction to its variant once it has seen it execute with two number operands.
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_LESS_NUM,
+    OP_LESS_EQUAL_NUM,
+    OP_GREATER_NUM,
+    OP_GREATER_EQUAL_NUM
 };
+static constexpr auto NUMBER_OF_OPCODES = static_cast<size_t>(OP_GREATER_EQUAL_NUM) + 1;
 
 static constexpr auto MAX_INDEX_SIZE = std::numeric_limits<uint16_t>::max();
 static constexpr auto MAX_NUMBER_CONSTANTS = MAX_INDEX_SIZE; // Currently we can only store as many constants that can be addressed by 16 bits
 static constexpr auto MAX_NUMBER_LOCAL_VARIABLES = MAX_INDEX_SIZE;
 static constexpr auto MAX_JUMP_OFFSET = MAX_INDEX_SIZE;
 static constexpr auto MAX_NUMBER_OF_FUNCTION_PARAMETERS = MAX_INDEX_SIZE;
+static constexpr auto MAX_NUMBER_PROPERTY_CACHES = MAX_INDEX_SIZE;
 
 struct Chunk {
     std::vector<uint8_t> byte_code;
     std::vector<int32_t> lines;
     std::vector<Value> constant_pool;
+    std::vector<PropertyCache> property_caches; // Indexed by the last operand of OP_GET_PROPERTY/OP_SET_PROPERTY/OP_INVOKE
     void Clear();
 };
 
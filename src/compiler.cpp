@@ -37,6 +37,7 @@
 #include "object.h"
 #include "scanner.h"
 #include "value.h"
+#include "verifier.h"
 
 using namespace std::string_literals;
 
@@ -103,11 +104,13 @@ static constexpr auto GetRule(TokenType type) -> ParseRule const*
 
 Compiler::Compiler(Heap& heap,
     ParserState& parser_state,
+    GlobalTable& globals,
     Compiler* parent_compiler,
     FunctionCompilerType function_type)
     : m_parent_compiler(parent_compiler)
     , m_heap(heap)
     , m_parser_state(parser_state)
+    , m_globals(globals)
     , m_function_type(function_type)
 {
     if (m_parent_compiler != nullptr) {
@@ -127,6 +130,12 @@ auto Compiler::CompileSource(Source const& source) -> CompilationErrorOr<Functio
 {
     m_parser_state.Initialize(source);
     m_source = &source;
+    if (not m_function->chunk.byte_code.empty()) {
+        // Every source gets its own top-level function, so that running it starts with the newly compiled code
+        m_function = m_heap.AllocateFunctionObject("TOP_LEVEL_SCRIPT", 0);
+        m_locals_state.Reset();
+        m_locals_state.locals.emplace_back("", 0);
+    }
 
     m_parser_state.Advance();
 
@@ -152,6 +161,16 @@ auto Compiler::endCompiler() -> FunctionObject*
     // However this return handles the case where functions don't have explicit return types and also the top-level script
     LOX_ASSERT(m_upvalues.size() <= MAX_INDEX_SIZE);
     m_function->upvalue_count = static_cast<uint16_t>(m_upvalues.size());
+    // The function is immortal and so are its constants, the constant pool is filled in without write barriers
+    m_heap.UpdateFootprint(m_function);
+    if (!m_parser_state.EncounteredError()) {
+        // Verify the chunk once here so that the VM can execute it without bounds checks
+        auto verification_result = VerifyFunction(*m_function, m_parent_compiler != nullptr, m_globals.Size());
+        if (!verification_result) {
+            auto const& token = m_parser_state.CurrentToken().has_value() ? m_parser_state.CurrentToken() : m_parser_state.PreviousToken();
+            m_parser_state.ReportError(token->line_number, GetTokenSpan(*token), verification_result.error().error_message);
+        }
+    }
     return m_function;
 }
 
@@ -318,7 +337,7 @@ auto Compiler::string(bool) -> void
 {
     LOX_ASSERT(m_parser_state.PreviousToken().has_value());
     LOX_ASSERT(m_parser_state.PreviousToken()->type == TokenType::STRING);
-    auto string_object = m_heap.AllocateStringObject(m_source->GetSource().substr(m_parser_state.PreviousToken()->start + 1, m_parser_state.PreviousToken()->length - 2));
+    auto string_object = m_heap.AllocateImmortalStringObject(m_source->GetSource().substr(m_parser_state.PreviousToken()->start + 1, m_parser_state.PreviousToken()->length - 2));
     this->addConstant(string_object);
 }
 
@@ -336,7 +355,7 @@ auto Compiler::classDeclaration() -> void
     declareVariable();
     emitByte(OP_CLASS);
     emitIndex(constant_index_result);
-    defineVariable(constant_index_result);
+    defineVariable(m_locals_state.current_scope_depth > 0 ? 0 : globalSlot(class_identifier_token));
 
     struct Defer {
         Defer(Compiler* compiler)
@@ -465,7 +484,7 @@ auto Compiler::setFunctionName() -> void
 auto Compiler::function(FunctionCompilerType function_type) -> void
 {
     // Setup the function compiler
-    Compiler function_compiler(m_heap, m_parser_state, this, function_type);
+    Compiler function_compiler(m_heap, m_parser_state, m_globals, this, function_type);
     function_compiler.m_within_class = this->m_within_class;
     function_compiler.m_source = this->m_source;
     function_compiler.setFunctionName();
@@ -473,8 +492,6 @@ auto Compiler::function(FunctionCompilerType function_type) -> void
         function_compiler.m_function_type = FunctionCompilerType::INITIALIZER;
     }
     ///////////////////////////////////////////////// Compile the function body ////////////////////////////////////////////////////////////////////////////////////////////
-    HeapContextManager heap_context_manager(m_heap, this, &function_compiler);
-
     function_compiler.beginScope();
     auto success = function_compiler.m_parser_state.Consume(TokenType::LEFT_PAREN);
     if (!success) {
@@ -606,7 +623,7 @@ auto Compiler::namedVariable(std::string_view new_local_identifier_name, bool ca
         get_op = OP_GET_UPVALUE;
     } else {
         // Global variable
-        index = identifierConstant(m_parser_state.PreviousToken().value());
+        index = globalSlot(m_parser_state.PreviousToken().value());
         set_op = OP_SET_GLOBAL;
         get_op = OP_GET_GLOBAL;
     }
@@ -645,12 +662,26 @@ auto Compiler::this_(bool) -> void
 auto Compiler::identifierConstant(Token const& token) -> uint16_t
 {
     LOX_ASSERT(token.type == TokenType::IDENTIFIER);
-    auto string_object_ptr = m_heap.AllocateStringObject(m_source->GetSource().substr(token.start, token.length));
+    auto string_object_ptr = m_heap.AllocateImmortalStringObject(m_source->GetSource().substr(token.start, token.length));
     currentChunk()->constant_pool.push_back(string_object_ptr);
     LOX_ASSERT(currentChunk()->constant_pool.size() <= MAX_NUMBER_CONSTANTS);
     return static_cast<uint16_t>(currentChunk()->constant_pool.size() - 1);
 }
 
+auto Compiler::newPropertyCache() -> uint16_t
+{
+    LOX_ASSERT(currentChunk()->property_caches.size() < MAX_NUMBER_PROPERTY_CACHES, "Exceeded the maximum number of property accesses in a function");
+    currentChunk()->property_caches.emplace_back();
+    return static_cast<uint16_t>(currentChunk()->property_caches.size() - 1);
+}
+
+auto Compiler::globalSlot(Token const& token) -> uint16_t
+{
+    LOX_ASSERT(token.type == TokenType::IDENTIFIER);
+    // The interned name is kept alive by the global table
+    return m_globals.Resolve(m_heap.AllocateStringObject(m_source->GetSource().substr(token.start, token.length)));
+}
+
 auto Compiler::emitIndex(uint16_t index) -> void
 {
     // Extract the 8 LSB's
@@ -685,12 +716,10 @@ auto Compiler::parseVariable(std::string_view error_message) -> ParseErrorOr<uin
         // Local variable
         return 0;
     }
-    auto index = identifierConstant(m_parser_state.PreviousToken().value());
-    LOX_ASSERT(index < MAX_NUMBER_CONSTANTS);
-    return index;
+    return globalSlot(m_parser_state.PreviousToken().value());
 }
 
-auto Compiler::defineVariable(uint16_t constant_pool_index) -> void
+auto Compiler::defineVariable(uint16_t global_slot) -> void
 {
     if (m_locals_state.current_scope_depth > 0) {
         // Local variable
@@ -698,7 +727,7 @@ auto Compiler::defineVariable(uint16_t constant_pool_index) -> void
         return;
     }
     emitByte(OP_DEFINE_GLOBAL);
-    emitIndex(static_cast<uint16_t>(constant_pool_index));
+    emitIndex(global_slot);
 }
 
 auto Compiler::declareVariable() -> void
@@ -985,9 +1014,18 @@ auto Compiler::dot(bool can_assign) -> void
         expression();
         emitByte(OP_SET_PROPERTY);
         emitIndex(constant_index);
+        emitIndex(newPropertyCache());
+    } else if (m_parser_state.Consume(TokenType::LEFT_PAREN)) {
+        // "instance.name(arguments)" looks up and calls the method in one instruction without creating a bound method
+        auto const num_args = argumentList();
+        emitByte(OP_INVOKE);
+        emitIndex(constant_index);
+        emitIndex(num_args);
+        emitIndex(newPropertyCache());
     } else {
         emitByte(OP_GET_PROPERTY);
         emitIndex(constant_index);
+        emitIndex(newPropertyCache());
     }
 }
 
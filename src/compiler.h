@@ -25,6 +25,7 @@
 
 #include "chunk.h"
 #include "error.h"
+#include "global_table.h"
 #include "heap.h"
 #include "object.h"
 #include "parser_state.h"
@@ -73,14 +74,13 @@ public:
     Compiler() = delete;
     Compiler(Heap& heap,
         ParserState& parser_state,
+        GlobalTable& globals,
         Compiler* parent_compiler = nullptr,
         FunctionCompilerType function_type = FunctionCompilerType::TOP_LEVEL_SCRIPT);
     [[nodiscard]] auto CompileSource(Source const& source) -> CompilationErrorOr<FunctionObject*>;
     [[maybe_unused]] auto DumpCompiledChunk() const -> void;
 
 private:
-    friend class Heap;
-
     // Compiler state
     Source const* m_source = nullptr;
     FunctionObject* m_function = nullptr;
@@ -89,6 +89,7 @@ private:
     bool m_within_class = false;
     Heap& m_heap;
     ParserState& m_parser_state;
+    GlobalTable& m_globals;
     FunctionCompilerType m_function_type = FunctionCompilerType::TOP_LEVEL_SCRIPT;
 
     struct LocalsState {
@@ -137,6 +138,8 @@ private:
     auto emitIndex(uint16_t index) -> void;
     [[nodiscard]] auto emitJump(OpCode op_code) -> uint64_t;
     [[nodiscard]] auto identifierConstant(Token const& token) -> uint16_t;
+    [[nodiscard]] auto globalSlot(Token const& token) -> uint16_t;
+    [[nodiscard]] auto newPropertyCache() -> uint16_t;
     auto patchJump(uint64_t offset) -> void;
     auto emitLoop(uint64_t loop_start) -> void;
     auto currentChunk() -> Chunk*;
@@ -161,7 +164,7 @@ private:
     auto variableDeclaration() -> void;
     [[nodiscard]] auto parseVariable(std::string_view error_message) -> ParseErrorOr<uint16_t>;
     auto declareVariable() -> void;
-    auto defineVariable(uint16_t constant_pool_index) -> void;
+    auto defineVariable(uint16_t global_slot) -> void;
     [[nodiscard]] auto resolveVariable(std::string_view identifier_name) -> std::optional<uint16_t>;
     [[nodiscard]] auto resolveUpvalue(std::string_view identifier_name) -> std::optional<uint16_t>;
     [[nodiscard]] auto addUpvalue(uint16_t index, Upvalue::Type type) -> uint16_t;
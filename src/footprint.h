@@ -0,0 +1,53 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_FOOTPRINT_H
+#define LOX_CPP_FOOTPRINT_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Bytes that containers own outside of their own object. The heap adds them to the size of the objects that own the
+// containers to pace its collections, so they follow the layout of the standard library closely but not exactly.
+
+template<typename Allocator>
+[[nodiscard]] auto StringBytes(std::basic_string<char, std::char_traits<char>, Allocator> const& string) -> size_t
+{
+    // Short strings are stored in the string object itself
+    return string.capacity() > std::string {}.capacity() ? string.capacity() + 1 : 0;
+}
+
+template<typename T, typename Allocator>
+[[nodiscard]] auto VectorBytes(std::vector<T, Allocator> const& vector) -> size_t
+{
+    return vector.capacity() * sizeof(T);
+}
+
+// A node per element holding the element, the link to the next node and the cached hash, plus the bucket array
+template<typename Map>
+[[nodiscard]] auto HashMapBytes(Map const& map) -> size_t
+{
+    return map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*)) + map.bucket_count() * sizeof(void*);
+}
+
+#endif // LOX_CPP_FOOTPRINT_H
@@ -0,0 +1,39 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "global_table.h"
+
+#include "chunk.h"
+#include "error.h"
+
+auto GlobalTable::Resolve(StringObject const* name) -> uint16_t
+{
+    if (auto it = m_slots.find(name); it != m_slots.end()) {
+        return it->second;
+    }
+    LOX_ASSERT(m_values.size() <= MAX_INDEX_SIZE, "Exceeded the maximum number of global variables");
+    auto const slot = static_cast<uint16_t>(m_values.size());
+    m_values.emplace_back(UndefinedType {});
+    m_names.push_back(name);
+    m_slots.emplace(name, slot);
+    return slot;
+}
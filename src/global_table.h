@@ -0,0 +1,65 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_GLOBAL_TABLE_H
+#define LOX_CPP_GLOBAL_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "object.h"
+#include "value.h"
+
+// Global variables live in a flat array. The compiler resolves every global name to a slot once, the VM then accesses
+// globals by slot index. Slots that have been resolved but not defined yet hold the UndefinedType sentinel.
+class GlobalTable {
+public:
+    // Returns the slot for the given name, a new undefined slot is created the first time a name is seen
+    [[nodiscard]] auto Resolve(StringObject const* name) -> uint16_t;
+
+    [[nodiscard]] auto Values() -> Value*
+    {
+        return m_values.data();
+    }
+    [[nodiscard]] auto Size() const -> size_t
+    {
+        return m_values.size();
+    }
+    [[nodiscard]] auto Name(uint16_t slot) const -> StringObject const*
+    {
+        return m_names[slot];
+    }
+    auto Define(StringObject const* name, Value value) -> void
+    {
+        m_values[Resolve(name)] = value;
+    }
+
+private:
+    friend class Heap;
+    std::vector<Value> m_values;
+    std::vector<StringObject const*> m_names;
+    std::unordered_map<StringObject const*, uint16_t, StringObjectHash> m_slots;
+};
+
+#endif // LOX_CPP_GLOBAL_TABLE_H
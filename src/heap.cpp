@@ -23,57 +23,441 @@
 #include "heap.h"
 
 #include "error.h"
+#include "footprint.h"
 #include "fmt/core.h"
 #include "object.h"
 #include "virtual_machine.h"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <cstddef>
 #include <cstdio>
+#include <functional>
+#include <limits>
+#include <mutex>
 #include <stdexcept>
 #include <string_view>
+#include <new>
+#include <ranges>
+#include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
-static constexpr auto HEAP_GROW_FACTOR = 2;
+#ifdef __GLIBC__
+#    include <malloc.h>
+#endif
+
+static constexpr auto INCREMENTAL_WORK_UNIT = 64U; // Objects traced or swept between two checks of the pause budget
+// A compaction is asked for once at least this many blocks, and this fraction of the blocks in use, could be given back
+static constexpr auto MIN_COMPACTION_BLOCKS = size_t { 8 };
+static constexpr auto COMPACTION_FRAGMENTATION_DIVISOR = size_t { 4 };
+// The region mode allocates its blocks in 2MB arenas
+static constexpr auto REGION_BLOCKS_PER_ARENA = size_t { 32 };
+#ifdef STRESS_TEST_GC
+static constexpr auto STRESS_MAJOR_COLLECTION_INTERVAL = 8U; // Every n'th stress collection is a major one
+#endif
+
+// Calls "visit" with every object "object" references and "visit_name" with the strings it references as names
+template<typename Visit, typename VisitName>
+static auto VisitReferences(Object* object, Visit&& visit, VisitName&& visit_name) -> void
+{
+    LOX_ASSERT(object != nullptr);
+    auto const visit_value = [&visit](Value value) {
+        if (value.IsObject()) {
+            visit(value.AsObjectPtr());
+        }
+    };
+    switch (object->GetType()) {
+    case ObjectType::STRING:
+    case ObjectType::NATIVE_FUNCTION:
+        break; // No outgoing references nothing to do
+    case ObjectType::UPVALUE: {
+        auto upvalue = static_cast<UpvalueObject*>(object);
+        if (upvalue->IsClosed()) {
+            visit_value(upvalue->GetClosedValue());
+        }
+        break;
+    }
+    case ObjectType::FUNCTION: {
+        auto function = static_cast<FunctionObject*>(object);
+        for (auto& constant : function->chunk.constant_pool) {
+            visit_value(constant);
+        }
+        break;
+    }
+    case ObjectType::CLOSURE: {
+        auto closure = static_cast<ClosureObject*>(object);
+        visit(closure->function);
+        for (auto const upvalue : closure->upvalues) {
+            visit(upvalue);
+        }
+        break;
+    }
+    case ObjectType::CLASS: {
+        auto class_obj_ptr = static_cast<ClassObject*>(object);
+        for (auto& [name, method] : class_obj_ptr->methods) {
+            visit_name(name);
+            visit(method);
+        }
+        class_obj_ptr->root_shape->VisitFieldNames(visit_name);
+        break;
+    }
+    case ObjectType::INSTANCE: {
+        auto instance = static_cast<InstanceObject*>(object);
+        // The field names are kept alive by the class' shape tree
+        visit(instance->class_);
+        for (uint32_t index = 0; index < instance->shape->FieldCount(); ++index) {
+            visit_value(instance->Field(index));
+        }
+        break;
+    }
+    case ObjectType::BOUND_METHOD: {
+        auto const& bound_method = static_cast<BoundMethodObject const*>(object);
+        visit(bound_method->receiver);
+        visit(bound_method->method);
+        break;
+    }
+    }
+}
+
+template<typename Forward>
+static auto ForwardValue(Value& value, Forward& forward) -> void
+{
+    if (value.IsObject()) {
+        value = Value(forward(value.AsObjectPtr()));
+    }
+}
+
+// Rehashes the map under the forwarded keys
+template<typename Map, typename Forward>
+static auto ForwardKeys(Map& map, Forward& forward) -> void
+{
+    auto forwarded = Map {};
+    forwarded.reserve(map.size());
+    while (!map.empty()) {
+        auto node = map.extract(map.begin());
+        node.key() = forward(node.key());
+        forwarded.insert(std::move(node));
+    }
+    map = std::move(forwarded);
+}
+
+// Replaces every reference "object" holds with "forward(reference)", including the names of its class and the methods
+// its inline caches point to
+template<typename Forward>
+static auto ForwardReferences(Object* object, Forward& forward) -> void
+{
+    switch (object->GetType()) {
+    case ObjectType::STRING:
+    case ObjectType::NATIVE_FUNCTION:
+        break;
+    case ObjectType::UPVALUE: {
+        auto* upvalue = static_cast<UpvalueObject*>(object);
+        if (upvalue->IsClosed()) {
+            auto value = upvalue->GetClosedValue();
+            ForwardValue(value, forward);
+            upvalue->SetClosedValue(value);
+        }
+        break;
+    }
+    case ObjectType::FUNCTION: {
+        auto& chunk = static_cast<FunctionObject*>(object)->chunk;
+        for (auto& constant : chunk.constant_pool) {
+            ForwardValue(constant, forward);
+        }
+        // Entries of dead shapes may point to closures that are gone, the forwarding only looks the pointers up
+        for (auto& cache : chunk.property_caches) {
+            for (uint8_t i = 0; i < cache.size; ++i) {
+                if (cache.entries[i].kind == PropertyCacheEntry::Kind::METHOD) {
+                    cache.entries[i].method = forward(cache.entries[i].method);
+                }
+            }
+        }
+        break;
+    }
+    case ObjectType::CLOSURE: {
+        auto* closure = static_cast<ClosureObject*>(object);
+        closure->function = forward(closure->function.Get());
+        for (auto& upvalue : closure->upvalues) {
+            upvalue = forward(upvalue.Get());
+        }
+        break;
+    }
+    case ObjectType::CLASS: {
+        auto* class_object = static_cast<ClassObject*>(object);
+        ForwardKeys(class_object->methods, forward);
+        for (auto& [name, method] : class_object->methods) {
+            method = forward(method);
+        }
+        class_object->root_shape->ForwardFieldNames(forward);
+        break;
+    }
+    case ObjectType::INSTANCE: {
+        auto* instance = static_cast<InstanceObject*>(object);
+        instance->class_ = forward(instance->class_.Get());
+        for (uint32_t index = 0; index < instance->shape->FieldCount(); ++index) {
+            ForwardValue(instance->Field(index), forward);
+        }
+        break;
+    }
+    case ObjectType::BOUND_METHOD: {
+        auto* bound_method = static_cast<BoundMethodObject*>(object);
+        bound_method->receiver = forward(bound_method->receiver.Get());
+        bound_method->method = forward(bound_method->method.Get());
+        break;
+    }
+    }
+}
+
+[[nodiscard]] static auto ObjectFootprint(Object const* object) -> size_t
+{
+    switch (object->GetType()) {
+    case ObjectType::STRING:
+        return sizeof(StringObject) + StringBytes(static_cast<StringObject const*>(object)->data);
+    case ObjectType::FUNCTION: {
+        auto const* function = static_cast<FunctionObject const*>(object);
+        auto const& chunk = function->chunk;
+        return sizeof(FunctionObject) + StringBytes(function->function_name) + VectorBytes(chunk.byte_code) + VectorBytes(chunk.lines)
+            + VectorBytes(chunk.constant_pool) + VectorBytes(chunk.property_caches);
+    }
+    case ObjectType::CLOSURE:
+        return sizeof(ClosureObject) + VectorBytes(static_cast<ClosureObject const*>(object)->upvalues);
+    case ObjectType::NATIVE_FUNCTION:
+        return sizeof(NativeFunctionObject);
+    case ObjectType::UPVALUE:
+        return sizeof(UpvalueObject);
+    case ObjectType::CLASS: {
+        auto const* class_object = static_cast<ClassObject const*>(object);
+        return sizeof(ClassObject) + HashMapBytes(class_object->methods) + StringBytes(class_object->class_name) + class_object->root_shape->TreeBytes();
+    }
+    case ObjectType::INSTANCE:
+        return sizeof(InstanceObject) + static_cast<InstanceObject const*>(object)->OverflowBytes();
+    case ObjectType::BOUND_METHOD:
+        return sizeof(BoundMethodObject);
+    }
+    __builtin_unreachable();
+}
+
+// Runs the destructor of the object, its memory is left to the caller. Dead objects are unreachable from the program, this
+// is safe to do on the sweeper thread.
+static auto DestroyObject(Object* object) -> void
+{
+    switch (object->GetType()) {
+    case ObjectType::STRING:
+        GCDebugLog("Freeing object of type STRING");
+        static_cast<StringObject*>(object)->~StringObject();
+        break;
+    case ObjectType::FUNCTION:
+        GCDebugLog("Freeing object of type FUNCTION");
+        static_cast<FunctionObject*>(object)->~FunctionObject();
+        break;
+    case ObjectType::CLOSURE:
+        GCDebugLog("Freeing object of type CLOSURE");
+        static_cast<ClosureObject*>(object)->~ClosureObject();
+        break;
+    case ObjectType::NATIVE_FUNCTION:
+        GCDebugLog("Freeing object of type NATIVE_FUNCTION");
+        static_cast<NativeFunctionObject*>(object)->~NativeFunctionObject();
+        break;
+    case ObjectType::UPVALUE:
+        GCDebugLog("Freeing object of type UPVALUE");
+        static_cast<UpvalueObject*>(object)->~UpvalueObject();
+        break;
+    case ObjectType::CLASS:
+        GCDebugLog("Freeing object of type CLASS");
+        static_cast<ClassObject*>(object)->~ClassObject();
+        break;
+    case ObjectType::INSTANCE:
+        GCDebugLog("Freeing object of type Instance");
+        static_cast<InstanceObject*>(object)->~InstanceObject();
+        break;
+    case ObjectType::BOUND_METHOD:
+        GCDebugLog("Freeing object of type BoundMethod");
+        static_cast<BoundMethodObject*>(object)->~BoundMethodObject();
+        break;
+    }
+}
+
+// Move-constructs the object into "cell", the moved-from object is left to the caller to destroy
+template<typename T>
+static auto MoveConstructObject(Object* object, void* cell) -> Object*
+{
+    return new (cell) T(std::move(*static_cast<T*>(object)));
+}
 
-Heap::Heap(VirtualMachine& vm)
-    : m_vm(vm)
+static auto CountAllocation(AllocationStats& stats, ObjectType type, size_t bytes, uint64_t heap_bytes) -> void
 {
+    auto const index = static_cast<size_t>(type);
+    ++stats.objects[index];
+    stats.bytes[index] += bytes;
+    stats.peak_heap_bytes = std::max(stats.peak_heap_bytes, heap_bytes);
+}
+
+Heap::Heap(VirtualMachine& vm, HeapOptions const& options)
+    : m_options(options)
+    , m_next_collection_threhold(options.min_heap_bytes)
+    , m_collections_deferred(options.mode == HeapMode::REGION)
+    , m_vm(vm)
+    , m_allocator(options.mode == HeapMode::REGION ? REGION_BLOCKS_PER_ARENA : 1)
+{
+    LOX_ASSERT(options.growth_ratio >= 1.0, "The heap can not be smaller than its live objects");
+    LOX_ASSERT(options.min_heap_bytes <= options.max_heap_bytes);
 }
 
 Heap::~Heap()
 {
+    stopMarkerThread();
+    stopSweeperThread();
+    releaseDestroyedObjects();
+    m_background_freeing = false; // The remaining objects are freed right away
     reset();
 }
 
 auto Heap::reset() -> void
 {
-    auto current = m_head;
-    while (current != nullptr) {
-        auto next = current->next;
-        freeObject(current);
-        current = next;
+    // The cells are not freed one by one, the blocks are given back whole once their objects are destroyed
+    for (auto* allocator : { &m_allocator, &m_immortal_allocator }) {
+        for (auto* block : allocator->Blocks()) {
+            block->ForEachCell([block](uint32_t word) { return block->allocated[word]; }, [](void* cell) { DestroyObject(static_cast<Object*>(cell)); });
+        }
+        allocator->ReleaseAll();
+    }
+    m_number_of_heap_objects_allocated = 0;
+    m_bytes_allocated = 0;
+    m_immortal_bytes = 0;
+    m_young_bytes_allocated = 0;
+    for (auto& blocks : m_unswept_blocks) {
+        blocks.clear();
+    }
+    m_unswept_block_count = 0;
+    m_phase = CollectionPhase::IDLE;
+    m_greyed_objects.clear();
+    m_suspended_greyed_objects.clear();
+    m_remembered_set.clear();
+    m_interned_strings.clear();
+}
+
+auto Heap::startSweeperThread() -> void
+{
+    if (!m_sweeper_thread.joinable()) {
+        m_sweeper_thread = std::thread([this] { runSweeperThread(); });
+    }
+}
+
+auto Heap::stopSweeperThread() -> void
+{
+    handOverDeadObjects();
+    if (!m_sweeper_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard const lock(m_sweeper_mutex);
+        m_sweeper_shutdown = true;
+    }
+    m_sweeper_wakeup.notify_one();
+    m_sweeper_thread.join();
+    m_sweeper_shutdown = false;
+}
+
+auto Heap::runSweeperThread() -> void
+{
+    std::unique_lock lock(m_sweeper_mutex);
+    while (true) {
+        m_sweeper_wakeup.wait(lock, [this] { return !m_objects_to_destroy.empty() || m_sweeper_shutdown; });
+        if (m_objects_to_destroy.empty()) {
+            return; // Shutting down, everything that was handed over has been destroyed
+        }
+        auto const objects = std::exchange(m_objects_to_destroy, {});
+        lock.unlock();
+        for (auto* object : objects) {
+            DestroyObject(object);
+        }
+        lock.lock();
+        m_destroyed_objects.insert(m_destroyed_objects.end(), objects.begin(), objects.end());
+    }
+}
+
+auto Heap::handOverDeadObjects() -> void
+{
+    if (m_dead_objects.empty()) {
+        return;
+    }
+    startSweeperThread();
+    m_collection_stats.objects_freed_in_background += m_dead_objects.size();
+    {
+        std::lock_guard const lock(m_sweeper_mutex);
+        m_objects_to_destroy.insert(m_objects_to_destroy.end(), m_dead_objects.begin(), m_dead_objects.end());
+    }
+    m_dead_objects.clear();
+    m_sweeper_wakeup.notify_one();
+}
+
+auto Heap::releaseDestroyedObjects() -> void
+{
+    auto destroyed = std::vector<void*> {};
+    {
+        std::lock_guard const lock(m_sweeper_mutex);
+        destroyed.swap(m_destroyed_objects);
+    }
+    for (auto* cell : destroyed) {
+        m_allocator.Reclaim(cell);
     }
-    m_head = nullptr;
 }
 
 auto Heap::AllocateStringObject(std::string_view string_data) -> StringObject*
 {
-    auto* object_ptr = allocateObject(ObjectType::STRING);
+    return internString(string_data, false);
+}
+
+auto Heap::AllocateStringObjectFromBuffer(LoxString&& string_data) -> StringObject*
+{
+    return internString(string_data, false, std::move(string_data));
+}
+
+auto Heap::AllocateImmortalStringObject(std::string_view string_data) -> StringObject*
+{
+    return internString(string_data, true);
+}
+
+auto Heap::internString(std::string_view string_data, bool immortal, LoxString&& buffer) -> StringObject*
+{
+    if (auto it = m_interned_strings.find(string_data); it != m_interned_strings.end()) {
+        auto* string_object_ptr = *it;
+        if (immortal) {
+            // The string stays where it is, the sweeps leave it alone from now on(even if it was already found dead)
+            string_object_ptr->immortal = true;
+        } else if (m_phase != CollectionPhase::IDLE && string_object_ptr->old) {
+            // The string may have been unreachable when marking started or be waiting to be swept, marking it keeps the
+            // sweep from freeing it. Strings have no outgoing references so they never need to be greyed, marking one
+            // that is live or was already swept only keeps it alive for another collection.
+            string_object_ptr->MarkObjectAsReachable();
+        }
+        return string_object_ptr;
+    }
+    auto* object_ptr = allocateObject(ObjectType::STRING, immortal);
     LOX_ASSERT(object_ptr->type == ObjectType::STRING);
     auto string_object_ptr = static_cast<StringObject*>(object_ptr);
-    string_object_ptr->data = string_data;
-    ;
+    string_object_ptr->hash = StringObject::HashString(string_data);
+    if (buffer.empty()) {
+        buffer = string_data;
+    }
+    string_object_ptr->data = std::move(buffer); // "string_data" may point into the buffer, it is dangling from here on
+    UpdateFootprint(string_object_ptr);
+    m_interned_strings.insert(string_object_ptr);
     return string_object_ptr;
 }
 
 auto Heap::AllocateFunctionObject(std::string_view function_name, uint32_t arity) -> FunctionObject*
 {
-    auto* object_ptr = allocateObject(ObjectType::FUNCTION);
+    auto* object_ptr = allocateObject(ObjectType::FUNCTION, true);
     LOX_ASSERT(object_ptr->type == ObjectType::FUNCTION);
     auto function_object_ptr = static_cast<FunctionObject*>(object_ptr);
     function_object_ptr->function_name = function_name;
     function_object_ptr->arity = arity;
-    ;
+    UpdateFootprint(function_object_ptr);
     return function_object_ptr;
 }
 
@@ -89,7 +473,7 @@ auto Heap::AllocateClosureObject(FunctionObject* function) -> ClosureObject*
 
 auto Heap::AllocateNativeFunctionObject(NativeFunction function) -> NativeFunctionObject*
 {
-    auto* object_ptr = allocateObject(ObjectType::NATIVE_FUNCTION);
+    auto* object_ptr = allocateObject(ObjectType::NATIVE_FUNCTION, true);
     LOX_ASSERT(object_ptr->type == ObjectType::NATIVE_FUNCTION);
     auto native_function_object_ptr = static_cast<NativeFunctionObject*>(object_ptr);
     native_function_object_ptr->native_function = function;
@@ -111,7 +495,7 @@ auto Heap::AllocateClassObject(std::string_view class_name) -> ClassObject*
     LOX_ASSERT(object_ptr->type == ObjectType::CLASS);
     auto class_object_ptr = static_cast<ClassObject*>(object_ptr);
     class_object_ptr->class_name = class_name;
-    ;
+    UpdateFootprint(class_object_ptr);
     return class_object_ptr;
 }
 
@@ -121,7 +505,7 @@ auto Heap::AllocateInstanceObject(ClassObject* class_) -> InstanceObject*
     LOX_ASSERT(object_ptr->type == ObjectType::INSTANCE);
     auto instance_object_ptr = static_cast<InstanceObject*>(object_ptr);
     instance_object_ptr->class_ = class_;
-    ;
+    instance_object_ptr->shape = class_->root_shape.get();
     return instance_object_ptr;
 }
 auto Heap::AllocateBoundMethodObject(InstanceObject* instance, ClosureObject* method) -> BoundMethodObject*
@@ -134,190 +518,766 @@ auto Heap::AllocateBoundMethodObject(InstanceObject* instance, ClosureObject* me
     return bound_method_object_ptr;
 }
 
-auto Heap::allocateObject(ObjectType type) -> Object*
+auto Heap::allocateObject(ObjectType type, bool immortal) -> Object*
 {
+    if (m_collections_deferred) [[unlikely]] {
+        m_collections_deferred = m_bytes_allocated <= m_options.region_limit_bytes;
+    }
+    if (!m_collections_deferred) {
 #ifdef STRESS_TEST_GC
-    collectGarbage();
+        auto const collections = m_collection_stats.minor_collections + m_collection_stats.major_collections + m_collection_stats.incremental_steps;
+        collect((collections + 1) % STRESS_MAJOR_COLLECTION_INTERVAL == 0 || m_bytes_allocated > m_next_collection_threhold);
 #else
-    if (m_bytes_allocated > m_next_collection_threhold) {
-        collectGarbage();
-    }
+        if (m_young_bytes_allocated > m_options.nursery_bytes) {
+            collect(m_bytes_allocated > m_next_collection_threhold);
+        }
 #endif
+    }
     ++m_number_of_heap_objects_allocated;
-    return insertAtHead([type, this]() -> Object* {
+    ++m_total_objects_allocated;
+    auto* object = [type, immortal, this]() -> Object* {
         switch (type) {
-        case ObjectType::STRING: {
+        case ObjectType::STRING:
             GCDebugLog("Heap::allocateObject ObjectType::STRING");
-            auto ptr = new StringObject;
-            m_bytes_allocated += sizeof(*ptr);
-            return ptr;
-        }
-        case ObjectType::FUNCTION: {
+            return constructObject<StringObject>(immortal);
+        case ObjectType::FUNCTION:
             GCDebugLog("Heap::allocateObject ObjectType::FUNCTION");
-            auto ptr = new FunctionObject;
-            m_bytes_allocated += sizeof(*ptr);
-            return ptr;
-        }
-        case ObjectType::CLOSURE: {
+            return constructObject<FunctionObject>(immortal);
+        case ObjectType::CLOSURE:
             GCDebugLog("Heap::allocateObject ObjectType::CLOSURE");
-            auto ptr = new ClosureObject;
-            m_bytes_allocated += sizeof(*ptr);
-            return ptr;
-        }
-        case ObjectType::NATIVE_FUNCTION: {
+            return constructObject<ClosureObject>(immortal);
+        case ObjectType::NATIVE_FUNCTION:
             GCDebugLog("Heap::allocateObject ObjectType::NATIVE_FUNCTION");
-            auto ptr = new NativeFunctionObject;
-            m_bytes_allocated += sizeof(*ptr);
-            return ptr;
-        }
-        case ObjectType::UPVALUE: {
+            return constructObject<NativeFunctionObject>(immortal);
+        case ObjectType::UPVALUE:
             GCDebugLog("Heap::allocateObject ObjectType::UPVALUE");
-            auto ptr = new UpvalueObject;
-            m_bytes_allocated += sizeof(*ptr);
-            return ptr;
-        }
-        case ObjectType::CLASS: {
+            return constructObject<UpvalueObject>(immortal);
+        case ObjectType::CLASS:
             GCDebugLog("Heap::allocateObject ObjectType::CLASS");
-            auto ptr = new ClassObject;
-            m_bytes_allocated += sizeof(*ptr);
-            return ptr;
-        }
-        case ObjectType::INSTANCE: {
+            return constructObject<ClassObject>(immortal);
+        case ObjectType::INSTANCE:
             GCDebugLog("Heap::allocateObject ObjectType::INSTANCE");
-            auto ptr = new InstanceObject;
-            m_bytes_allocated += sizeof(*ptr);
-            return ptr;
-        }
-        case ObjectType::BOUND_METHOD: {
+            return constructObject<InstanceObject>(immortal);
+        case ObjectType::BOUND_METHOD:
             GCDebugLog("Heap::allocateObject ObjectType::BOUND_METHOD");
-            auto ptr = new BoundMethodObject;
-            m_bytes_allocated += sizeof(*ptr);
-            return ptr;
-        }
+            return constructObject<BoundMethodObject>(immortal);
         }
         __builtin_unreachable();
-    }());
+    }();
+    if (m_major_collection_start.has_value()) {
+        auto const time_to_allocation = Clock::now() - *m_major_collection_start;
+        m_collection_stats.longest_time_to_first_allocation = std::max(m_collection_stats.longest_time_to_first_allocation, time_to_allocation);
+        m_major_collection_start.reset();
+    }
+    return object;
 }
 
-auto Heap::insertAtHead(Object* new_node) -> Object*
+template<typename T>
+auto Heap::constructObject(bool immortal) -> Object*
 {
-    LOX_ASSERT(new_node != nullptr);
-    if (m_head == nullptr) {
-        m_head = new_node;
-    } else {
-        new_node->next = m_head;
-        m_head = new_node;
+    if (immortal) {
+        // Marked for good, immortal blocks are never swept
+        auto* cell = m_immortal_allocator.Allocate(sizeof(T));
+        (void)SlabAllocator::TryMark(cell);
+        auto* object = new (cell) T;
+        object->old = true;
+        object->immortal = true;
+        object->footprint = sizeof(T);
+        m_bytes_allocated += sizeof(T);
+        m_immortal_bytes += sizeof(T);
+        CountAllocation(m_allocation_stats, object->GetType(), sizeof(T), m_bytes_allocated);
+        return object;
+    }
+    if (m_phase == CollectionPhase::LAZY_SWEEPING && m_allocator.NeedsNewBlock(sizeof(T))) {
+        sweepLazily(sizeof(T));
     }
-    return new_node;
+    auto* object = new (m_allocator.Allocate(sizeof(T))) T;
+    object->footprint = sizeof(T);
+    m_bytes_allocated += sizeof(T);
+    m_young_bytes_allocated += sizeof(T);
+    CountAllocation(m_allocation_stats, object->GetType(), sizeof(T), m_bytes_allocated);
+    return object;
 }
 
-auto Heap::collectGarbage() -> void
+auto Heap::UpdateFootprint(Object* object) -> void
+{
+    auto const footprint = ObjectFootprint(object);
+    LOX_ASSERT(footprint <= std::numeric_limits<uint32_t>::max(), "Object too large");
+    auto const counted = size_t { object->footprint };
+    m_bytes_allocated = m_bytes_allocated + footprint - counted;
+    if (object->immortal) {
+        // Pinned strings never change, only objects of the immortal space get here
+        m_immortal_bytes = m_immortal_bytes + footprint - counted;
+    }
+    if (!object->old && footprint > counted) {
+        m_young_bytes_allocated += footprint - counted;
+    }
+    if (footprint > counted) {
+        m_allocation_stats.bytes[static_cast<size_t>(object->GetType())] += footprint - counted;
+        m_allocation_stats.peak_heap_bytes = std::max(m_allocation_stats.peak_heap_bytes, m_bytes_allocated);
+    }
+    object->footprint = static_cast<uint32_t>(footprint);
+}
+
+auto Heap::remember(Object* object) -> void
+{
+    object->remembered = true;
+    m_remembered_set.push_back(object);
+}
+
+auto Heap::clearRememberedSet() -> void
+{
+    // With no young objects there are no old to young references left to remember
+    for (auto* object : m_remembered_set) {
+        object->remembered = false;
+    }
+    m_remembered_set.clear();
+}
+
+auto Heap::shade(Object const* object) -> void
+{
+    markRoot(const_cast<Object*>(object));
+}
+
+auto Heap::inMarkScope(Object const* object) const -> bool
+{
+    switch (m_mark_scope) {
+    case MarkScope::ALL:
+        return true;
+    case MarkScope::YOUNG:
+        return !object->old;
+    case MarkScope::OLD:
+        return object->old;
+    }
+    __builtin_unreachable();
+}
+
+auto Heap::collect(bool major_collection_due) -> void
+{
+    releaseDestroyedObjects();
+    if (m_phase == CollectionPhase::LAZY_SWEEPING) {
+        if (!major_collection_due) {
+            collectGarbage(CollectionKind::MINOR);
+            return;
+        }
+        // Marking relies on the old generation's mark bits having been cleared by the sweep
+        finishLazySweeping();
+    }
+    if (m_pause_budget.count() == 0 && !m_concurrent_marking && m_phase == CollectionPhase::IDLE) {
+        collectGarbage(major_collection_due ? CollectionKind::MAJOR : CollectionKind::MINOR);
+        return;
+    }
+    // A collection that is already under way is finished incrementally even if the budget has since been set to zero
+    auto const start = Clock::now();
+    // The marker thread is paused while the collector runs on this thread
+    auto const marker_lock = m_concurrent_cycle ? lockMarker() : std::unique_lock<std::mutex> {};
+    collectGarbage(CollectionKind::MINOR);
+    if (m_phase == CollectionPhase::IDLE && !major_collection_due) {
+        return;
+    }
+#ifdef STRESS_TEST_GC
+    // Do as little work as possible per slice to interleave the slices with as many mutations as possible
+    incrementalStep(start);
+#else
+    // The minor collection counts towards the pause
+    incrementalStep(start + m_pause_budget);
+#endif
+}
+
+auto Heap::CollectGarbage() -> void
+{
+    GCDebugLog("[START]CollectGarbage");
+    releaseDestroyedObjects();
+    // A major collection that is under way is finished first, regardless of the pause budget
+    while (m_phase == CollectionPhase::MARKING || m_phase == CollectionPhase::SWEEPING) {
+        {
+            auto const marker_lock = m_concurrent_cycle ? lockMarker() : std::unique_lock<std::mutex> {};
+            incrementalStep(Clock::time_point::max());
+        }
+        if (m_phase == CollectionPhase::MARKING) {
+            std::this_thread::yield(); // The marker thread has yet to empty the grey stack
+        }
+    }
+    finishLazySweeping();
+    collectGarbage(CollectionKind::MAJOR);
+    finishLazySweeping();
+    if (m_compaction) {
+        compact();
+    }
+    GCDebugLog("[END]CollectGarbage");
+}
+
+auto Heap::finishLazySweeping() -> void
+{
+    if (m_phase != CollectionPhase::LAZY_SWEEPING) {
+        return;
+    }
+    while (auto* block = popUnsweptBlock(0)) {
+        sweepOldCells(block);
+    }
+    handOverDeadObjects();
+    finishSweeping();
+}
+
+auto Heap::collectGarbage(CollectionKind kind) -> void
 {
     GCDebugLog("[START]collectGarbage | Total number of allocated objects:{}", m_number_of_heap_objects_allocated);
+    LOX_ASSERT(kind == CollectionKind::MINOR || m_phase == CollectionPhase::IDLE, "Incremental collection in progress");
+    auto const start = Clock::now();
+    auto const minor_collection = (kind == CollectionKind::MINOR);
+    // The grey stack of an incremental collection only holds old objects, which a minor collection does not trace
+    std::swap(m_greyed_objects, m_suspended_greyed_objects);
+    m_mark_scope = minor_collection ? MarkScope::YOUNG : MarkScope::ALL;
     markRoots();
-    traceObjects();
-    sweep();
-    m_next_collection_threhold = HEAP_GROW_FACTOR * m_next_collection_threhold;
+    if (minor_collection) {
+        // Old objects are not marked(or swept) by a minor collection, the ones that were written to since the last
+        // collection are blackened to find the young objects they reference
+        for (auto* object : m_remembered_set) {
+            blackenObject(object);
+        }
+    }
+    if (!minor_collection && m_mark_threads > 1 && m_bytes_allocated >= m_parallel_mark_threshold) {
+        traceObjectsInParallel();
+    } else {
+        traceObjects();
+    }
+    m_mark_scope = MarkScope::ALL;
+    std::swap(m_greyed_objects, m_suspended_greyed_objects);
+    auto const mark_time = Clock::now() - start;
+
+    // Young survivors are promoted in place, after this there are no young objects left
+    if (minor_collection) {
+        sweepYoungBlocks();
+    } else if (m_lazy_sweeping) {
+        // The allocator sweeps the old cells on demand. The young survivors that are promoted into the unswept blocks stay
+        // marked until then.
+        m_phase = CollectionPhase::LAZY_SWEEPING;
+        startSweepingOldCells();
+        sweepYoungBlocks();
+    } else {
+        (void)m_allocator.TakeYoungBlocks(); // Every block is swept, young cells included
+        for (auto* block : m_allocator.Blocks()) {
+            sweepBlock(block);
+        }
+    }
+    handOverDeadObjects();
+    m_young_bytes_allocated = 0;
+    clearRememberedSet();
+    if (m_unswept_block_count == 0) {
+        m_allocator.ReleaseEmptyBlocks();
+    }
+
+    auto const end = Clock::now();
+    auto const pause = end - start;
+    if (minor_collection) {
+        ++m_collection_stats.minor_collections;
+        m_collection_stats.total_minor_pause += pause;
+        m_collection_stats.longest_minor_pause = std::max(m_collection_stats.longest_minor_pause, pause);
+        recordPause(pause);
+    } else {
+        ++m_collection_stats.major_collections;
+        m_collection_stats.total_major_pause += pause;
+        m_collection_stats.longest_major_pause = std::max(m_collection_stats.longest_major_pause, pause);
+        recordPause(pause);
+        // Everything that is left was marked, the lazy sweep takes off the bytes it frees later on. Immortal objects are
+        // not traced.
+        m_collection_stats.major_marked_bytes += m_bytes_allocated - m_immortal_bytes;
+        m_collection_stats.total_major_mark_time += mark_time;
+        m_collection_stats.longest_post_mark_pause = std::max(m_collection_stats.longest_post_mark_pause, pause - mark_time);
+        m_major_collection_start = start;
+        // Until the lazy sweep is done the heap still counts the dead old objects, see finishSweeping
+        updateCollectionThreshold();
+        if (m_phase == CollectionPhase::IDLE) {
+            releaseUnusedMemory();
+        }
+    }
     GCDebugLog("[END]collectGarbage");
 }
 
-auto Heap::sweep() -> void
-{
-    GCDebugLog("[START] sweep");
-    auto currentObject = m_head;
-    auto previousObject = static_cast<Object*>(nullptr);
-    while (currentObject != nullptr) {
-        // Iterate over our linked list of objects
-        if (currentObject->marked) {
-            // Has been marked reachable, carry on
-            currentObject->marked = false;
-            previousObject = currentObject;
-            currentObject = currentObject->next;
-        } else {
-            // Not marked as reachable, we must free this object
-            auto* unreachable = currentObject;
-            currentObject = currentObject->next;
-            if (previousObject != nullptr) {
-                previousObject->next = unreachable->next;
-            } else {
-                m_head = unreachable->next;
+auto Heap::incrementalStep(Clock::time_point deadline) -> void
+{
+    GCDebugLog("[START]incrementalStep");
+    auto const start = Clock::now();
+    switch (m_phase) {
+    case CollectionPhase::IDLE:
+        // Called right after a minor collection, the snapshot consists of the roots and the old generation
+        LOX_ASSERT(m_young_bytes_allocated == 0, "Marking has to start with an empty young generation");
+        m_phase = CollectionPhase::MARKING;
+        m_mark_scope = MarkScope::OLD;
+        markRoots();
+        m_mark_scope = MarkScope::ALL;
+        if (m_concurrent_marking) {
+            startMarkerThread();
+            break;
+        }
+        [[fallthrough]];
+    case CollectionPhase::MARKING:
+        if (m_concurrent_cycle) {
+            // The caller holds the marker lock, the remark runs once the marker thread has emptied the grey stack
+            if (!m_marker_busy) {
+                finishMarking();
             }
-            freeObject(unreachable);
+            break;
+        }
+        m_mark_scope = MarkScope::OLD;
+        if (traceObjects(deadline)) {
+            finishMarking();
         }
+        m_mark_scope = MarkScope::ALL;
+        break;
+    case CollectionPhase::SWEEPING: {
+        while (auto* block = popUnsweptBlock(0)) {
+            sweepOldCells(block);
+            if (Clock::now() >= deadline) {
+                break;
+            }
+        }
+        handOverDeadObjects();
+        if (m_unswept_block_count == 0) {
+            ++m_collection_stats.major_collections;
+            finishSweeping();
+        }
+        break;
     }
+    case CollectionPhase::LAZY_SWEEPING:
+        LOX_ASSERT(false, "Lazy sweeps are left to the allocator");
+        break;
+    }
+    auto const pause = Clock::now() - start;
+    ++m_collection_stats.incremental_steps;
+    m_collection_stats.total_major_pause += pause;
+    m_collection_stats.longest_major_pause = std::max(m_collection_stats.longest_major_pause, pause);
+    recordPause(pause);
+    GCDebugLog("[END]incrementalStep");
+}
 
-    GCDebugLog("[END] sweep");
+auto Heap::sweepLazily(size_t size) -> void
+{
+    GCDebugLog("[START]sweepLazily");
+    // Sweeps the blocks of the size class that ran out of cells until one of them has a free cell, failing that a block
+    // of another size class is swept for every block the allocator starts
+    auto const bytes_before = m_bytes_allocated;
+    auto const size_class = SlabAllocator::SizeClassOf(size);
+    auto swept_blocks = 0U;
+    while (!m_unswept_blocks[size_class].empty() && m_allocator.NeedsNewBlock(size)) {
+        sweepOldCells(popUnsweptBlock(size_class));
+        ++swept_blocks;
+    }
+    if (swept_blocks == 0) {
+        sweepOldCells(popUnsweptBlock(size_class));
+    }
+    ++m_collection_stats.lazy_sweeps;
+    m_collection_stats.major_marked_bytes -= bytes_before - m_bytes_allocated;
+    handOverDeadObjects();
+    if (m_unswept_block_count == 0) {
+        finishSweeping();
+    }
+    GCDebugLog("[END]sweepLazily");
 }
 
-auto Heap::freeObject(Object* object) -> void
+auto Heap::finishSweeping() -> void
 {
-    LOX_ASSERT(m_number_of_heap_objects_allocated > 0, "Precondition failed");
-    --m_number_of_heap_objects_allocated;
-    switch (object->type) {
-    case ObjectType::STRING: {
-        GCDebugLog("Freeing object of type STRING");
-        delete static_cast<StringObject*>(object);
-        m_bytes_allocated -= sizeof(StringObject);
-        break;
+    m_phase = CollectionPhase::IDLE;
+    m_allocator.ReleaseEmptyBlocks();
+    updateCollectionThreshold();
+    releaseUnusedMemory();
+}
+
+auto Heap::recordPause(std::chrono::nanoseconds pause) -> void
+{
+    auto const microseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(pause).count());
+    auto const bucket = std::min(static_cast<size_t>(std::bit_width(microseconds)), PAUSE_HISTOGRAM_BUCKETS - 1);
+    ++m_collection_stats.pause_histogram[bucket];
+}
+
+auto Heap::updateCollectionThreshold() -> void
+{
+    auto const target = static_cast<double>(m_bytes_allocated) * m_options.growth_ratio;
+    auto const threshold = target >= static_cast<double>(m_options.max_heap_bytes) ? m_options.max_heap_bytes : static_cast<uint64_t>(target);
+    m_next_collection_threhold = std::clamp(threshold, m_options.min_heap_bytes, m_options.max_heap_bytes);
+}
+
+auto Heap::releaseUnusedMemory() -> void
+{
+    // After a big free the intern table and the collector's work lists are still sized for the heap before it
+    static constexpr auto MIN_SHRINK_CAPACITY = size_t { 4096 };
+    if (m_interned_strings.bucket_count() > std::max(4 * m_interned_strings.size(), MIN_SHRINK_CAPACITY)) {
+        m_interned_strings.rehash(0);
     }
-    case ObjectType::FUNCTION: {
-        GCDebugLog("Freeing object of type FUNCTION");
-        delete static_cast<FunctionObject*>(object);
-        m_bytes_allocated -= sizeof(FunctionObject);
-        break;
+    for (auto* objects : { &m_greyed_objects, &m_suspended_greyed_objects, &m_remembered_set, &m_dead_objects }) {
+        if (objects->empty() && objects->capacity() > MIN_SHRINK_CAPACITY) {
+            objects->shrink_to_fit();
+        }
     }
-    case ObjectType::CLOSURE: {
-        GCDebugLog("Freeing object of type CLOSURE");
-        delete static_cast<ClosureObject*>(object);
-        m_bytes_allocated -= sizeof(ClosureObject);
-        break;
+    // The blocks themselves can only be given back once their objects have been moved out, which the VM has to allow for
+    if (m_compaction) {
+        auto const reclaimable = reclaimableBlocks();
+        m_compaction_due = reclaimable >= MIN_COMPACTION_BLOCKS && reclaimable * COMPACTION_FRAGMENTATION_DIVISOR >= m_allocator.BlocksInUse();
     }
-    case ObjectType::NATIVE_FUNCTION: {
-        GCDebugLog("Freeing object of type NATIVE_FUNCTION");
-        delete static_cast<NativeFunctionObject*>(object);
-        m_bytes_allocated -= sizeof(NativeFunctionObject);
-        break;
+}
+
+auto Heap::reclaimableBlocks() const -> size_t
+{
+    // Blocks in use minus the blocks the live cells of every size class would fit into
+    auto live_cells = std::array<size_t, SlabAllocator::SIZE_CLASS_COUNT> {};
+    auto cell_counts = std::array<size_t, SlabAllocator::SIZE_CLASS_COUNT> {};
+    for (auto const* block : m_allocator.Blocks()) {
+        live_cells[block->size_class] += block->live_cells;
+        cell_counts[block->size_class] = block->cell_count;
     }
-    case ObjectType::UPVALUE:
-        GCDebugLog("Freeing object of type UPVALUE");
-        delete static_cast<UpvalueObject*>(object);
-        m_bytes_allocated -= sizeof(UpvalueObject);
-        break;
-    case ObjectType::CLASS: {
-        GCDebugLog("Freeing object of type CLASS");
-        delete static_cast<ClassObject*>(object);
-        m_bytes_allocated -= sizeof(ClassObject);
-        break;
+    auto needed_blocks = size_t { 0 };
+    for (size_t size_class = 0; size_class < SlabAllocator::SIZE_CLASS_COUNT; ++size_class) {
+        if (live_cells[size_class] > 0) {
+            needed_blocks += (live_cells[size_class] + cell_counts[size_class] - 1) / cell_counts[size_class];
+        }
     }
-    case ObjectType::INSTANCE: {
-        GCDebugLog("Freeing object of type Instance");
-        delete static_cast<InstanceObject*>(object);
-        m_bytes_allocated -= sizeof(InstanceObject);
-        break;
+    return m_allocator.BlocksInUse() - needed_blocks;
+}
+
+auto Heap::compact() -> void
+{
+    GCDebugLog("[START]compact");
+    LOX_ASSERT(m_phase == CollectionPhase::IDLE && m_remembered_set.empty(), "Compaction has to follow a full collection");
+    m_compaction_due = false;
+    auto blocks_by_class = std::array<std::vector<SlabAllocator::Block*>, SlabAllocator::SIZE_CLASS_COUNT> {};
+    for (auto* block : m_allocator.Blocks()) {
+        blocks_by_class[block->size_class].push_back(block);
     }
-    case ObjectType::BOUND_METHOD: {
-        GCDebugLog("Freeing object of type BoundMethod");
-        delete static_cast<BoundMethodObject*>(object);
-        m_bytes_allocated -= sizeof(BoundMethodObject);
-        break;
+    // Moved objects by their old address. Moved strings are re-interned right away, the rest of the references are
+    // rewritten once everything has been moved.
+    auto forwarding = std::unordered_map<Object const*, Object*> {};
+    auto kept_blocks = std::vector<SlabAllocator::Block*> {};
+    auto evacuated_blocks = std::vector<SlabAllocator::Block*> {};
+    for (auto& blocks : blocks_by_class) {
+        // Densest first, the blocks at the back are emptied into the ones in front for as long as those have room. Blocks
+        // with retired cells can not be given back before the sweeper thread is done with them, they are left in place.
+        std::ranges::sort(blocks, std::greater {}, [](SlabAllocator::Block const* block) { return block->live_cells; });
+        auto const free_cells = [](SlabAllocator::Block const* block) -> size_t { return block->cell_count - block->live_cells - block->retired_cells; };
+        auto room = size_t { 0 };
+        for (auto const* block : blocks) {
+            room += free_cells(block);
+        }
+        auto first_evacuated = blocks.end();
+        while (first_evacuated != blocks.begin()) {
+            // The block's objects have to fit into the free cells of the blocks in front of it
+            auto const* block = *std::prev(first_evacuated);
+            if (block->retired_cells > 0 || free_cells(block) + block->live_cells > room) {
+                break;
+            }
+            room -= free_cells(block) + block->live_cells;
+            --first_evacuated;
+        }
+        kept_blocks.insert(kept_blocks.end(), blocks.begin(), first_evacuated);
+        auto destination = blocks.begin();
+        for (auto* block : std::ranges::subrange(first_evacuated, blocks.end())) {
+            block->ForEachCell([block](uint32_t word) { return block->allocated[word]; }, [&](void* cell) {
+                while (!(*destination)->HasFreeCell()) {
+                    ++destination;
+                }
+                auto* object = static_cast<Object*>(cell);
+                forwarding.emplace(object, moveObject(object, m_allocator.AllocateIn(*destination)));
+            });
+            evacuated_blocks.push_back(block);
+        }
+    }
+    if (forwarding.empty()) {
+        GCDebugLog("[END]compact");
+        return;
+    }
+
+    auto const forward = [&forwarding]<typename T>(T* object) -> T* {
+        auto it = forwarding.find(object);
+        return it == forwarding.end() ? object : static_cast<T*>(it->second);
+    };
+    for (auto* block : kept_blocks) {
+        block->ForEachCell([block](uint32_t word) { return block->allocated[word]; }, [&forward](void* cell) { ForwardReferences(static_cast<Object*>(cell), forward); });
+    }
+    // The constant pools of immortal functions may refer to pinned strings, their inline caches to closures
+    for (auto* block : m_immortal_allocator.Blocks()) {
+        block->ForEachCell([block](uint32_t word) { return block->allocated[word]; }, [&forward](void* cell) { ForwardReferences(static_cast<Object*>(cell), forward); });
+    }
+    for (auto& value : m_vm.m_value_stack) {
+        ForwardValue(value, forward);
+    }
+    for (auto& name : m_vm.m_globals.m_names) {
+        name = forward(name);
+    }
+    for (auto& value : m_vm.m_globals.m_values) {
+        ForwardValue(value, forward);
+    }
+    ForwardKeys(m_vm.m_globals.m_slots, forward);
+    m_vm.m_init_string = forward(m_vm.m_init_string);
+    for (auto& call_frame : m_vm.m_frames) {
+        call_frame.closure = forward(call_frame.closure);
+    }
+    for (auto& upvalue : m_vm.m_open_upvalues) {
+        upvalue = forward(upvalue);
+    }
+
+    for (auto* block : evacuated_blocks) {
+        block->ForEachCell([block](uint32_t word) { return block->allocated[word]; }, [this](void* cell) {
+            DestroyObject(static_cast<Object*>(cell));
+            m_allocator.Free(cell);
+        });
+    }
+    // The moved objects keep their generation, the cells they were given are not young
+    for (auto* block : m_allocator.TakeYoungBlocks()) {
+        block->young = {};
+    }
+    m_allocator.ReleaseEmptyBlocks();
+#ifdef __GLIBC__
+    // glibc keeps freed blocks in its own free lists, only trimming gives the pages of the emptied blocks back to the system
+    malloc_trim(0);
+#endif
+    ++m_collection_stats.compactions;
+    m_collection_stats.objects_moved += forwarding.size();
+    m_collection_stats.blocks_compacted += evacuated_blocks.size();
+    GCDebugLog("[END]compact");
+}
+
+auto Heap::moveObject(Object* object, void* cell) -> Object*
+{
+    auto* moved = [object, cell]() -> Object* {
+        switch (object->GetType()) {
+        case ObjectType::STRING:
+            return MoveConstructObject<StringObject>(object, cell);
+        case ObjectType::FUNCTION:
+            return MoveConstructObject<FunctionObject>(object, cell);
+        case ObjectType::CLOSURE:
+            return MoveConstructObject<ClosureObject>(object, cell);
+        case ObjectType::NATIVE_FUNCTION:
+            return MoveConstructObject<NativeFunctionObject>(object, cell);
+        case ObjectType::UPVALUE:
+            return MoveConstructObject<UpvalueObject>(object, cell);
+        case ObjectType::CLASS:
+            return MoveConstructObject<ClassObject>(object, cell);
+        case ObjectType::INSTANCE:
+            return MoveConstructObject<InstanceObject>(object, cell);
+        case ObjectType::BOUND_METHOD:
+            return MoveConstructObject<BoundMethodObject>(object, cell);
+        }
+        __builtin_unreachable();
+    }();
+    // The remembered set is empty after a full collection
+    moved->old = object->old;
+    moved->immortal = object->immortal;
+    moved->footprint = object->footprint;
+    if (object->type == ObjectType::STRING) {
+        // The moved-from string keeps its hash, which is all the lookup needs
+        m_interned_strings.erase(static_cast<StringObject*>(object));
+        m_interned_strings.insert(static_cast<StringObject*>(moved));
+    }
+    return moved;
+}
+
+auto Heap::lockMarker() -> std::unique_lock<std::mutex>
+{
+    std::unique_lock lock(m_marker_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto const start = Clock::now();
+        m_interpreter_waiting.store(true, std::memory_order_relaxed);
+        lock.lock();
+        m_interpreter_waiting.store(false, std::memory_order_relaxed);
+        auto const wait = Clock::now() - start;
+        ++m_collection_stats.marker_lock_waits;
+        m_collection_stats.longest_marker_lock_wait = std::max(m_collection_stats.longest_marker_lock_wait, wait);
+    }
+    return lock;
+}
+
+auto Heap::startMarkerThread() -> void
+{
+    if (!m_marker_thread.joinable()) {
+        m_marker_thread = std::thread([this] { runMarkerThread(); });
+    }
+    {
+        std::lock_guard const lock(m_marker_mutex);
+        m_marker_busy = true;
+    }
+    m_concurrent_cycle = true;
+    ++m_collection_stats.concurrent_markings;
+    m_marker_wakeup.notify_one();
+}
+
+auto Heap::stopMarkerThread() -> void
+{
+    if (!m_marker_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard const lock(m_marker_mutex);
+        m_marker_shutdown = true;
+    }
+    m_marker_wakeup.notify_one();
+    m_marker_thread.join();
+    m_concurrent_cycle = false;
+}
+
+auto Heap::runMarkerThread() -> void
+{
+    std::unique_lock lock(m_marker_mutex);
+    while (true) {
+        m_marker_wakeup.wait(lock, [this] { return m_marker_busy || m_marker_shutdown; });
+        while (!m_marker_shutdown && !m_greyed_objects.empty()) {
+            m_mark_scope = MarkScope::OLD;
+            for (auto work = 0U; work < INCREMENTAL_WORK_UNIT && !m_greyed_objects.empty(); ++work) {
+                auto* object = m_greyed_objects.back();
+                m_greyed_objects.pop_back();
+                blackenObject(object);
+            }
+            m_mark_scope = MarkScope::ALL;
+            // Hand the lock over between batches if the interpreter is waiting to store into an old object
+            lock.unlock();
+            while (m_interpreter_waiting.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+            lock.lock();
+        }
+        if (m_marker_shutdown) {
+            return;
+        }
+        m_marker_busy = false;
+    }
+}
+
+auto Heap::finishMarking() -> void
+{
+    // Remark: the roots and the young objects are not covered by the barrier, trace them now together with the old
+    // objects that were given young references. Along the way this empties the grey stack the barrier filled.
+    m_mark_scope = MarkScope::ALL;
+    markRoots();
+    for (auto* object : m_remembered_set) {
+        blackenObject(object);
+    }
+    traceObjects();
+
+    // The old cells are swept by the next slices, the young survivors that are promoted into the unswept blocks stay
+    // marked until then
+    m_concurrent_cycle = false;
+    m_phase = CollectionPhase::SWEEPING;
+    startSweepingOldCells();
+    sweepYoungBlocks();
+    handOverDeadObjects();
+    m_young_bytes_allocated = 0;
+    clearRememberedSet();
+}
+
+auto Heap::sweepDeadObject(Object* object) -> void
+{
+    if (object->immortal) {
+        return; // A pinned string, see AllocateImmortalStringObject
+    }
+    if (object->type == ObjectType::STRING) {
+        m_interned_strings.erase(static_cast<StringObject*>(object));
     }
+    freeObject(object);
+}
+
+auto Heap::sweepYoungBlocks() -> void
+{
+    GCDebugLog("[START]sweepYoungBlocks");
+    for (auto* block : m_allocator.TakeYoungBlocks()) {
+        block->ForEachCell([block](uint32_t word) { return block->young[word] & ~block->mark_state->marked[word].load(std::memory_order_relaxed); },
+            [this](void* cell) { sweepDeadObject(static_cast<Object*>(cell)); });
+        block->ForEachCell([block](uint32_t word) { return block->young[word]; }, [](void* cell) { static_cast<Object*>(cell)->old = true; });
+        // Objects promoted while a major collection is marking were not part of its snapshot, the ones promoted into a block
+        // that is waiting to be swept have to survive the sweep. Both stay marked.
+        auto const keep_marked = (m_phase == CollectionPhase::MARKING || block->mark_state->unswept);
+        for (uint32_t word = 0; word < SlabAllocator::BITMAP_WORDS; ++word) {
+            if (!keep_marked) {
+                block->mark_state->marked[word].fetch_and(~block->young[word], std::memory_order_relaxed);
+            }
+            block->young[word] = 0;
+        }
+    }
+    GCDebugLog("[END]sweepYoungBlocks");
+}
+
+auto Heap::sweepBlock(SlabAllocator::Block* block) -> void
+{
+    block->ForEachCell([block](uint32_t word) { return block->allocated[word] & ~block->mark_state->marked[word].load(std::memory_order_relaxed); },
+        [this](void* cell) { sweepDeadObject(static_cast<Object*>(cell)); });
+    block->ForEachCell([block](uint32_t word) { return block->young[word]; }, [](void* cell) { static_cast<Object*>(cell)->old = true; });
+    for (uint32_t word = 0; word < SlabAllocator::BITMAP_WORDS; ++word) {
+        block->mark_state->marked[word].store(0, std::memory_order_relaxed);
+        if (block->young[word] != 0) {
+            block->young[word] = 0; // Only blocks with young cells are written to
+        }
+    }
+}
+
+auto Heap::sweepOldCells(SlabAllocator::Block* block) -> void
+{
+    auto const old_cells = [block](uint32_t word) { return block->allocated[word] & ~block->young[word]; };
+    block->ForEachCell([block, &old_cells](uint32_t word) { return old_cells(word) & ~block->mark_state->marked[word].load(std::memory_order_relaxed); },
+        [this](void* cell) { sweepDeadObject(static_cast<Object*>(cell)); });
+    for (uint32_t word = 0; word < SlabAllocator::BITMAP_WORDS; ++word) {
+        block->mark_state->marked[word].fetch_and(~old_cells(word), std::memory_order_relaxed);
     }
+    block->mark_state->unswept = false;
+}
+
+auto Heap::startSweepingOldCells() -> void
+{
+    for (auto* block : m_allocator.Blocks()) {
+        block->mark_state->unswept = true;
+        m_unswept_blocks[block->size_class].push_back(block);
+    }
+    m_unswept_block_count = m_allocator.Blocks().size();
+}
+
+auto Heap::popUnsweptBlock(size_t size_class) -> SlabAllocator::Block*
+{
+    if (m_unswept_block_count == 0) {
+        return nullptr;
+    }
+    auto& preferred = m_unswept_blocks[size_class];
+    auto& blocks = preferred.empty() ? *std::ranges::find_if(m_unswept_blocks, [](auto const& other) { return !other.empty(); }) : preferred;
+    auto* block = blocks.back();
+    blocks.pop_back();
+    --m_unswept_block_count;
+    return block;
+}
+
+auto Heap::freeObject(Object* object) -> void
+{
+    LOX_ASSERT(m_number_of_heap_objects_allocated > 0, "Precondition failed");
+    --m_number_of_heap_objects_allocated;
+    m_bytes_allocated -= object->footprint;
+    if (m_background_freeing) {
+        m_allocator.Retire(object);
+        m_dead_objects.push_back(object);
+        return;
+    }
+    DestroyObject(object);
+    m_allocator.Free(object);
 }
 
 auto Heap::markRoot(Object* object_ptr) -> void
 {
     LOX_ASSERT(object_ptr != nullptr, "Failed Precondition");
+    if (object_ptr->IsMarked() || !inMarkScope(object_ptr)) {
+        return; // Already grey or black(e.g. the class shared by many instances), or in a generation that is not traced
+    }
     object_ptr->MarkObjectAsReachable();
     m_greyed_objects.push_back(object_ptr);
 }
 
 auto Heap::markRoot(Value value) -> void
 {
-    if (value.IsObject() && !value.AsObject().marked) {
+    if (value.IsObject() && !value.AsObject().IsMarked()) {
         markRoot(value.AsObjectPtr());
     }
 }
 
+auto Heap::markString(StringObject const* string) -> void
+{
+    // Strings have no outgoing references, there is no need to grey them
+    if (string != nullptr && inMarkScope(string)) {
+        string->MarkObjectAsReachable();
+    }
+}
+
 auto Heap::markRoots() -> void
 {
     GCDebugLog("[START]markRoots");
@@ -327,9 +1287,13 @@ auto Heap::markRoots() -> void
     }
 
     // Mark all globals as reachable
-    for (auto& [_, global_value] : m_vm.m_globals) {
+    for (auto const* name : m_vm.m_globals.m_names) {
+        markString(name);
+    }
+    for (auto const& global_value : m_vm.m_globals.m_values) {
         markRoot(global_value);
     }
+    markString(m_vm.m_init_string);
 
     // Mark the call frame closures
     for (auto& call_frame : m_vm.m_frames) {
@@ -340,13 +1304,7 @@ auto Heap::markRoots() -> void
     for (auto& upvalue : m_vm.m_open_upvalues) {
         markRoot(upvalue);
     }
-
-    // Mark all the roots for objects that originate during the compilation phase
-    auto current_compiler = m_current_compiler;
-    while (current_compiler != nullptr) {
-        markRoot(current_compiler->m_function);
-        current_compiler = current_compiler->m_parent_compiler;
-    }
+    // The functions that are being compiled and their constants are immortal, they need no marking
     GCDebugLog("[END]markRoots");
 }
 
@@ -361,76 +1319,140 @@ auto Heap::traceObjects() -> void
     GCDebugLog("[END]traceObjects");
 }
 
-auto Heap::blackenObject(Object* object) -> void
+namespace {
+// Grey objects of one of the threads of a parallel marking. The owner pushes and pops "local" without synchronization and
+// hands part of it over to "shared" when that runs empty, which is where the other threads steal from.
+struct MarkWorker {
+    std::vector<Object*> local;
+    std::mutex mutex;
+    std::vector<Object*> shared; // Guarded by mutex
+    std::atomic<size_t> shared_size = 0;
+};
+}
+
+// Grey objects a thread keeps to itself before sharing
+static constexpr auto PARALLEL_MARK_SHARE_THRESHOLD = size_t { 64 };
+
+// Moves half of "victim"'s shared objects to "thief"'s local stack, returns false if there was nothing to steal
+static auto StealGreyObjects(MarkWorker& victim, MarkWorker& thief) -> bool
 {
-    GCDebugLog("[START]blackenObject");
-    LOX_ASSERT(object != nullptr);
-    switch (object->type) {
-    case ObjectType::STRING:
-    case ObjectType::NATIVE_FUNCTION:
-        break; // No outgoing references nothing to do
-    case ObjectType::UPVALUE: {
-        auto upvalue = static_cast<UpvalueObject*>(object);
-        if (upvalue->IsClosed()) {
-            markRoot(upvalue->GetClosedValue());
-        }
-        break;
+    if (victim.shared_size.load(std::memory_order_relaxed) == 0) {
+        return false;
     }
-    case ObjectType::FUNCTION: {
-        auto function = static_cast<FunctionObject*>(object);
-        for (auto& constant : function->chunk.constant_pool) {
-            markRoot(constant);
-        }
-        break;
+    auto const lock = std::scoped_lock(victim.mutex);
+    if (victim.shared.empty()) {
+        return false;
     }
-    case ObjectType::CLOSURE: {
-        auto closure = static_cast<ClosureObject*>(object);
-        markRoot(closure->function);
-        for (auto* upvalue : closure->upvalues) {
-            markRoot(upvalue);
+    auto const first_stolen = victim.shared.begin() + static_cast<std::ptrdiff_t>(victim.shared.size() / 2);
+    thief.local.insert(thief.local.end(), first_stolen, victim.shared.end());
+    victim.shared.erase(first_stolen, victim.shared.end());
+    victim.shared_size.store(victim.shared.size(), std::memory_order_relaxed);
+    return true;
+}
+
+static auto ShareGreyObjects(MarkWorker& worker) -> void
+{
+    // The bottom of the stack was pushed first, it is likelier to lead to large subgraphs
+    auto const shared_end = worker.local.begin() + static_cast<std::ptrdiff_t>(worker.local.size() / 2);
+    auto const lock = std::scoped_lock(worker.mutex);
+    worker.shared.insert(worker.shared.end(), worker.local.begin(), shared_end);
+    worker.shared_size.store(worker.shared.size(), std::memory_order_relaxed);
+    worker.local.erase(worker.local.begin(), shared_end);
+}
+
+// Traces until every thread has run out of grey objects. A thread only goes idle once its own stacks are empty, so once
+// all of them are idle there is nothing left to steal.
+static auto RunMarkWorker(std::vector<MarkWorker>& workers, size_t self, std::atomic<size_t>& idle_workers) -> void
+{
+    auto& worker = workers[self];
+    auto const mark = [&worker](Object* object) {
+        if (object->TryMark() && object->GetType() != ObjectType::STRING) {
+            worker.local.push_back(object);
         }
-        break;
-    }
-    case ObjectType::CLASS: {
-        auto class_obj_ptr = static_cast<ClassObject*>(object);
-        for (auto& [_, method] : class_obj_ptr->methods) {
-            markRoot(method);
+    };
+    auto const mark_name = [](StringObject const* name) { (void)name->TryMark(); };
+    auto const steal = [&workers, &worker, self]() {
+        for (size_t offset = 0; offset < workers.size(); ++offset) {
+            if (StealGreyObjects(workers[(self + offset) % workers.size()], worker)) {
+                return true;
+            }
         }
-        break;
-    }
-    case ObjectType::INSTANCE: {
-        auto instance = static_cast<InstanceObject*>(object);
-        for (auto const& [_, value] : instance->fields) {
-            markRoot(value);
+        return false;
+    };
+    while (true) {
+        while (!worker.local.empty()) {
+            auto* object = worker.local.back();
+            worker.local.pop_back();
+            VisitReferences(object, mark, mark_name);
+            if (worker.local.size() > PARALLEL_MARK_SHARE_THRESHOLD && worker.shared_size.load(std::memory_order_relaxed) == 0) {
+                ShareGreyObjects(worker);
+            }
+        }
+        if (steal()) {
+            continue;
+        }
+        idle_workers.fetch_add(1);
+        while (true) {
+            if (idle_workers.load() == workers.size()) {
+                return;
+            }
+            auto const work_available = std::ranges::any_of(workers, [](MarkWorker const& other) { return other.shared_size.load(std::memory_order_relaxed) != 0; });
+            if (work_available) {
+                idle_workers.fetch_sub(1);
+                break;
+            }
+            std::this_thread::yield();
         }
-        break;
-    }
-    case ObjectType::BOUND_METHOD: {
-        auto const& bound_method = static_cast<BoundMethodObject const*>(object);
-        markRoot(bound_method->receiver);
-        markRoot(bound_method->method);
-        break;
-    }
     }
-    GCDebugLog("[END]blackenObject");
 }
 
-auto Heap::SetCompilerContext(Compiler* compiler) -> void
+auto Heap::traceObjectsInParallel() -> void
 {
-    m_current_compiler = compiler;
+    GCDebugLog("[START]traceObjectsInParallel");
+    LOX_ASSERT(m_mark_scope == MarkScope::ALL, "Only stop-the-world major collections trace in parallel");
+    auto workers = std::vector<MarkWorker>(m_mark_threads);
+    // Deal the roots out to all of the threads
+    for (size_t index = 0; index < m_greyed_objects.size(); ++index) {
+        workers[index % workers.size()].shared.push_back(m_greyed_objects[index]);
+    }
+    m_greyed_objects.clear();
+    for (auto& worker : workers) {
+        worker.shared_size.store(worker.shared.size(), std::memory_order_relaxed);
+    }
+    auto idle_workers = std::atomic<size_t> { 0 };
+    auto threads = std::vector<std::thread> {};
+    threads.reserve(workers.size() - 1);
+    for (size_t index = 1; index < workers.size(); ++index) {
+        threads.emplace_back(RunMarkWorker, std::ref(workers), index, std::ref(idle_workers));
+    }
+    RunMarkWorker(workers, 0, idle_workers);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ++m_collection_stats.parallel_markings;
+    GCDebugLog("[END]traceObjectsInParallel");
 }
 
-HeapContextManager::HeapContextManager(Heap& heap, Compiler* current, Compiler* new_compiler)
-    : m_heap(heap)
-    , m_current(current)
+auto Heap::traceObjects(Clock::time_point deadline) -> bool
 {
-    LOX_ASSERT(current != nullptr);
-    LOX_ASSERT(new_compiler != nullptr);
-    m_heap.SetCompilerContext(new_compiler);
+    GCDebugLog("[START]traceObjects(incremental)");
+    auto work = 0U;
+    while (not m_greyed_objects.empty()) {
+        auto* object = m_greyed_objects.back();
+        m_greyed_objects.pop_back();
+        blackenObject(object);
+        if (++work % INCREMENTAL_WORK_UNIT == 0 && Clock::now() >= deadline) {
+            break;
+        }
+    }
+    GCDebugLog("[END]traceObjects(incremental)");
+    return m_greyed_objects.empty();
 }
 
-HeapContextManager::~HeapContextManager()
+auto Heap::blackenObject(Object* object) -> void
 {
-    // Restore the original compiler
-    m_heap.SetCompilerContext(m_current);
-}
\ No newline at end of file
+    GCDebugLog("[START]blackenObject");
+    VisitReferences(
+        object, [this](Object* referenced) { markRoot(referenced); }, [this](StringObject const* name) { markString(name); });
+    GCDebugLog("[END]blackenObject");
+}
@@ -25,18 +25,145 @@
 
 #include "error.h"
 #include "object.h"
+#include "slab_allocator.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 class VirtualMachine;
-class Compiler;
+struct HeapSnapshot;
 
+// Pauses are counted in power-of-two buckets: the first one holds the pauses below 1us, bucket i the ones from 2^(i-1)us
+// up to 2^i us and the last one everything longer
+static constexpr auto PAUSE_HISTOGRAM_BUCKETS = size_t { 16 };
+
+struct CollectionStats {
+    uint64_t minor_collections = 0;
+    uint64_t major_collections = 0;
+    std::chrono::nanoseconds total_minor_pause {};
+    std::chrono::nanoseconds total_major_pause {};
+    std::chrono::nanoseconds longest_minor_pause {};
+    std::chrono::nanoseconds longest_major_pause {};
+    uint64_t incremental_steps = 0; // Slices of the incremental major collections, each one counts as a major pause
+    uint64_t concurrent_markings = 0; // Major collections whose marking ran on the marker thread
+    // Stores into old objects that had to wait for the concurrent marker thread to release the heap
+    uint64_t marker_lock_waits = 0;
+    std::chrono::nanoseconds longest_marker_lock_wait {};
+    // Marking of the stop-the-world major collections, the bytes that survived them over the time spent tracing
+    uint64_t parallel_markings = 0; // Stop-the-world major collections traced by more than one thread
+    uint64_t major_marked_bytes = 0;
+    std::chrono::nanoseconds total_major_mark_time {};
+    // Part of the stop-the-world major pauses that came after marking, and the time from the start of such a collection
+    // until the allocation that triggered it returned
+    std::chrono::nanoseconds longest_post_mark_pause {};
+    std::chrono::nanoseconds longest_time_to_first_allocation {};
+    uint64_t lazy_sweeps = 0; // Batches of old objects swept on demand by the allocator
+    uint64_t objects_freed_in_background = 0;
+    uint64_t compactions = 0; // Collections that moved objects out of sparse blocks
+    uint64_t objects_moved = 0;
+    uint64_t blocks_compacted = 0; // Blocks emptied by moving their objects
+    std::array<uint64_t, PAUSE_HISTOGRAM_BUCKETS> pause_histogram {}; // Minor, major and incremental pauses by duration
+};
+
+// Objects and bytes allocated since the heap was created by object type, freed ones included. The bytes include the
+// growth of the buffers the objects own.
+struct AllocationStats {
+    std::array<uint64_t, OBJECT_TYPE_COUNT> objects {};
+    std::array<uint64_t, OBJECT_TYPE_COUNT> bytes {};
+    uint64_t peak_heap_bytes = 0; // Largest BytesAllocated seen
+};
+
+// Default upper bound on the time a slice of an incremental major collection spends marking or sweeping
+static constexpr auto DEFAULT_GC_PAUSE_BUDGET = std::chrono::microseconds { 1000 };
+// Smaller heaps are marked by a single thread, starting the other threads would take longer than tracing them
+static constexpr auto DEFAULT_PARALLEL_MARK_THRESHOLD = uint64_t { 32 } * 1024 * 1024;
+
+enum class HeapMode : uint8_t {
+    GENERATIONAL,
+    // For short runs that allocate heavily and exit: objects come from arenas of many blocks and no collection runs
+    // until the heap has grown to the region limit, it collects as a generational heap from then on
+    REGION,
+};
+
+// Sizing of the heap, see Heap
+struct HeapOptions {
+    HeapMode mode = HeapMode::GENERATIONAL;
+    uint64_t region_limit_bytes = 64 * 1024 * 1024; // Soft limit of the region mode
+    uint64_t nursery_bytes = 256 * 1024; // Bytes allocated between minor collections
+    double growth_ratio = 2.0; // The heap may grow to this multiple of the bytes that survived a major collection
+    uint64_t min_heap_bytes = 1024 * 1024; // No major collections below this size
+    // A major collection is due whenever the heap is above this size, even if that means one on every collection
+    uint64_t max_heap_bytes = std::numeric_limits<uint64_t>::max();
+};
+
+// Generational mark-sweep heap. Objects are allocated from size-class slabs and start out young, the survivors of a
+// collection are promoted to the old generation in place(objects only move when the heap is compacted). Sweeps walk the
+// mark bitmaps of the slab blocks, minor collections only the blocks that were allocated from since the last collection.
+// Minor collections only trace and sweep the young generation: old objects are assumed to be live and the old objects
+// that reference young ones are found through the remembered set, which the write barrier maintains. Major collections
+// trace and sweep both generations.
+//
+// The heap counts the bytes of every object including the buffers it owns, the VM reports the objects whose buffers grew
+// through UpdateFootprint. A minor collection runs once the young objects have grown past the nursery size, it is
+// upgraded to a major one once the heap has grown by the growth ratio over what survived the last major collection,
+// within the bounds set by HeapOptions.
+//
+// With a non-zero pause budget major collections are incremental: the old generation is marked and then swept in slices
+// that each stop once the budget is used up, interleaved with the program and with minor collections. Marking starts
+// right after a minor collection, from the roots and the old generation alone. The pre-write barrier greys old objects
+// that old objects lose a reference to(snapshot-at-the-beginning), objects promoted while marking are allocated black.
+// The final slice traces the roots once more(remark).
+//
+// With concurrent marking enabled the old generation is traced by a background thread instead. The marker thread only
+// reads objects that were old when marking started, the interpreter takes the marker lock(see LockForStore) to store
+// into old objects and the collector holds it whenever it runs on the interpreter's thread.
+//
+// Stop-the-world major collections of large heaps are traced by several threads. Each one works off a grey stack of its
+// own and steals from the others when it runs out, objects are marked with an atomic test-and-set so that every object is
+// blackened exactly once.
+//
+// With lazy sweeping a stop-the-world major collection only sweeps the young generation, the old one is swept block by
+// block whenever the allocator runs out of free cells of a size class, starting with the blocks of that size class. With
+// background freeing the destructors of dead objects run on a sweeper thread, their memory is handed back to the
+// allocator by the next collection.
+//
+// With compaction enabled a major collection that leaves many blocks sparsely used asks the VM for a compaction(see
+// CompactionDue), which the VM runs where it holds no object pointers outside of its roots. A compaction collects the
+// whole heap and then moves the objects of the sparsest blocks of every size class into the free cells of the others,
+// the emptied blocks are given back. The moved objects are looked up in a forwarding table to rewrite every reference
+// to them: the roots, the fields of the objects, the keys of the method, global and shape tables and the inline caches.
+//
+// The functions the compiler produces, the string constants they refer to and the native functions live as long as the
+// heap and are allocated from an immortal space of their own. Its objects are old and marked from the start and its
+// blocks are never swept, so tracing stops at them and they are never visited by a collection. An interned string that
+// already lived in the collected heap when the compiler needed it as a constant is pinned instead, the sweeps skip it.
+// Immortal objects may only reference other immortal objects, the chunks' inline caches are not traced.
+//
+// In region mode(see HeapMode) collections are deferred until the heap grows past a soft limit, the blocks are allocated
+// in arenas. The heap is torn down in bulk in any mode: its objects are destroyed and the blocks given back whole.
 class Heap {
 public:
-    Heap(VirtualMachine& vm);
+    Heap(VirtualMachine& vm, HeapOptions const& options = {});
     ~Heap();
+    // Returns the interned string object for the given contents, a new object is only allocated for unseen strings
     [[nodiscard]] auto AllocateStringObject(std::string_view) -> StringObject*;
+    // Same as AllocateStringObject but a new string object takes over the buffer of "string_data"
+    [[nodiscard]] auto AllocateStringObjectFromBuffer(LoxString&& string_data) -> StringObject*;
+    // Same as AllocateStringObject but the string is never freed, for the constants of compiled functions
+    [[nodiscard]] auto AllocateImmortalStringObject(std::string_view) -> StringObject*;
+    // Functions and native functions are immortal
     [[nodiscard]] auto AllocateFunctionObject(std::string_view function_name, uint32_t arity) -> FunctionObject*;
     [[nodiscard]] auto AllocateClosureObject(FunctionObject* function) -> ClosureObject*;
     [[nodiscard]] auto AllocateNativeFunctionObject(NativeFunction) -> NativeFunctionObject*;
@@ -44,40 +171,274 @@ public:
     [[nodiscard]] auto AllocateClassObject(std::string_view class_name) -> ClassObject*;
     [[nodiscard]] auto AllocateInstanceObject(ClassObject* class_) -> InstanceObject*;
     [[nodiscard]] auto AllocateBoundMethodObject(InstanceObject* instance, ClosureObject* method) -> BoundMethodObject*;
-    auto SetCompilerContext(Compiler* current_compiler) -> void;
+    template<typename Visitor>
+    auto ForEachObject(Visitor&& visitor) const -> void
+    {
+        for (auto* block : m_immortal_allocator.Blocks()) {
+            block->ForEachCell([block](uint32_t word) { return block->allocated[word]; }, [&visitor](void* cell) { visitor(*static_cast<Object const*>(cell)); });
+        }
+        for (auto* block : m_allocator.Blocks()) {
+            block->ForEachCell([block](uint32_t word) { return block->allocated[word]; }, [block, &visitor](void* cell) {
+                auto const* object = static_cast<Object const*>(cell);
+                // Unmarked old objects that are waiting to be swept are already dead, unless they are pinned
+                if (!block->mark_state->unswept || !object->old || object->IsMarked() || object->immortal) {
+                    visitor(*object);
+                }
+            });
+        }
+    }
+    // Must be held while storing into "owner", which the concurrent marker thread may be reading. Disengaged unless
+    // "owner" is old and the marker thread is running, the marker thread never reads immortal objects.
+    [[nodiscard]] auto LockForStore(Object const* owner) -> std::unique_lock<std::mutex>
+    {
+        if (!m_concurrent_cycle || !owner->old || owner->immortal) {
+            return {};
+        }
+        return lockMarker();
+    }
+    // Must be called before "owner" drops its reference to "previous"(an overwritten field, closed upvalue or method).
+    // While a major collection is marking the old objects that are reachable from the snapshot stay so.
+    auto PreWriteBarrier(Object const* owner, Object const* previous) -> void
+    {
+        if (m_phase == CollectionPhase::MARKING && owner->old && previous != nullptr && previous->old && !previous->IsMarked()) {
+            shade(previous);
+        }
+    }
+    auto PreWriteBarrier(Object const* owner, Value previous) -> void
+    {
+        if (previous.IsObject()) {
+            PreWriteBarrier(owner, previous.AsObjectPtr());
+        }
+    }
+    // Must be called after a reference to "stored" is written into "owner"(a field, a closed upvalue, a method...). An old
+    // object that starts referencing a young one is remembered, the next minor collection traces it like a root.
+    auto WriteBarrier(Object* owner, Object const* stored) -> void
+    {
+        if (owner->old && !owner->remembered && stored != nullptr && !stored->old) {
+            remember(owner);
+        }
+    }
+    auto WriteBarrier(Object* owner, Value stored) -> void
+    {
+        if (stored.IsObject()) {
+            WriteBarrier(owner, stored.AsObjectPtr());
+        }
+    }
+    // Remembers "owner" regardless of what was stored, for bulk updates such as a chunk filled in by the compiler
+    auto RememberObject(Object* owner) -> void
+    {
+        if (owner->old && !owner->remembered) {
+            remember(owner);
+        }
+    }
+    // Zero turns incremental collection off, major collections then stop the program until they are done
+    auto SetPauseBudget(std::chrono::microseconds budget) -> void
+    {
+        m_pause_budget = budget;
+    }
+    // Takes effect from the next major collection
+    auto SetConcurrentMarking(bool enabled) -> void
+    {
+        m_concurrent_marking = enabled;
+    }
+    // Stop-the-world major collections of heaps of at least "min_heap_bytes" are traced by "threads" threads
+    auto SetParallelMarking(uint32_t threads, uint64_t min_heap_bytes = DEFAULT_PARALLEL_MARK_THRESHOLD) -> void
+    {
+        m_mark_threads = std::max(threads, 1U);
+        m_parallel_mark_threshold = min_heap_bytes;
+    }
+    // Takes effect from the next stop-the-world major collection
+    auto SetLazySweeping(bool enabled) -> void
+    {
+        m_lazy_sweeping = enabled;
+    }
+    auto SetBackgroundFreeing(bool enabled) -> void
+    {
+        m_background_freeing = enabled;
+    }
+    auto SetCompaction(bool enabled) -> void
+    {
+        m_compaction = enabled;
+        m_compaction_due = false;
+    }
+    // Set once a major collection found the heap fragmented enough to be worth compacting, see CollectGarbage
+    [[nodiscard]] auto CompactionDue() const -> bool
+    {
+        return m_compaction_due;
+    }
+    [[nodiscard]] auto Collections() const -> CollectionStats const&
+    {
+        return m_collection_stats;
+    }
+    [[nodiscard]] auto Allocations() const -> AllocationStats const&
+    {
+        return m_allocation_stats;
+    }
+    // The objects reachable from the VM's roots and the references between them, see heap_snapshot.h
+    [[nodiscard]] auto TakeSnapshot() const -> HeapSnapshot;
+    // Runs a stop-the-world major collection and sweeps the whole heap, after finishing the collection that is under way.
+    // With compaction enabled the objects of sparse blocks are moved afterwards, no object pointers may be held on to
+    // across the call other than the ones the heap knows as roots.
+    auto CollectGarbage() -> void;
+    // Counts the bytes the object's buffers have grown(or shrunk) by since it was allocated or last updated
+    auto UpdateFootprint(Object* object) -> void;
+    // Bytes of the live objects and of the dead ones that have not been swept yet
+    [[nodiscard]] auto BytesAllocated() const -> uint64_t
+    {
+        return m_bytes_allocated;
+    }
+    // Number of objects allocated since the heap was created, including the ones that have since been freed
+    [[nodiscard]] auto TotalObjectsAllocated() const -> uint64_t
+    {
+        return m_total_objects_allocated;
+    }
 
 protected:
+    enum class CollectionKind {
+        MINOR,
+        MAJOR,
+    };
+    enum class CollectionPhase {
+        IDLE,
+        MARKING,  // An incremental major collection is tracing the old generation
+        SWEEPING, // An incremental major collection is freeing the unmarked old cells of m_unswept_blocks
+        LAZY_SWEEPING, // A stop-the-world major collection left the unmarked old cells of m_unswept_blocks to the allocator
+    };
+    // Which generations markRoot visits, objects outside of the scope are left alone
+    enum class MarkScope {
+        ALL,
+        YOUNG,
+        OLD,
+    };
+    using Clock = std::chrono::steady_clock;
+
     auto reset() -> void;
-    [[nodiscard]] auto allocateObject(ObjectType) -> Object*;
+    [[nodiscard]] auto allocateObject(ObjectType, bool immortal = false) -> Object*;
+    template<typename T>
+    [[nodiscard]] auto constructObject(bool immortal) -> Object*;
+    // "buffer" is either empty or holds "string_data"
+    [[nodiscard]] auto internString(std::string_view string_data, bool immortal, LoxString&& buffer = {}) -> StringObject*;
     auto freeObject(Object* object) -> void;
-    auto insertAtHead(Object* new_node) -> Object*;
+    auto startSweeperThread() -> void;
+    auto stopSweeperThread() -> void;
+    auto runSweeperThread() -> void;
+    auto handOverDeadObjects() -> void;
+    auto releaseDestroyedObjects() -> void;
     // GC related member functions
-    auto collectGarbage() -> void;
+    auto collectGarbage(CollectionKind kind) -> void;
+    auto collect(bool major_collection_due) -> void;
+    auto incrementalStep(Clock::time_point deadline) -> void;
+    auto sweepLazily(size_t size) -> void;
+    auto finishSweeping() -> void;
+    auto finishLazySweeping() -> void;
+    auto recordPause(std::chrono::nanoseconds pause) -> void;
+    auto updateCollectionThreshold() -> void;
+    auto releaseUnusedMemory() -> void;
+    [[nodiscard]] auto reclaimableBlocks() const -> size_t;
+    auto compact() -> void;
+    [[nodiscard]] auto moveObject(Object* object, void* cell) -> Object*;
+    auto finishMarking() -> void;
+    auto startMarkerThread() -> void;
+    auto stopMarkerThread() -> void;
+    auto runMarkerThread() -> void;
+    [[nodiscard]] auto lockMarker() -> std::unique_lock<std::mutex>;
+    [[nodiscard]] auto inMarkScope(Object const* object) const -> bool;
+    auto remember(Object* object) -> void;
+    auto clearRememberedSet() -> void;
+    auto shade(Object const* object) -> void;
     auto markRoots() -> void;
     auto markRoot(Object* object_ptr) -> void;
     auto markRoot(Value value) -> void;
+    auto markString(StringObject const* string) -> void;
     auto traceObjects() -> void;
+    auto traceObjectsInParallel() -> void;
+    // Returns true once the grey stack is empty
+    [[nodiscard]] auto traceObjects(Clock::time_point deadline) -> bool;
     auto blackenObject(Object* object) -> void;
-    auto sweep() -> void;
+    auto sweepDeadObject(Object* object) -> void;
+    auto sweepYoungBlocks() -> void;
+    auto sweepBlock(SlabAllocator::Block* block) -> void;
+    auto sweepOldCells(SlabAllocator::Block* block) -> void;
+    auto startSweepingOldCells() -> void;
+    [[nodiscard]] auto popUnsweptBlock(size_t size_class) -> SlabAllocator::Block*;
+
+    // Lookups by std::string_view hash the contents, lookups by StringObject* use the cached hash
+    struct InternedStringHash {
+        using is_transparent = void;
+        auto operator()(StringObject const* string) const -> size_t
+        {
+            return string->hash;
+        }
+        auto operator()(std::string_view string) const -> size_t
+        {
+            return StringObject::HashString(string);
+        }
+    };
+    struct InternedStringEqual {
+        using is_transparent = void;
+        auto operator()(StringObject const* lhs, StringObject const* rhs) const -> bool
+        {
+            return lhs == rhs;
+        }
+        auto operator()(std::string_view lhs, StringObject const* rhs) const -> bool
+        {
+            return lhs == rhs->data;
+        }
+        auto operator()(StringObject const* lhs, std::string_view rhs) const -> bool
+        {
+            return lhs->data == rhs;
+        }
+    };
 
 protected:
-    Compiler* m_current_compiler = nullptr; // Set the current function that's being compiled
     uint64_t m_number_of_heap_objects_allocated = 0;
+    uint64_t m_total_objects_allocated = 0;
     uint64_t m_bytes_allocated = 0;
-    uint64_t m_next_collection_threhold = 1024U; // 1KB
-    Object* m_head = nullptr;
+    uint64_t m_immortal_bytes = 0; // Part of m_bytes_allocated that lives in m_immortal_allocator
+    uint64_t m_young_bytes_allocated = 0;              // Allocated since the last collection
+    HeapOptions m_options;
+    uint64_t m_next_collection_threhold; // A minor collection is upgraded to a major one above this size
+    bool m_collections_deferred = false; // In region mode until the heap grows past the region limit
+    // Blocks whose old cells an incremental or lazy sweep has yet to sweep, by size class
+    std::array<std::vector<SlabAllocator::Block*>, SlabAllocator::SIZE_CLASS_COUNT> m_unswept_blocks {};
+    size_t m_unswept_block_count = 0;
+    MarkScope m_mark_scope = MarkScope::ALL;
+    CollectionPhase m_phase = CollectionPhase::IDLE;
+    std::chrono::nanoseconds m_pause_budget = DEFAULT_GC_PAUSE_BUDGET;
+    bool m_concurrent_marking = false;
+    bool m_concurrent_cycle = false; // The marker thread is marking the old generation
+    uint32_t m_mark_threads = std::clamp(std::thread::hardware_concurrency(), 1U, 8U);
+    uint64_t m_parallel_mark_threshold = DEFAULT_PARALLEL_MARK_THRESHOLD;
+    bool m_lazy_sweeping = true;
+    bool m_background_freeing = false;
+    bool m_compaction = false;
+    bool m_compaction_due = false;
+    std::optional<Clock::time_point> m_major_collection_start {}; // Set until the first allocation after the collection
     VirtualMachine& m_vm;
-    std::vector<Object*> m_greyed_objects {}; // Refer 26.4.1 : The tricolor abstraction from https://craftinginterpreters.com/garbage-collection.html#tracing-object-references
-};
-
-class HeapContextManager {
-public:
-    HeapContextManager(Heap& heap, Compiler* current, Compiler* new_compiler);
-    ~HeapContextManager();
-
-private:
-    Heap& m_heap;
-    Compiler* m_current = nullptr;
+    SlabAllocator m_allocator;
+    SlabAllocator m_immortal_allocator;
+    std::vector<Object*> m_greyed_objects {};
+    std::vector<Object*> m_suspended_greyed_objects {}; // Grey stack of the incremental collection during a minor one
+    // The marker thread holds m_marker_mutex while it traces, as does the interpreter's thread while it touches the grey
+    // stack or stores into an old object during a concurrent cycle
+    std::mutex m_marker_mutex;
+    std::condition_variable m_marker_wakeup;
+    std::thread m_marker_thread;
+    bool m_marker_busy = false; // Guarded by m_marker_mutex, cleared once the marker thread has emptied the grey stack
+    bool m_marker_shutdown = false; // Guarded by m_marker_mutex
+    std::atomic<bool> m_interpreter_waiting = false; // The marker thread yields the lock between batches while set
+    std::vector<Object*> m_remembered_set {}; // Old objects that may reference young ones
+    std::vector<Object*> m_dead_objects {}; // Swept objects waiting to be handed over to the sweeper thread
+    std::mutex m_sweeper_mutex;
+    std::condition_variable m_sweeper_wakeup;
+    std::thread m_sweeper_thread;
+    std::vector<Object*> m_objects_to_destroy {}; // Guarded by m_sweeper_mutex
+    std::vector<void*> m_destroyed_objects {}; // Guarded by m_sweeper_mutex, cells to hand back to m_allocator
+    bool m_sweeper_shutdown = false; // Guarded by m_sweeper_mutex
+    CollectionStats m_collection_stats {};
+    AllocationStats m_allocation_stats {};
+    // Weak set of every live string, entries are dropped when the string is swept
+    std::unordered_set<StringObject*, InternedStringHash, InternedStringEqual> m_interned_strings {}; // Refer 26.4.1 : The tricolor abstraction from https://craftinginterpreters.com/garbage-collection.html#tracing-object-references
 };
 
 #endif // LOX_CPP_HEAP_H
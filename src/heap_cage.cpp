@@ -0,0 +1,107 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "heap_cage.h"
+
+#include "error.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <sys/mman.h>
+
+// Leaves room to align the base to the largest region alignment the heap asks for
+static constexpr auto MAX_ALIGNMENT = size_t { 2 } * 1024 * 1024;
+
+auto HeapCage::Instance() -> HeapCage&
+{
+    static auto cage = HeapCage {};
+    return cage;
+}
+
+HeapCage::HeapCage()
+    : m_reservation_size(SIZE + MAX_ALIGNMENT)
+{
+    m_reservation = mmap(nullptr, m_reservation_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    LOX_ASSERT(m_reservation != MAP_FAILED, "Could not reserve the heap cage");
+    auto const address = reinterpret_cast<uintptr_t>(m_reservation);
+    s_base = reinterpret_cast<std::byte*>((address + MAX_ALIGNMENT - 1) & ~(MAX_ALIGNMENT - 1));
+}
+
+HeapCage::~HeapCage()
+{
+    munmap(m_reservation, m_reservation_size);
+}
+
+// Takes a region of "size" bytes aligned to "alignment" out of "regions"
+[[nodiscard]] static auto TakeRegion(std::multimap<size_t, std::byte*>& regions, size_t size, size_t alignment) -> std::byte*
+{
+    auto [first, last] = regions.equal_range(size);
+    auto const is_aligned = [alignment](auto const& entry) { return (reinterpret_cast<uintptr_t>(entry.second) & (alignment - 1)) == 0; };
+    auto const it = std::find_if(first, last, is_aligned);
+    if (it == last) {
+        return nullptr;
+    }
+    auto* region = it->second;
+    regions.erase(it);
+    return region;
+}
+
+auto HeapCage::Allocate(size_t size, size_t alignment) -> void*
+{
+    LOX_ASSERT(alignment <= MAX_ALIGNMENT && (alignment & (alignment - 1)) == 0);
+    std::lock_guard const lock(m_mutex);
+    if (auto* region = TakeRegion(m_warm_regions, size, alignment); region != nullptr) {
+        m_warm_bytes -= size;
+        return region;
+    }
+    if (auto* region = TakeRegion(m_released_regions, size, alignment); region != nullptr) {
+        return region;
+    }
+    auto const offset = (m_top + alignment - 1) & ~(alignment - 1);
+    LOX_ASSERT(offset + size <= SIZE, "The heap cage is full");
+    m_top = offset + size;
+    return s_base + offset;
+}
+
+auto HeapCage::Free(void* region, size_t size) -> void
+{
+    LOX_ASSERT(Contains(region));
+    auto to_release = std::pair<size_t, std::byte*> {};
+    {
+        std::lock_guard const lock(m_mutex);
+        m_warm_regions.emplace(size, static_cast<std::byte*>(region));
+        m_warm_bytes += size;
+        if (m_warm_bytes <= MAX_WARM_BYTES) {
+            return;
+        }
+        // Off the lists while its pages are given back, no other heap can be handed the region in the meantime
+        to_release = *m_warm_regions.begin();
+        m_warm_regions.erase(m_warm_regions.begin());
+        m_warm_bytes -= to_release.first;
+    }
+    auto const [released_size, released_region] = to_release;
+    // The region stays reserved, its pages are zero-filled again on the next touch
+    madvise(released_region, released_size, MADV_DONTNEED);
+    std::lock_guard const lock(m_mutex);
+    m_released_regions.emplace(released_size, released_region);
+}
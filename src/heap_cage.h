@@ -0,0 +1,115 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_HEAP_CAGE_H
+#define LOX_CPP_HEAP_CAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+// A contiguous reservation of address space that the blocks of every heap of the process are carved out of when pointer
+// compression is enabled(LOX_POINTER_COMPRESSION). The references between objects(see ObjectRef) are then stored as the
+// 32 bit offset of the object from the base of the cage. The pages of the reservation are only backed by memory once
+// they are touched. Freed regions are kept for the next region of the same size and alignment: up to MAX_WARM_BYTES of
+// them keep their pages, the pages of the others go back to the system(madvise).
+class HeapCage {
+public:
+    static constexpr size_t SIZE = size_t { 4 } * 1024 * 1024 * 1024; // What a 32 bit offset can address
+    static constexpr size_t MAX_WARM_BYTES = size_t { 16 } * 1024 * 1024;
+
+    [[nodiscard]] static auto Instance() -> HeapCage&;
+    [[nodiscard]] static auto Base() -> std::byte*
+    {
+        return s_base;
+    }
+    // "size" bytes aligned to "alignment", a power of two
+    [[nodiscard]] auto Allocate(size_t size, size_t alignment) -> void*;
+    auto Free(void* region, size_t size) -> void;
+    [[nodiscard]] auto Contains(void const* address) const -> bool
+    {
+        auto const* byte = static_cast<std::byte const*>(address);
+        return byte >= s_base && byte < s_base + SIZE;
+    }
+
+private:
+    HeapCage();
+    ~HeapCage();
+
+    static inline std::byte* s_base = nullptr;
+    void* m_reservation = nullptr;
+    size_t m_reservation_size = 0;
+    std::mutex m_mutex;
+    size_t m_top = 0; // Offset of the first byte that was never handed out
+    std::multimap<size_t, std::byte*> m_warm_regions {};     // Freed regions that keep their pages, by size
+    std::multimap<size_t, std::byte*> m_released_regions {}; // Freed regions whose pages were given back, by size
+    size_t m_warm_bytes = 0;
+};
+
+#ifdef POINTER_COMPRESSION
+static constexpr auto POINTER_COMPRESSION_ENABLED = true;
+#else
+static constexpr auto POINTER_COMPRESSION_ENABLED = false;
+#endif
+
+// A reference from one heap object to another. With pointer compression it is stored as the offset of the object from
+// the base of the heap cage, zero standing for nullptr(no object starts at the base, it holds the first block's header),
+// otherwise as a plain pointer. Converts to and from T* implicitly.
+template<typename T>
+class ObjectRef {
+public:
+    ObjectRef() = default;
+    ObjectRef(T* object)
+#ifdef POINTER_COMPRESSION
+        : m_offset(object == nullptr ? 0 : static_cast<uint32_t>(reinterpret_cast<std::byte*>(object) - HeapCage::Base()))
+#else
+        : m_pointer(object)
+#endif
+    {
+    }
+    [[nodiscard]] auto Get() const -> T*
+    {
+#ifdef POINTER_COMPRESSION
+        return m_offset == 0 ? nullptr : reinterpret_cast<T*>(HeapCage::Base() + m_offset);
+#else
+        return m_pointer;
+#endif
+    }
+    operator T*() const
+    {
+        return Get();
+    }
+    auto operator->() const -> T*
+    {
+        return Get();
+    }
+
+private:
+#ifdef POINTER_COMPRESSION
+    uint32_t m_offset = 0;
+#else
+    T* m_pointer = nullptr;
+#endif
+};
+
+#endif // LOX_CPP_HEAP_CAGE_H
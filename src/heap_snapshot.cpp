@@ -0,0 +1,418 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "heap_snapshot.h"
+
+#include "heap.h"
+#include "virtual_machine.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fmt/core.h>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+static constexpr auto SNAPSHOT_MAGIC = std::string_view { "LOXHEAP1" };
+static constexpr auto MAX_STRING_NAME_LENGTH = size_t { 32 }; // Strings are named after their first characters
+
+// Calls "visit(name, referenced)" with every object "object" references, named after the field, method, upvalue or
+// constant that holds the reference
+template<typename Visit>
+static auto VisitNamedReferences(Object const* object, Visit&& visit) -> void
+{
+    auto const visit_value = [&visit](std::string name, Value value) {
+        if (value.IsObject()) {
+            visit(std::move(name), value.AsObjectPtr());
+        }
+    };
+    switch (object->GetType()) {
+    case ObjectType::STRING:
+    case ObjectType::NATIVE_FUNCTION:
+        break;
+    case ObjectType::UPVALUE: {
+        auto const* upvalue = static_cast<UpvalueObject const*>(object);
+        if (upvalue->IsClosed()) {
+            visit_value("value", upvalue->GetClosedValue());
+        }
+        break;
+    }
+    case ObjectType::FUNCTION: {
+        auto const& constants = static_cast<FunctionObject const*>(object)->chunk.constant_pool;
+        for (size_t index = 0; index < constants.size(); ++index) {
+            visit_value(fmt::format("constant {}", index), constants[index]);
+        }
+        break;
+    }
+    case ObjectType::CLOSURE: {
+        auto const* closure = static_cast<ClosureObject const*>(object);
+        visit("function", closure->function);
+        for (size_t index = 0; index < closure->upvalues.size(); ++index) {
+            visit(fmt::format("upvalue {}", index), closure->upvalues[index]);
+        }
+        break;
+    }
+    case ObjectType::CLASS: {
+        auto const* class_object = static_cast<ClassObject const*>(object);
+        for (auto const& [name, method] : class_object->methods) {
+            visit(std::string(name->data), method);
+        }
+        // The names of the fields of its instances, which the shape tree keeps alive
+        class_object->root_shape->VisitFieldNames([&visit](StringObject const* name) { visit("field name", name); });
+        break;
+    }
+    case ObjectType::INSTANCE: {
+        auto const* instance = static_cast<InstanceObject const*>(object);
+        visit("class", instance->class_);
+        for (uint32_t index = 0; index < instance->shape->FieldCount(); ++index) {
+            visit_value(std::string(instance->shape->FieldName(index)->data), instance->Field(index));
+        }
+        break;
+    }
+    case ObjectType::BOUND_METHOD: {
+        auto const* bound_method = static_cast<BoundMethodObject const*>(object);
+        visit("receiver", bound_method->receiver);
+        visit("method", bound_method->method);
+        break;
+    }
+    }
+}
+
+[[nodiscard]] static auto NodeName(Object const* object) -> std::string
+{
+    switch (object->GetType()) {
+    case ObjectType::STRING:
+        return std::string(std::string_view(static_cast<StringObject const*>(object)->data).substr(0, MAX_STRING_NAME_LENGTH));
+    case ObjectType::FUNCTION:
+        return static_cast<FunctionObject const*>(object)->function_name;
+    case ObjectType::CLOSURE:
+        return static_cast<ClosureObject const*>(object)->function->function_name;
+    case ObjectType::CLASS:
+        return static_cast<ClassObject const*>(object)->class_name;
+    case ObjectType::INSTANCE:
+        return static_cast<InstanceObject const*>(object)->class_->class_name;
+    case ObjectType::BOUND_METHOD:
+        return static_cast<BoundMethodObject const*>(object)->method->function->function_name;
+    case ObjectType::NATIVE_FUNCTION:
+    case ObjectType::UPVALUE:
+        return {};
+    }
+    __builtin_unreachable();
+}
+
+auto Heap::TakeSnapshot() const -> HeapSnapshot
+{
+    auto snapshot = HeapSnapshot {};
+    auto ids = std::unordered_map<Object const*, uint32_t> {};
+    auto unvisited = std::vector<Object const*> {};
+    auto const node_id = [&snapshot, &ids, &unvisited](Object const* object) -> uint32_t {
+        auto [it, inserted] = ids.try_emplace(object, static_cast<uint32_t>(snapshot.nodes.size()));
+        if (inserted) {
+            snapshot.nodes.push_back({ .type = object->GetType(), .shallow_size = object->footprint, .name = NodeName(object) });
+            unvisited.push_back(object);
+        }
+        return it->second;
+    };
+    auto const add_root = [&snapshot, &node_id](Object const* object, SnapshotRootKind kind, std::string name) {
+        snapshot.roots.push_back({ .node = node_id(object), .kind = kind, .name = std::move(name) });
+    };
+
+    // The same roots the collector marks from, see markRoots
+    for (size_t slot = 0; slot < m_vm.m_value_stack.size(); ++slot) {
+        if (auto const value = m_vm.m_value_stack[slot]; value.IsObject()) {
+            add_root(value.AsObjectPtr(), SnapshotRootKind::STACK, fmt::format("stack {}", slot));
+        }
+    }
+    for (size_t slot = 0; slot < m_vm.m_globals.m_names.size(); ++slot) {
+        auto const* name = m_vm.m_globals.m_names[slot];
+        add_root(name, SnapshotRootKind::GLOBAL, fmt::format("{} (name)", name->data));
+        if (auto const value = m_vm.m_globals.m_values[slot]; value.IsObject()) {
+            add_root(value.AsObjectPtr(), SnapshotRootKind::GLOBAL, std::string(name->data));
+        }
+    }
+    add_root(m_vm.m_init_string, SnapshotRootKind::VM, "init");
+    for (size_t depth = 0; depth < m_vm.m_frames.size(); ++depth) {
+        auto const* closure = m_vm.m_frames[depth].closure;
+        add_root(closure, SnapshotRootKind::FRAME, fmt::format("frame {} {}", depth, closure->function->function_name));
+    }
+    for (auto const* upvalue : m_vm.m_open_upvalues) {
+        add_root(upvalue, SnapshotRootKind::OPEN_UPVALUE, fmt::format("stack {}", upvalue->GetStackIndex()));
+    }
+
+    while (!unvisited.empty()) {
+        auto const* object = unvisited.back();
+        unvisited.pop_back();
+        auto const from = ids.at(object);
+        VisitNamedReferences(object, [&snapshot, &node_id, from](std::string name, Object const* referenced) {
+            auto const to = node_id(referenced);
+            snapshot.edges.push_back({ .from = from, .to = to, .name = std::move(name) });
+        });
+    }
+    return snapshot;
+}
+
+namespace {
+struct FileCloser {
+    auto operator()(std::FILE* file) const -> void
+    {
+        std::fclose(file);
+    }
+};
+using File = std::unique_ptr<std::FILE, FileCloser>;
+
+template<typename T>
+auto WriteNumber(std::FILE* file, T number) -> void
+{
+    std::fwrite(&number, sizeof(number), 1, file);
+}
+
+auto WriteString(std::FILE* file, std::string_view string) -> void
+{
+    WriteNumber(file, static_cast<uint32_t>(string.size()));
+    std::fwrite(string.data(), 1, string.size(), file);
+}
+
+template<typename T>
+[[nodiscard]] auto ReadNumber(std::FILE* file) -> std::optional<T>
+{
+    auto number = T {};
+    if (std::fread(&number, sizeof(number), 1, file) != 1) {
+        return std::nullopt;
+    }
+    return number;
+}
+
+[[nodiscard]] auto ReadString(std::FILE* file) -> std::optional<std::string>
+{
+    auto const length = ReadNumber<uint32_t>(file);
+    if (!length.has_value()) {
+        return std::nullopt;
+    }
+    auto string = std::string(*length, '\0');
+    if (std::fread(string.data(), 1, string.size(), file) != string.size()) {
+        return std::nullopt;
+    }
+    return string;
+}
+}
+
+auto WriteHeapSnapshot(HeapSnapshot const& snapshot, std::string_view path) -> bool
+{
+    auto const file = File { std::fopen(std::string(path).c_str(), "wb") };
+    if (file == nullptr) {
+        return false;
+    }
+    std::fwrite(SNAPSHOT_MAGIC.data(), 1, SNAPSHOT_MAGIC.size(), file.get());
+    WriteNumber(file.get(), static_cast<uint32_t>(snapshot.nodes.size()));
+    for (auto const& node : snapshot.nodes) {
+        WriteNumber(file.get(), static_cast<uint8_t>(node.type));
+        WriteNumber(file.get(), node.shallow_size);
+        WriteString(file.get(), node.name);
+    }
+    WriteNumber(file.get(), static_cast<uint32_t>(snapshot.edges.size()));
+    for (auto const& edge : snapshot.edges) {
+        WriteNumber(file.get(), edge.from);
+        WriteNumber(file.get(), edge.to);
+        WriteString(file.get(), edge.name);
+    }
+    WriteNumber(file.get(), static_cast<uint32_t>(snapshot.roots.size()));
+    for (auto const& root : snapshot.roots) {
+        WriteNumber(file.get(), root.node);
+        WriteNumber(file.get(), static_cast<uint8_t>(root.kind));
+        WriteString(file.get(), root.name);
+    }
+    return std::ferror(file.get()) == 0;
+}
+
+auto ReadHeapSnapshot(std::string_view path) -> std::optional<HeapSnapshot>
+{
+    auto const file = File { std::fopen(std::string(path).c_str(), "rb") };
+    if (file == nullptr) {
+        return std::nullopt;
+    }
+    auto magic = std::string(SNAPSHOT_MAGIC.size(), '\0');
+    if (std::fread(magic.data(), 1, magic.size(), file.get()) != magic.size() || magic != SNAPSHOT_MAGIC) {
+        return std::nullopt;
+    }
+    auto snapshot = HeapSnapshot {};
+    auto const node_count = ReadNumber<uint32_t>(file.get());
+    if (!node_count.has_value()) {
+        return std::nullopt;
+    }
+    for (uint32_t i = 0; i < *node_count; ++i) {
+        auto const type = ReadNumber<uint8_t>(file.get());
+        auto const shallow_size = ReadNumber<uint32_t>(file.get());
+        auto name = ReadString(file.get());
+        if (!type.has_value() || *type >= OBJECT_TYPE_COUNT || !shallow_size.has_value() || !name.has_value()) {
+            return std::nullopt;
+        }
+        snapshot.nodes.push_back({ .type = static_cast<ObjectType>(*type), .shallow_size = *shallow_size, .name = std::move(*name) });
+    }
+    auto const valid_node = [node_count](std::optional<uint32_t> node) { return node.has_value() && *node < *node_count; };
+    auto const edge_count = ReadNumber<uint32_t>(file.get());
+    if (!edge_count.has_value()) {
+        return std::nullopt;
+    }
+    for (uint32_t i = 0; i < *edge_count; ++i) {
+        auto const from = ReadNumber<uint32_t>(file.get());
+        auto const to = ReadNumber<uint32_t>(file.get());
+        auto name = ReadString(file.get());
+        if (!valid_node(from) || !valid_node(to) || !name.has_value()) {
+            return std::nullopt;
+        }
+        snapshot.edges.push_back({ .from = *from, .to = *to, .name = std::move(*name) });
+    }
+    auto const root_count = ReadNumber<uint32_t>(file.get());
+    if (!root_count.has_value()) {
+        return std::nullopt;
+    }
+    for (uint32_t i = 0; i < *root_count; ++i) {
+        auto const node = ReadNumber<uint32_t>(file.get());
+        auto const kind = ReadNumber<uint8_t>(file.get());
+        auto name = ReadString(file.get());
+        if (!valid_node(node) || !kind.has_value() || *kind > static_cast<uint8_t>(SnapshotRootKind::VM) || !name.has_value()) {
+            return std::nullopt;
+        }
+        snapshot.roots.push_back({ .node = *node, .kind = static_cast<SnapshotRootKind>(*kind), .name = std::move(*name) });
+    }
+    return snapshot;
+}
+
+auto ComputeDominators(HeapSnapshot const& snapshot) -> SnapshotDominators
+{
+    // The graph has a vertex for every node, one for every root and the virtual root that points to the roots' vertices
+    static constexpr auto UNDEFINED = UINT32_MAX;
+    auto const node_count = static_cast<uint32_t>(snapshot.nodes.size());
+    auto const root_count = static_cast<uint32_t>(snapshot.roots.size());
+    auto const virtual_root = node_count + root_count;
+    auto const vertex_count = virtual_root + 1;
+
+    // Successors and predecessors in compressed sparse row form
+    auto const build_adjacency = [&](bool reverse) {
+        auto offsets = std::vector<uint32_t>(vertex_count + 1, 0);
+        auto arcs = std::vector<std::pair<uint32_t, uint32_t>> {};
+        arcs.reserve(snapshot.edges.size() + 2 * size_t { root_count });
+        for (auto const& edge : snapshot.edges) {
+            arcs.emplace_back(edge.from, edge.to);
+        }
+        for (uint32_t root = 0; root < root_count; ++root) {
+            arcs.emplace_back(virtual_root, node_count + root);
+            arcs.emplace_back(node_count + root, snapshot.roots[root].node);
+        }
+        for (auto& [from, to] : arcs) {
+            if (reverse) {
+                std::swap(from, to);
+            }
+            ++offsets[from + 1];
+        }
+        for (uint32_t vertex = 0; vertex < vertex_count; ++vertex) {
+            offsets[vertex + 1] += offsets[vertex];
+        }
+        auto targets = std::vector<uint32_t>(arcs.size());
+        auto next = offsets;
+        for (auto const& [from, to] : arcs) {
+            targets[next[from]++] = to;
+        }
+        return std::pair { std::move(offsets), std::move(targets) };
+    };
+    auto const [successor_offsets, successors] = build_adjacency(false);
+    auto const [predecessor_offsets, predecessors] = build_adjacency(true);
+
+    // Depth-first postorder from the virtual root
+    auto postorder_number = std::vector<uint32_t>(vertex_count, UNDEFINED);
+    auto postorder = std::vector<uint32_t> {};
+    postorder.reserve(vertex_count);
+    {
+        auto visited = std::vector<bool>(vertex_count, false);
+        auto stack = std::vector<std::pair<uint32_t, uint32_t>> { { virtual_root, successor_offsets[virtual_root] } };
+        visited[virtual_root] = true;
+        while (!stack.empty()) {
+            auto& [vertex, next] = stack.back();
+            if (next == successor_offsets[vertex + 1]) {
+                postorder_number[vertex] = static_cast<uint32_t>(postorder.size());
+                postorder.push_back(vertex);
+                stack.pop_back();
+                continue;
+            }
+            auto const successor = successors[next++];
+            if (!visited[successor]) {
+                visited[successor] = true;
+                stack.emplace_back(successor, successor_offsets[successor]);
+            }
+        }
+    }
+
+    // "A Simple, Fast Dominance Algorithm", Cooper, Harvey and Kennedy
+    auto dominators = std::vector<uint32_t>(vertex_count, UNDEFINED);
+    dominators[virtual_root] = virtual_root;
+    auto const intersect = [&](uint32_t lhs, uint32_t rhs) {
+        while (lhs != rhs) {
+            while (postorder_number[lhs] < postorder_number[rhs]) {
+                lhs = dominators[lhs];
+            }
+            while (postorder_number[rhs] < postorder_number[lhs]) {
+                rhs = dominators[rhs];
+            }
+        }
+        return lhs;
+    };
+    for (auto changed = true; changed;) {
+        changed = false;
+        for (auto it = std::next(postorder.rbegin()); it != postorder.rend(); ++it) {
+            auto const vertex = *it;
+            auto dominator = UNDEFINED;
+            for (auto arc = predecessor_offsets[vertex]; arc < predecessor_offsets[vertex + 1]; ++arc) {
+                auto const predecessor = predecessors[arc];
+                if (dominators[predecessor] == UNDEFINED) {
+                    continue; // Not processed yet, or unreachable
+                }
+                dominator = dominator == UNDEFINED ? predecessor : intersect(predecessor, dominator);
+            }
+            if (dominators[vertex] != dominator) {
+                dominators[vertex] = dominator;
+                changed = true;
+            }
+        }
+    }
+
+    // A vertex comes after everything it dominates in postorder
+    auto retained = std::vector<uint64_t>(vertex_count, 0);
+    for (uint32_t node = 0; node < node_count; ++node) {
+        retained[node] = snapshot.nodes[node].shallow_size;
+    }
+    for (auto const vertex : postorder) {
+        if (vertex != virtual_root) {
+            retained[dominators[vertex]] += retained[vertex];
+        }
+    }
+
+    auto result = SnapshotDominators {};
+    result.immediate_dominators.resize(node_count, SnapshotDominators::VIRTUAL_ROOT);
+    for (uint32_t node = 0; node < node_count; ++node) {
+        if (dominators[node] < node_count) {
+            result.immediate_dominators[node] = dominators[node];
+        }
+    }
+    result.retained_sizes.assign(retained.begin(), retained.begin() + node_count);
+    result.root_retained_sizes.assign(retained.begin() + node_count, retained.begin() + virtual_root);
+    return result;
+}
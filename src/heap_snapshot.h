@@ -0,0 +1,89 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_HEAP_SNAPSHOT_H
+#define LOX_CPP_HEAP_SNAPSHOT_H
+
+#include "object.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Where a root of the snapshot points from
+enum class SnapshotRootKind : uint8_t {
+    GLOBAL,
+    STACK,
+    FRAME,
+    OPEN_UPVALUE,
+    VM, // References the VM holds on to itself, e.g. the interned "init"
+};
+
+// The objects reachable from the VM's roots, see Heap::TakeSnapshot. Nodes are numbered in the order they were reached
+// and carry the name of their class (instances and classes), of their function (closures and functions) or the first
+// characters of their contents (strings). Edges are named after the field, method, upvalue or constant they stand for.
+//
+// The file layout is the magic "LOXHEAP1" followed by the node, edge and root counts each followed by as many records:
+//     node: u8 object type, u32 shallow size, string name
+//     edge: u32 from, u32 to, string name
+//     root: u32 node, u8 root kind, string name
+// where a string is its u32 length followed by its bytes. Numbers are stored in the byte order of the machine that took
+// the snapshot.
+struct HeapSnapshot {
+    struct Node {
+        ObjectType type;
+        uint32_t shallow_size; // Bytes of the object and the buffers it owns
+        std::string name;
+    };
+    struct Edge {
+        uint32_t from;
+        uint32_t to;
+        std::string name;
+    };
+    struct Root {
+        uint32_t node;
+        SnapshotRootKind kind;
+        std::string name;
+    };
+    std::vector<Node> nodes;
+    std::vector<Edge> edges;
+    std::vector<Root> roots;
+};
+
+[[nodiscard]] auto WriteHeapSnapshot(HeapSnapshot const& snapshot, std::string_view path) -> bool;
+[[nodiscard]] auto ReadHeapSnapshot(std::string_view path) -> std::optional<HeapSnapshot>;
+
+// The dominator tree of a snapshot, rooted at a virtual node that points to every root. Node n is dominated by another
+// node d if every path from the roots to n passes through d, the retained size of d is what freeing it would free.
+struct SnapshotDominators {
+    static constexpr auto VIRTUAL_ROOT = UINT32_MAX;
+    std::vector<uint32_t> immediate_dominators; // By node, VIRTUAL_ROOT for the nodes that no other node dominates
+    std::vector<uint64_t> retained_sizes;       // By node
+    // By root: the size of what only that root keeps alive, zero for roots whose target is shared with another root
+    std::vector<uint64_t> root_retained_sizes;
+};
+
+[[nodiscard]] auto ComputeDominators(HeapSnapshot const& snapshot) -> SnapshotDominators;
+
+#endif // LOX_CPP_HEAP_SNAPSHOT_H
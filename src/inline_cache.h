@@ -0,0 +1,117 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_INLINE_CACHE_H
+#define LOX_CPP_INLINE_CACHE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+class Shape;
+struct ClosureObject;
+
+// What a property access resolved to for receivers of one shape
+struct PropertyCacheEntry {
+    enum class Kind : uint8_t {
+        FIELD,     // The receiver has the field at "slot"
+        METHOD,    // The receiver has no such field, the name resolves to "method" of its class
+        ADD_FIELD, // Assignment that adds a new field, the receiver moves to "transition" and the value goes to "slot"
+    };
+    static auto Field(uint64_t shape_id, uint32_t slot) -> PropertyCacheEntry
+    {
+        PropertyCacheEntry entry;
+        entry.shape_id = shape_id;
+        entry.slot = slot;
+        entry.kind = Kind::FIELD;
+        return entry;
+    }
+    static auto Method(uint64_t shape_id, ClosureObject* method) -> PropertyCacheEntry
+    {
+        PropertyCacheEntry entry;
+        entry.shape_id = shape_id;
+        entry.method = method;
+        entry.kind = Kind::METHOD;
+        return entry;
+    }
+    static auto AddField(uint64_t shape_id, Shape* transition, uint32_t slot) -> PropertyCacheEntry
+    {
+        PropertyCacheEntry entry;
+        entry.shape_id = shape_id;
+        entry.transition = transition;
+        entry.slot = slot;
+        entry.kind = Kind::ADD_FIELD;
+        return entry;
+    }
+
+    uint64_t shape_id = 0; // Shape ids start at 1, so an empty entry never matches
+    union {
+        ClosureObject* method = nullptr;
+        Shape* transition;
+    };
+    uint32_t slot = 0;
+    Kind kind = Kind::FIELD;
+};
+
+// Inline cache for a single OP_GET_PROPERTY/OP_SET_PROPERTY instruction. Starts out empty, remembers the resolution
+// for the first few receiver shapes that are seen(monomorphic, then polymorphic) and gives up on caching once the
+// instruction has seen more than POLYMORPHIC_LIMIT shapes(megamorphic).
+// A shape belongs to exactly one class and a class' methods are all defined before any of its instances exist, so the
+// shape id alone identifies both the field layout and the method table. Entries for shapes that have been collected are
+// never matched again since shape ids are never reused, which is why the cached pointers need not be traced by the GC.
+struct PropertyCache {
+    static constexpr size_t POLYMORPHIC_LIMIT = 4;
+
+    [[nodiscard]] auto Find(uint64_t shape_id) const -> PropertyCacheEntry const*
+    {
+        for (uint8_t i = 0; i < size; ++i) {
+            if (entries[i].shape_id == shape_id) {
+                return &entries[i];
+            }
+        }
+        return nullptr;
+    }
+    auto Insert(PropertyCacheEntry const& entry) -> void
+    {
+        if (megamorphic) {
+            return;
+        }
+        if (size == POLYMORPHIC_LIMIT) {
+            megamorphic = true;
+            return;
+        }
+        entries[size++] = entry;
+    }
+
+    std::array<PropertyCacheEntry, POLYMORPHIC_LIMIT> entries {};
+    uint8_t size = 0;
+    bool megamorphic = false;
+};
+
+// Aggregate counters over every property cache executed by a VirtualMachine
+struct PropertyCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;             // Lookups that took the slow path, including the megamorphic ones
+    uint64_t megamorphic_misses = 0; // Slow path lookups at instructions that stopped caching
+};
+
+#endif // LOX_CPP_INLINE_CACHE_H
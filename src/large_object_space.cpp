@@ -0,0 +1,142 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "large_object_space.h"
+
+#include "error.h"
+
+#include <algorithm>
+#include <bit>
+#include <optional>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+[[nodiscard]] static auto PageSize() -> size_t
+{
+    static auto const page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page_size;
+}
+
+// Mapping sizes step by an eighth of a power of two, a string that is rebuilt a little longer every time keeps fitting the
+// mapping its last version was freed from
+[[nodiscard]] static auto MappingSize(size_t size) -> size_t
+{
+    auto const step = std::max(std::bit_floor(size) / 8, PageSize());
+    return (size + step - 1) & ~(step - 1);
+}
+
+auto LargeObjectSpace::Instance() -> LargeObjectSpace&
+{
+    static auto space = LargeObjectSpace {};
+    return space;
+}
+
+LargeObjectSpace::~LargeObjectSpace()
+{
+    for (auto const* mappings : { &m_warm_mappings, &m_cached_mappings }) {
+        for (auto const& [size, mapping] : *mappings) {
+            munmap(mapping, size);
+        }
+    }
+}
+
+// Takes the smallest mapping of at least "size" bytes but no more than twice that out of "mappings"
+[[nodiscard]] static auto TakeMapping(std::multimap<size_t, void*>& mappings, size_t size) -> std::optional<std::pair<size_t, void*>>
+{
+    auto it = mappings.lower_bound(size);
+    if (it == mappings.end() || it->first > 2 * size) {
+        return std::nullopt;
+    }
+    auto const mapping = *it;
+    mappings.erase(it);
+    return mapping;
+}
+
+auto LargeObjectSpace::Allocate(size_t size) -> void*
+{
+    {
+        std::lock_guard const lock(m_mutex);
+        auto mapping = TakeMapping(m_warm_mappings, size);
+        if (mapping.has_value()) {
+            m_stats.bytes_warm -= mapping->first;
+        } else if (mapping = TakeMapping(m_cached_mappings, size); mapping.has_value()) {
+            m_stats.bytes_cached -= mapping->first;
+        }
+        if (mapping.has_value()) {
+            ++m_stats.allocations;
+            m_stats.bytes_in_use += mapping->first;
+            m_mapping_sizes.emplace(mapping->second, mapping->first);
+            return mapping->second;
+        }
+    }
+    auto const mapping_size = MappingSize(size);
+    auto* mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    LOX_ASSERT(mapping != MAP_FAILED, "Out of memory");
+    std::lock_guard const lock(m_mutex);
+    ++m_stats.allocations;
+    m_stats.bytes_in_use += mapping_size;
+    m_mapping_sizes.emplace(mapping, mapping_size);
+    return mapping;
+}
+
+auto LargeObjectSpace::Free(void* payload) -> void
+{
+    auto to_release = std::pair<size_t, void*> {};
+    {
+        std::lock_guard const lock(m_mutex);
+        auto const it = m_mapping_sizes.find(payload);
+        LOX_ASSERT(it != m_mapping_sizes.end(), "Not a payload of the large object space");
+        auto const mapping_size = it->second;
+        m_mapping_sizes.erase(it);
+        ++m_stats.frees;
+        m_stats.bytes_in_use -= mapping_size;
+        m_warm_mappings.emplace(mapping_size, payload);
+        m_stats.bytes_warm += mapping_size;
+        if (m_stats.bytes_warm <= MAX_WARM_BYTES) {
+            return;
+        }
+        // The smallest warm mapping is the least likely to fit the next payload
+        to_release = *m_warm_mappings.begin();
+        m_warm_mappings.erase(m_warm_mappings.begin());
+        m_stats.bytes_warm -= to_release.first;
+    }
+    auto const [mapping_size, mapping] = to_release;
+    // The mapping stays, its pages are zero-filled again on the next touch
+    madvise(mapping, mapping_size, MADV_DONTNEED);
+    {
+        std::lock_guard const lock(m_mutex);
+        if (m_stats.bytes_cached + mapping_size <= MAX_CACHED_BYTES) {
+            m_cached_mappings.emplace(mapping_size, mapping);
+            m_stats.bytes_cached += mapping_size;
+            return;
+        }
+    }
+    munmap(mapping, mapping_size);
+}
+
+auto LargeObjectSpace::GetStats() const -> Stats
+{
+    std::lock_guard const lock(m_mutex);
+    return m_stats;
+}
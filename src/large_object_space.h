@@ -0,0 +1,114 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_LARGE_OBJECT_SPACE_H
+#define LOX_CPP_LARGE_OBJECT_SPACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Pages for the payloads of large objects: the characters of long strings and the overflow fields of instances with very
+// many fields. A payload of at least THRESHOLD bytes is given pages of its own, mapped from the system, instead of
+// sharing the malloc heap with the small buffers. It is never moved(moving its object moves the pointer to it). The
+// mapping of a freed payload is kept for the next payload that fits it: the largest ones keep their pages up to
+// MAX_WARM_BYTES, which saves faulting them in again when a string is rebuilt a little longer over and over, the pages of
+// the others go back to the system(madvise). The space is shared by every heap of the process, the sweeper threads free
+// payloads too.
+class LargeObjectSpace {
+public:
+    static constexpr size_t THRESHOLD = 32 * 1024;
+    static constexpr size_t MAX_WARM_BYTES = 2 * 1024 * 1024;    // Freed mappings that keep their pages
+    static constexpr size_t MAX_CACHED_BYTES = 64 * 1024 * 1024; // Freed mappings whose pages were given back
+
+    struct Stats {
+        uint64_t allocations = 0;
+        uint64_t frees = 0;
+        uint64_t bytes_in_use = 0; // Of the mappings of the payloads
+        uint64_t bytes_warm = 0;   // Of the freed mappings kept for reuse with their pages
+        uint64_t bytes_cached = 0; // Of the freed mappings kept for reuse whose pages were given back
+    };
+
+    [[nodiscard]] static auto Instance() -> LargeObjectSpace&;
+    [[nodiscard]] auto Allocate(size_t size) -> void*;
+    auto Free(void* payload) -> void;
+    [[nodiscard]] auto GetStats() const -> Stats;
+
+private:
+    LargeObjectSpace() = default;
+    ~LargeObjectSpace();
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<void*, size_t> m_mapping_sizes {}; // Of the payloads in use
+    std::multimap<size_t, void*> m_warm_mappings {};      // By size
+    std::multimap<size_t, void*> m_cached_mappings {};
+    Stats m_stats {};
+};
+
+#ifdef LARGE_OBJECT_SPACE
+static constexpr auto LARGE_OBJECT_SPACE_ENABLED = true;
+#else
+static constexpr auto LARGE_OBJECT_SPACE_ENABLED = false;
+#endif
+
+// Allocates buffers of at least LargeObjectSpace::THRESHOLD bytes from the large object space, the others with new
+template<typename T>
+struct LargeObjectAllocator {
+    using value_type = T;
+
+    LargeObjectAllocator() = default;
+    template<typename U>
+    LargeObjectAllocator(LargeObjectAllocator<U> const&)
+    {
+    }
+
+    [[nodiscard]] auto allocate(size_t count) -> T*
+    {
+        if (LARGE_OBJECT_SPACE_ENABLED && count * sizeof(T) >= LargeObjectSpace::THRESHOLD) {
+            return static_cast<T*>(LargeObjectSpace::Instance().Allocate(count * sizeof(T)));
+        }
+        return std::allocator<T> {}.allocate(count);
+    }
+    auto deallocate(T* buffer, size_t count) -> void
+    {
+        if (LARGE_OBJECT_SPACE_ENABLED && count * sizeof(T) >= LargeObjectSpace::THRESHOLD) {
+            LargeObjectSpace::Instance().Free(buffer);
+            return;
+        }
+        std::allocator<T> {}.deallocate(buffer, count);
+    }
+
+    template<typename U>
+    friend auto operator==(LargeObjectAllocator const&, LargeObjectAllocator<U> const&) -> bool
+    {
+        return true;
+    }
+};
+
+// The contents of string objects
+using LoxString = std::basic_string<char, std::char_traits<char>, LargeObjectAllocator<char>>;
+
+#endif // LOX_CPP_LARGE_OBJECT_SPACE_H
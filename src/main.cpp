@@ -20,18 +20,35 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include "metrics.h"
 #include "virtual_machine.h"
 
+#include <csignal>
+#include <cstdio>
 #include <iostream>
+#include <optional>
+#include <string>
 #include <unistd.h>
 
 #include <fmt/core.h>
 
 static constexpr auto USAGE =
     R"(
-usage: lox_cpp [LOX_SOURCE_FILE]
+usage: lox_cpp [--region-heap] [--metrics-json OUTPUT_FILE] [--heap-snapshot-on-signal OUTPUT_FILE] [LOX_SOURCE_FILE]
+    --region-heap                           Defer garbage collection until the heap holds 64MB, for short scripts
+    --metrics-json OUTPUT_FILE              Write the interpreter's metrics to OUTPUT_FILE as JSON once the program has run
+    --heap-snapshot-on-signal OUTPUT_FILE   Write a heap snapshot to OUTPUT_FILE whenever the process receives SIGUSR1
 )";
 
+struct Options {
+    std::string_view source_file_name;
+    std::optional<std::string_view> metrics_file_name;
+    std::optional<std::string_view> heap_snapshot_file_name;
+    bool region_heap = false;
+};
+
+static VirtualMachine* g_signalled_vm = nullptr; // The VM SIGUSR1 requests heap snapshots from
+
 static int Run(VirtualMachine& vm, Source& source)
 {
     auto result = vm.Interpret(source);
@@ -42,24 +59,66 @@ static int Run(VirtualMachine& vm, Source& source)
     return 0;
 }
 
-static int RunFromFile(std::string_view file_name)
+static bool WriteMetrics(VirtualMachine const& vm, std::string_view file_name)
+{
+    auto* file = std::fopen(std::string(file_name).c_str(), "w");
+    if (file == nullptr) {
+        fmt::print(stderr, "Could not open {}\n", file_name);
+        return false;
+    }
+    fmt::print(file, "{}", MetricsToJson(vm.Metrics()));
+    std::fclose(file);
+    return true;
+}
+
+static int RunFromFile(Options const& options)
 {
-    VirtualMachine vm;
+    VirtualMachine vm(nullptr, HeapOptions { .mode = options.region_heap ? HeapMode::REGION : HeapMode::GENERATIONAL });
     Source source;
-    if (!source.ReadFromFile(file_name)) {
+    if (!source.ReadFromFile(options.source_file_name)) {
+        return 1;
+    }
+    if (options.heap_snapshot_file_name.has_value()) {
+        vm.SetHeapSnapshotPath(std::string(*options.heap_snapshot_file_name));
+        g_signalled_vm = &vm;
+        std::signal(SIGUSR1, [](int) { g_signalled_vm->RequestHeapSnapshot(); });
+    }
+    auto const result = Run(vm, source);
+    std::signal(SIGUSR1, SIG_DFL);
+    g_signalled_vm = nullptr;
+    if (options.metrics_file_name.has_value() && !WriteMetrics(vm, *options.metrics_file_name)) {
         return 1;
     }
-    return Run(vm, source);
+    return result;
+}
+
+[[nodiscard]] static auto ParseOptions(int argc, char** argv) -> std::optional<Options>
+{
+    auto options = Options {};
+    for (int i = 1; i < argc; ++i) {
+        auto const argument = std::string_view { argv[i] };
+        if ((argument == "--metrics-json" || argument == "--heap-snapshot-on-signal") && i + 1 < argc) {
+            (argument == "--metrics-json" ? options.metrics_file_name : options.heap_snapshot_file_name) = argv[++i];
+        } else if (argument == "--region-heap") {
+            options.region_heap = true;
+        } else if (options.source_file_name.empty() && !argument.starts_with("--")) {
+            options.source_file_name = argument;
+        } else {
+            return std::nullopt;
+        }
+    }
+    if (options.source_file_name.empty()) {
+        return std::nullopt;
+    }
+    return options;
 }
 
 int main(int argc, char** argv)
 {
-    switch (argc) {
-    case 2:
-        return RunFromFile(argv[1]);
-    default: {
+    auto const options = ParseOptions(argc, argv);
+    if (!options.has_value()) {
         fmt::print("{}", USAGE);
         return 1;
     }
-    }
-}
\ No newline at end of file
+    return RunFromFile(*options);
+}
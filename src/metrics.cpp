@@ -0,0 +1,156 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "metrics.h"
+
+#include "object.h"
+
+#include <array>
+#include <chrono>
+#include <unordered_map>
+#include <fmt/core.h>
+
+static auto ObjectTypeName(ObjectType type) -> std::string_view
+{
+    switch (type) {
+    case ObjectType::STRING:
+        return "string";
+    case ObjectType::FUNCTION:
+        return "function";
+    case ObjectType::CLOSURE:
+        return "closure";
+    case ObjectType::NATIVE_FUNCTION:
+        return "native_function";
+    case ObjectType::UPVALUE:
+        return "upvalue";
+    case ObjectType::CLASS:
+        return "class";
+    case ObjectType::INSTANCE:
+        return "instance";
+    case ObjectType::BOUND_METHOD:
+        return "bound_method";
+    }
+    __builtin_unreachable();
+}
+
+// The names of the numbered counters are formatted once, a lookup by name allocates nothing
+static auto PauseBucketMetricName(size_t bucket) -> std::string_view
+{
+    static auto const names = [] {
+        auto names = std::array<std::string, PAUSE_HISTOGRAM_BUCKETS> {};
+        for (size_t bucket = 0; bucket < PAUSE_HISTOGRAM_BUCKETS; ++bucket) {
+            auto const lower_bound = bucket == 0 ? uint64_t { 0 } : uint64_t { 1 } << (bucket - 1);
+            names[bucket] = fmt::format("gc.pauses.{}us", lower_bound);
+        }
+        return names;
+    }();
+    return names[bucket];
+}
+
+static auto AllocationMetricName(size_t type, bool bytes) -> std::string_view
+{
+    static auto const names = [] {
+        auto names = std::array<std::array<std::string, 2>, OBJECT_TYPE_COUNT> {};
+        for (size_t type = 0; type < OBJECT_TYPE_COUNT; ++type) {
+            auto const name = ObjectTypeName(static_cast<ObjectType>(type));
+            names[type] = { fmt::format("alloc.{}.objects", name), fmt::format("alloc.{}.bytes", name) };
+        }
+        return names;
+    }();
+    return names[type][bytes ? 1 : 0];
+}
+
+// Calls visitor(name, value) for every counter, in the order they are exported
+template<typename Visitor>
+static auto ForEachMetric(RuntimeMetrics const& metrics, Visitor&& visitor) -> void
+{
+    auto const nanoseconds = [](std::chrono::nanoseconds duration) { return static_cast<uint64_t>(duration.count()); };
+    visitor("vm.instructions_executed", metrics.instructions_executed);
+    visitor("vm.frames_pushed", metrics.frames_pushed);
+    visitor("heap.bytes", metrics.heap_bytes);
+    visitor("heap.peak_bytes", metrics.allocations.peak_heap_bytes);
+    visitor("heap.objects_allocated", metrics.objects_allocated);
+
+    auto const& collections = metrics.collections;
+    visitor("gc.minor_collections", collections.minor_collections);
+    visitor("gc.major_collections", collections.major_collections);
+    visitor("gc.incremental_steps", collections.incremental_steps);
+    visitor("gc.concurrent_markings", collections.concurrent_markings);
+    visitor("gc.parallel_markings", collections.parallel_markings);
+    visitor("gc.lazy_sweeps", collections.lazy_sweeps);
+    visitor("gc.compactions", collections.compactions);
+    visitor("gc.objects_moved", collections.objects_moved);
+    visitor("gc.objects_freed_in_background", collections.objects_freed_in_background);
+    visitor("gc.total_minor_pause_ns", nanoseconds(collections.total_minor_pause));
+    visitor("gc.total_major_pause_ns", nanoseconds(collections.total_major_pause));
+    visitor("gc.longest_minor_pause_ns", nanoseconds(collections.longest_minor_pause));
+    visitor("gc.longest_major_pause_ns", nanoseconds(collections.longest_major_pause));
+    visitor("gc.total_major_mark_time_ns", nanoseconds(collections.total_major_mark_time));
+    for (size_t bucket = 0; bucket < PAUSE_HISTOGRAM_BUCKETS; ++bucket) {
+        visitor(PauseBucketMetricName(bucket), collections.pause_histogram[bucket]);
+    }
+
+    for (size_t type = 0; type < OBJECT_TYPE_COUNT; ++type) {
+        visitor(AllocationMetricName(type, false), metrics.allocations.objects[type]);
+        visitor(AllocationMetricName(type, true), metrics.allocations.bytes[type]);
+    }
+
+    visitor("los.allocations", metrics.large_objects.allocations);
+    visitor("los.frees", metrics.large_objects.frees);
+    visitor("los.bytes_in_use", metrics.large_objects.bytes_in_use);
+    visitor("los.bytes_warm", metrics.large_objects.bytes_warm);
+    visitor("los.bytes_cached", metrics.large_objects.bytes_cached);
+}
+
+auto LookupMetric(RuntimeMetrics const& metrics, std::string_view name) -> std::optional<uint64_t>
+{
+    // The position of every counter in the order ForEachMetric visits them, built on the first lookup
+    static auto const indices = [] {
+        auto indices = std::unordered_map<std::string_view, size_t> {};
+        ForEachMetric(RuntimeMetrics {}, [&indices](std::string_view metric_name, uint64_t) { indices.emplace(metric_name, indices.size()); });
+        return indices;
+    }();
+    auto const it = indices.find(name);
+    if (it == indices.end()) {
+        return std::nullopt;
+    }
+    auto result = uint64_t { 0 };
+    auto index = size_t { 0 };
+    ForEachMetric(metrics, [&result, &index, wanted = it->second](std::string_view, uint64_t value) {
+        if (index++ == wanted) {
+            result = value;
+        }
+    });
+    return result;
+}
+
+auto MetricsToJson(RuntimeMetrics const& metrics) -> std::string
+{
+    auto json = std::string { "{" };
+    auto separator = "\n";
+    ForEachMetric(metrics, [&json, &separator](std::string_view name, uint64_t value) {
+        json += fmt::format("{}  \"{}\": {}", separator, name, value);
+        separator = ",\n";
+    });
+    json += "\n}\n";
+    return json;
+}
@@ -0,0 +1,52 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_METRICS_H
+#define LOX_CPP_METRICS_H
+
+#include "heap.h"
+#include "large_object_space.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Snapshot of the counters of the VM and its heap, see VirtualMachine::Metrics. Every counter has a dot-separated name,
+// e.g. "gc.minor_collections" or "alloc.instance.bytes", under which scripts read it through the Metric native function
+// and under which it is exported. Durations are counted in nanoseconds. The pause histogram is exported as one counter
+// per bucket, "gc.pauses.<n>us" counts the pauses from n microseconds up to the lower bound of the next bucket.
+struct RuntimeMetrics {
+    uint64_t instructions_executed = 0;
+    uint64_t frames_pushed = 0;
+    uint64_t heap_bytes = 0;
+    uint64_t objects_allocated = 0;
+    CollectionStats collections {};
+    AllocationStats allocations {};
+    LargeObjectSpace::Stats large_objects {}; // Of the whole process, the space is shared by every heap
+};
+
+[[nodiscard]] auto LookupMetric(RuntimeMetrics const& metrics, std::string_view name) -> std::optional<uint64_t>;
+// A flat JSON object of every counter by name
+[[nodiscard]] auto MetricsToJson(RuntimeMetrics const& metrics) -> std::string;
+
+#endif // LOX_CPP_METRICS_H
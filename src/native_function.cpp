@@ -21,10 +21,14 @@
 // SOFTWARE.
 
 #include "native_function.h"
+#include "metrics.h"
+#include "virtual_machine.h"
+
 #include <chrono>
 
-auto SystemTimeNow(uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>
+auto SystemTimeNow(VirtualMachine& vm, uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>
 {
+    static_cast<void>(vm);
     if (num_arguments != 0) {
         return std::unexpected(Error { .error_message = fmt::format("Number of arguments to SystemTimeNow not 0") });
     }
@@ -34,11 +38,45 @@ auto SystemTimeNow(uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Valu
     return Value { static_cast<double>(time_since_epoch_us.count()) };
 }
 
-auto Echo(uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>
+auto Echo(VirtualMachine& vm, uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>
 {
+    static_cast<void>(vm);
     LOX_ASSERT(values != nullptr);
     if (num_arguments != 1) {
         return std::unexpected(Error { .error_message = fmt::format("Number of arguments to SystemTimeNow not 0") });
     }
     return values[0];
-}
\ No newline at end of file
+}
+
+auto Metric(VirtualMachine& vm, uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>
+{
+    if (num_arguments != 1) {
+        return std::unexpected(Error { .error_message = "Number of arguments to Metric not 1" });
+    }
+    LOX_ASSERT(values != nullptr);
+    if (!values[0].IsObject() || values[0].AsObject().GetType() != ObjectType::STRING) {
+        return std::unexpected(Error { .error_message = "Metric expects the name of a metric" });
+    }
+    auto const& name = static_cast<StringObject const&>(values[0].AsObject()).data;
+    auto const value = LookupMetric(vm.Metrics(), name);
+    if (!value.has_value()) {
+        return std::unexpected(Error { .error_message = fmt::format("Unknown metric \"{}\"", name) });
+    }
+    return Value { static_cast<double>(*value) };
+}
+
+auto DumpHeapSnapshot(VirtualMachine& vm, uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>
+{
+    if (num_arguments != 1) {
+        return std::unexpected(Error { .error_message = "Number of arguments to HeapSnapshot not 1" });
+    }
+    LOX_ASSERT(values != nullptr);
+    if (!values[0].IsObject() || values[0].AsObject().GetType() != ObjectType::STRING) {
+        return std::unexpected(Error { .error_message = "HeapSnapshot expects the path of the snapshot file" });
+    }
+    auto const& path = static_cast<StringObject const&>(values[0].AsObject()).data;
+    if (!vm.WriteHeapSnapshot(path)) {
+        return std::unexpected(Error { .error_message = fmt::format("Could not write the heap snapshot to \"{}\"", path) });
+    }
+    return Value {};
+}
@@ -26,6 +26,12 @@
 #include "error.h"
 #include "value.h"
 
-[[nodiscard]] auto SystemTimeNow(uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>;
-[[nodiscard]] auto Echo(uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>;
+class VirtualMachine;
+
+[[nodiscard]] auto SystemTimeNow(VirtualMachine& vm, uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>;
+[[nodiscard]] auto Echo(VirtualMachine& vm, uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>;
+// Metric(name) returns the current value of one of the counters of VirtualMachine::Metrics, see metrics.h
+[[nodiscard]] auto Metric(VirtualMachine& vm, uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>;
+// HeapSnapshot(path) writes a heap snapshot to the file at "path", see heap_snapshot.h
+[[nodiscard]] auto DumpHeapSnapshot(VirtualMachine& vm, uint32_t num_arguments, Value* values) -> RuntimeErrorOr<Value>;
 #endif // LOX_CPP_NATIVE_FUNCTION_H
\ No newline at end of file
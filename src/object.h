@@ -25,18 +25,27 @@
 
 #include "chunk.h"
 #include "error.h"
+#include "heap_cage.h"
+#include "large_object_space.h"
 #include "native_function.h"
+#include "shape.h"
+#include "slab_allocator.h"
 #include "value.h"
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <variant>
 
-using Table = std::unordered_map<std::string, Value>;
-
-enum class ObjectType {
+// One byte, which keeps the header of an object at 8 bytes
+enum class ObjectType : uint8_t {
     STRING,
     FUNCTION,
     CLOSURE,
@@ -46,6 +55,7 @@ enum class ObjectType {
     INSTANCE,
     BOUND_METHOD
 };
+static constexpr auto OBJECT_TYPE_COUNT = static_cast<size_t>(ObjectType::BOUND_METHOD) + 1;
 
 template<>
 struct fmt::formatter<ObjectType> {
@@ -75,6 +85,7 @@ struct fmt::formatter<ObjectType> {
         case ObjectType::BOUND_METHOD:
             return fmt::format_to(ctx.out(), "ObjectType::BOUND_METHOD");
         }
+        __builtin_unreachable();
     }
 };
 
@@ -84,10 +95,20 @@ struct Object {
         return type;
     }
 
+    // The mark bits live in the bitmaps of the heap's blocks, only objects allocated by the Heap can be marked
     inline void MarkObjectAsReachable() const
     {
         GCDebugLog("Marking object(type={}) at:{} as reachable", type, static_cast<void const*>(this));
-        marked = true;
+        (void)SlabAllocator::TryMark(this);
+    }
+    [[nodiscard]] auto IsMarked() const -> bool
+    {
+        return SlabAllocator::IsMarked(this);
+    }
+    // Marks the object, returns false if it already was. Of several threads marking the object at once only one succeeds.
+    [[nodiscard]] auto TryMark() const -> bool
+    {
+        return SlabAllocator::TryMark(this);
     }
 
     Object() = delete;
@@ -96,25 +117,54 @@ struct Object {
         : type(type)
     {
     }
+    // A copy is not allocated by the heap, it starts out with a clean GC state
+    Object(Object const& other)
+        : type(other.type)
+    {
+    }
 
 private:
     friend class Heap;
     ObjectType type {};
-    Object* next = nullptr;
-    mutable bool marked = false;
+    bool old = false;        // Survived a collection, see Heap
+    bool remembered = false; // In the heap's remembered set
+    bool immortal = false;   // Never freed by the collector, see Heap
+    uint32_t footprint = 0;  // Bytes the heap counts for the object and the buffers it owns
 };
 
 struct StringObject : public Object {
     StringObject()
         : Object(ObjectType::STRING)
+        , hash(HashString({}))
     {
     }
     StringObject(std::string_view d)
         : Object(ObjectType::STRING)
         , data(d)
+        , hash(HashString(d))
+    {
+    }
+    [[nodiscard]] static auto HashString(std::string_view string) -> size_t
     {
+        return std::hash<std::string_view> {}(string);
     }
-    std::string data;
+    // Strings allocated on the Heap are interned and immutable, two equal strings are always the same object
+    LoxString data;
+    size_t hash;
+};
+
+// Hashes a string by its cached hash. Together with the default pointer equality this makes interned strings cheap keys.
+struct StringObjectHash {
+    auto operator()(StringObject const* string) const -> size_t
+    {
+        return string->hash;
+    }
+};
+
+// Number of in-place rewrites of a function's arithmetic and comparison instructions, see VirtualMachine::run
+struct QuickeningStats {
+    uint32_t specialized = 0;   // Generic instructions rewritten to their number-only variant
+    uint32_t despecialized = 0; // Number-only instructions reverted after seeing a non-number operand
 };
 
 struct FunctionObject : public Object {
@@ -133,9 +183,12 @@ struct FunctionObject : public Object {
     uint32_t arity {};
     Chunk chunk {};
     uint16_t upvalue_count {};
+    uint32_t max_stack_depth {}; // Maximum number of stack slots used by the frame, computed by the verifier
+    bool verified = false;
+    QuickeningStats quickening {};
 };
 
-using NativeFunction = std::add_pointer_t<RuntimeErrorOr<Value>(uint32_t num_arguments, Value*)>;
+using NativeFunction = std::add_pointer_t<RuntimeErrorOr<Value>(VirtualMachine& vm, uint32_t num_arguments, Value*)>;
 struct NativeFunctionObject : public Object {
     NativeFunctionObject()
         : Object(ObjectType::NATIVE_FUNCTION)
@@ -186,8 +239,8 @@ struct ClosureObject : public Object {
         : Object(ObjectType::CLOSURE)
     {
     }
-    std::vector<UpvalueObject*> upvalues {};
-    FunctionObject* function = nullptr;
+    std::vector<ObjectRef<UpvalueObject>> upvalues {};
+    ObjectRef<FunctionObject> function {};
 };
 
 struct ClassObject : public Object {
@@ -200,8 +253,9 @@ struct ClassObject : public Object {
         , class_name(cls_name)
     {
     }
-    std::unordered_map<std::string, ClosureObject*> methods;
+    std::unordered_map<StringObject const*, ClosureObject*, StringObjectHash> methods;
     std::string class_name;
+    std::unique_ptr<Shape> root_shape = std::make_unique<Shape>(); // Shape of instances without fields
 };
 
 struct InstanceObject : public Object {
@@ -212,10 +266,92 @@ struct InstanceObject : public Object {
     InstanceObject(ClassObject* cls)
         : Object(ObjectType::INSTANCE)
         , class_(cls)
+        , shape(cls->root_shape.get())
+    {
+    }
+    // Used by compaction, the overflow fields go with the instance
+    InstanceObject(InstanceObject&& other) noexcept
+        : Object(other)
+        , class_(other.class_)
+        , overflow_capacity(std::exchange(other.overflow_capacity, 0))
+        , shape(other.shape)
+        , inline_fields(other.inline_fields)
+        , overflow_fields(std::exchange(other.overflow_fields, nullptr))
+    {
+    }
+    InstanceObject(InstanceObject const&) = delete;
+    auto operator=(InstanceObject const&) -> InstanceObject& = delete;
+    ~InstanceObject()
+    {
+        if (overflow_fields != nullptr) {
+            LargeObjectAllocator<Value> {}.deallocate(overflow_fields, overflow_capacity);
+        }
+    }
+    // Returns a pointer to the field's storage or nullptr if the instance does not have the field
+    [[nodiscard]] auto GetField(StringObject const* name) -> Value*
+    {
+        auto index = shape->Lookup(name);
+        return index.has_value() ? &Field(*index) : nullptr;
+    }
+    // Adds or updates the field
+    auto SetField(StringObject const* name, Value value) -> void
+    {
+        if (auto* field = GetField(name); field != nullptr) {
+            *field = value;
+            return;
+        }
+        AddField(shape->Transition(name), value);
+    }
+    // Moves the instance to "new_shape", which must be a transition of the current shape, storing the new field's value
+    auto AddField(Shape* new_shape, Value value) -> void
     {
+        shape = new_shape;
+        if (shape->FieldCount() <= INLINE_FIELD_CAPACITY) {
+            inline_fields[shape->FieldCount() - 1] = value;
+            return;
+        }
+        auto const overflow_index = shape->FieldCount() - 1 - INLINE_FIELD_CAPACITY;
+        if (overflow_index == overflow_capacity) {
+            growOverflowFields();
+        }
+        overflow_fields[overflow_index] = value;
+    }
+    [[nodiscard]] auto Field(uint32_t index) -> Value&
+    {
+        return (index < INLINE_FIELD_CAPACITY) ? inline_fields[index] : overflow_fields[index - INLINE_FIELD_CAPACITY];
+    }
+    [[nodiscard]] auto Field(uint32_t index) const -> Value const&
+    {
+        return (index < INLINE_FIELD_CAPACITY) ? inline_fields[index] : overflow_fields[index - INLINE_FIELD_CAPACITY];
+    }
+    [[nodiscard]] auto OverflowBytes() const -> size_t
+    {
+        return overflow_capacity * sizeof(Value);
+    }
+
+    // The first few fields are stored in the instance itself, the rest in a separately allocated overflow array
+    static constexpr uint32_t INLINE_FIELD_CAPACITY = 4;
+
+    // The members are ordered so that the class reference and the capacity share a word when references are compressed
+    ObjectRef<ClassObject> class_ {};
+    uint32_t overflow_capacity = 0;
+    Shape* shape = nullptr; // Layout of the fields, owned by the class
+    std::array<Value, INLINE_FIELD_CAPACITY> inline_fields {};
+    Value* overflow_fields = nullptr; // The fields past the inline ones, their number is given by the shape
+
+private:
+    auto growOverflowFields() -> void
+    {
+        auto const new_capacity = std::max(overflow_capacity * 2, INLINE_FIELD_CAPACITY);
+        auto allocator = LargeObjectAllocator<Value> {};
+        auto* new_fields = allocator.allocate(new_capacity);
+        if (overflow_fields != nullptr) {
+            std::copy_n(overflow_fields, overflow_capacity, new_fields);
+            allocator.deallocate(overflow_fields, overflow_capacity);
+        }
+        overflow_fields = new_fields;
+        overflow_capacity = new_capacity;
     }
-    ClassObject* class_ = nullptr;
-    Table fields {};
 };
 
 struct BoundMethodObject : public Object {
@@ -223,7 +359,7 @@ struct BoundMethodObject : public Object {
         : Object(ObjectType::BOUND_METHOD)
     {
     }
-    InstanceObject* receiver {};
-    ClosureObject* method {};
+    ObjectRef<InstanceObject> receiver {};
+    ObjectRef<ClosureObject> method {};
 };
 #endif // LOX_CPP_OBJECT_H
@@ -0,0 +1,87 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "shape.h"
+
+#include "footprint.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace {
+auto NextShapeId() -> uint64_t
+{
+    static std::atomic<uint64_t> next_id { 1 }; // Zero is never a valid id, empty cache entries use it
+    return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+}
+
+Shape::Shape()
+    : m_id(NextShapeId())
+{
+}
+
+Shape::Shape(Shape const& parent, StringObject const* name)
+    : m_id(NextShapeId())
+    , m_field_names(parent.m_field_names)
+{
+    m_field_names.push_back(name);
+    if (m_field_names.size() > LINEAR_LOOKUP_LIMIT) {
+        m_field_index.reserve(m_field_names.size());
+        for (uint32_t index = 0; index < m_field_names.size(); ++index) {
+            m_field_index.emplace(m_field_names[index], index);
+        }
+    }
+}
+
+auto Shape::Lookup(StringObject const* name) const -> std::optional<uint32_t>
+{
+    if (m_field_names.size() > LINEAR_LOOKUP_LIMIT) {
+        if (auto it = m_field_index.find(name); it != m_field_index.end()) {
+            return it->second;
+        }
+        return {};
+    }
+    auto it = std::ranges::find(m_field_names, name);
+    if (it == m_field_names.end()) {
+        return {};
+    }
+    return static_cast<uint32_t>(std::distance(m_field_names.begin(), it));
+}
+
+auto Shape::Transition(StringObject const* name) -> Shape*
+{
+    auto& child = m_transitions[name];
+    if (child == nullptr) {
+        child.reset(new Shape(*this, name));
+    }
+    return child.get();
+}
+
+auto Shape::TreeBytes() const -> size_t
+{
+    auto bytes = sizeof(Shape) + VectorBytes(m_field_names) + HashMapBytes(m_field_index) + HashMapBytes(m_transitions);
+    for (auto const& [name, child] : m_transitions) {
+        bytes += child->TreeBytes();
+    }
+    return bytes;
+}
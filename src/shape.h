@@ -0,0 +1,116 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_SHAPE_H
+#define LOX_CPP_SHAPE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct StringObject;
+
+// A Shape(hidden class) describes the layout of an instance's fields: the i'th field name of the shape is stored in
+// the i'th field slot of every instance that has the shape. Shapes form a transition tree rooted at a ClassObject,
+// adding a field to an instance moves it to the child shape for that name. Instances that had their fields added in the
+// same order share a shape, so the layout is stored once per class instead of once per instance.
+// Field names are interned strings, they are compared and hashed by pointer.
+class Shape {
+public:
+    Shape();
+    Shape(Shape const&) = delete;
+    auto operator=(Shape const&) -> Shape& = delete;
+
+    // Unique for the lifetime of the process, unlike the address of a shape which can be reused once its class is
+    // collected. Inline caches key on the id so that they can never match a dead shape.
+    [[nodiscard]] auto Id() const -> uint64_t
+    {
+        return m_id;
+    }
+    [[nodiscard]] auto FieldCount() const -> uint32_t
+    {
+        return static_cast<uint32_t>(m_field_names.size());
+    }
+    [[nodiscard]] auto FieldName(uint32_t index) const -> StringObject const*
+    {
+        return m_field_names[index];
+    }
+    [[nodiscard]] auto Lookup(StringObject const* name) const -> std::optional<uint32_t>;
+    // Returns the shape that has all the fields of this shape followed by "name", created on first use
+    [[nodiscard]] auto Transition(StringObject const* name) -> Shape*;
+
+    // Bytes used by this shape and its sub-tree, counted towards the size of the class that owns the tree
+    [[nodiscard]] auto TreeBytes() const -> size_t;
+    // Visits the name of every field added anywhere in this shape's sub-tree, used by the GC to keep names alive
+    template<typename Visitor>
+    auto VisitFieldNames(Visitor&& visitor) const -> void
+    {
+        for (auto const& [name, child] : m_transitions) {
+            visitor(name);
+            child->VisitFieldNames(visitor);
+        }
+    }
+
+    // Replaces every field name in this shape's sub-tree with "forward(name)", used by the GC after it moved strings
+    template<typename Forward>
+    auto ForwardFieldNames(Forward&& forward) -> void
+    {
+        for (auto& name : m_field_names) {
+            name = forward(name);
+        }
+        forwardKeys(m_field_index, forward);
+        forwardKeys(m_transitions, forward);
+        for (auto const& [name, child] : m_transitions) {
+            child->ForwardFieldNames(forward);
+        }
+    }
+
+private:
+    Shape(Shape const& parent, StringObject const* name);
+
+    template<typename Map, typename Forward>
+    static auto forwardKeys(Map& map, Forward& forward) -> void
+    {
+        auto forwarded = Map {};
+        forwarded.reserve(map.size());
+        while (!map.empty()) {
+            auto node = map.extract(map.begin());
+            node.key() = forward(node.key());
+            forwarded.insert(std::move(node));
+        }
+        map = std::move(forwarded);
+    }
+
+    // Linear search over the names is faster than hashing for the small shapes that are the common case
+    static constexpr auto LINEAR_LOOKUP_LIMIT = 8U;
+
+    uint64_t m_id;
+    std::vector<StringObject const*> m_field_names;
+    std::unordered_map<StringObject const*, uint32_t> m_field_index; // Only populated for shapes above LINEAR_LOOKUP_LIMIT
+    std::unordered_map<StringObject const*, std::unique_ptr<Shape>> m_transitions;
+};
+
+#endif // LOX_CPP_SHAPE_H
@@ -0,0 +1,331 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "slab_allocator.h"
+
+#include "error.h"
+#include "heap_cage.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+#ifdef __linux__
+#    include <sys/mman.h>
+#endif
+
+// Freed cells are poisoned under AddressSanitizer, a dangling reference into a live block is reported just like a use
+// after free of a malloc'd object would be
+#if defined(__SANITIZE_ADDRESS__)
+#    include <sanitizer/asan_interface.h>
+#    define LOX_POISON_MEMORY(address, size) ASAN_POISON_MEMORY_REGION(address, size)
+#    define LOX_UNPOISON_MEMORY(address, size) ASAN_UNPOISON_MEMORY_REGION(address, size)
+#else
+#    define LOX_POISON_MEMORY(address, size) static_cast<void>(0)
+#    define LOX_UNPOISON_MEMORY(address, size) static_cast<void>(0)
+#endif
+
+static auto SetBit(std::array<uint64_t, SlabAllocator::BITMAP_WORDS>& bitmap, uint32_t index) -> void
+{
+    bitmap[index / 64] |= uint64_t { 1 } << (index % 64);
+}
+
+static auto ClearBit(std::array<uint64_t, SlabAllocator::BITMAP_WORDS>& bitmap, uint32_t index) -> void
+{
+    bitmap[index / 64] &= ~(uint64_t { 1 } << (index % 64));
+}
+
+SlabAllocator::SlabAllocator(size_t blocks_per_arena)
+    : m_blocks_per_arena(blocks_per_arena)
+{
+    LOX_ASSERT(blocks_per_arena > 0);
+}
+
+SlabAllocator::~SlabAllocator()
+{
+    for ([[maybe_unused]] auto* block : m_blocks) {
+        LOX_ASSERT(block->live_cells == 0 && block->retired_cells == 0, "Objects outlived their allocator");
+    }
+    freeBlockMemory();
+}
+
+// "count" blocks aligned to their size. With pointer compression they are carved out of the heap cage, see heap_cage.h.
+[[nodiscard]] static auto AllocateBlocks(size_t count) -> void*
+{
+    auto const size = count * SlabAllocator::BLOCK_SIZE;
+    if constexpr (POINTER_COMPRESSION_ENABLED) {
+        return HeapCage::Instance().Allocate(size, size);
+    }
+    auto* memory = std::aligned_alloc(size, size);
+    LOX_ASSERT(memory != nullptr, "Out of memory");
+    return memory;
+}
+
+static auto FreeBlocks(void* memory, size_t count) -> void
+{
+    if constexpr (POINTER_COMPRESSION_ENABLED) {
+        HeapCage::Instance().Free(memory, count * SlabAllocator::BLOCK_SIZE);
+    } else {
+        std::free(memory);
+    }
+}
+
+auto SlabAllocator::freeBlockMemory() -> void
+{
+    if (m_blocks_per_arena > 1) {
+        for (auto* arena : m_arenas) {
+            LOX_UNPOISON_MEMORY(arena, m_blocks_per_arena * BLOCK_SIZE);
+            FreeBlocks(arena, m_blocks_per_arena);
+        }
+        m_arenas.clear();
+    } else {
+        for (auto* block : m_blocks) {
+            LOX_UNPOISON_MEMORY(block, BLOCK_SIZE);
+            FreeBlocks(block, 1);
+        }
+        for (auto* block : m_spare_blocks) {
+            LOX_UNPOISON_MEMORY(block, BLOCK_SIZE);
+            FreeBlocks(block, 1);
+        }
+    }
+    m_blocks.clear();
+    m_spare_blocks.clear();
+}
+
+auto SlabAllocator::Allocate(size_t size) -> void*
+{
+    LOX_ASSERT(size > 0 && size <= MAX_CELL_SIZE, "Allocation does not fit in a cell");
+    auto const size_class = SizeClassOf(size);
+    auto* block = m_current_blocks[size_class];
+    if (block == nullptr || !block->HasFreeCell()) {
+        block = nullptr;
+        // Blocks that have been given free cells since they were last allocated from
+        auto& available_blocks = m_available_blocks[size_class];
+        while (block == nullptr && !available_blocks.empty()) {
+            block = available_blocks.back();
+            available_blocks.pop_back();
+            block->available = false;
+            if (!block->HasFreeCell()) {
+                block = nullptr;
+            }
+        }
+        if (block == nullptr) {
+            block = startNewBlock(size_class);
+        }
+        m_current_blocks[size_class] = block;
+    }
+    return allocateCell(block);
+}
+
+auto SlabAllocator::AllocateIn(Block* block) -> void*
+{
+    LOX_ASSERT(block->HasFreeCell(), "Block is full");
+    return allocateCell(block);
+}
+
+auto SlabAllocator::allocateCell(Block* block) -> void*
+{
+    auto index = uint32_t { 0 };
+    if (block->free_cells > 0) {
+        while (block->free[block->free_cursor] == 0) {
+            ++block->free_cursor;
+        }
+        auto& word = block->free[block->free_cursor];
+        index = block->free_cursor * 64 + static_cast<uint32_t>(std::countr_zero(word));
+        word &= word - 1;
+        --block->free_cells;
+    } else {
+        index = block->bump_index++;
+    }
+    auto* cell = block->Cell(index);
+    LOX_UNPOISON_MEMORY(cell, block->cell_size);
+    SetBit(block->allocated, index);
+    SetBit(block->young, index);
+    ++block->live_cells;
+    if (!block->has_young) {
+        block->has_young = true;
+        m_young_blocks.push_back(block);
+    }
+    return cell;
+}
+
+auto SlabAllocator::Free(void* cell) -> void
+{
+    Retire(cell);
+    Reclaim(cell);
+}
+
+auto SlabAllocator::Retire(void* cell) -> void
+{
+    auto* block = BlockOf(cell);
+    auto const index = block->CellIndex(cell);
+    LOX_ASSERT(block->live_cells > 0);
+    ClearBit(block->allocated, index);
+    ClearBit(block->young, index);
+    // Swept cells are unmarked, which saves the read-modify-write
+    auto const bit = uint64_t { 1 } << (index % 64);
+    if ((block->mark_state->marked[index / 64].load(std::memory_order_relaxed) & bit) != 0) {
+        block->mark_state->marked[index / 64].fetch_and(~bit, std::memory_order_relaxed);
+    }
+    --block->live_cells;
+    ++block->retired_cells;
+}
+
+auto SlabAllocator::Reclaim(void* cell) -> void
+{
+    auto* block = BlockOf(cell);
+    auto const index = block->CellIndex(cell);
+    LOX_ASSERT(block->retired_cells > 0);
+    --block->retired_cells;
+    SetBit(block->free, index);
+    ++block->free_cells;
+    block->free_cursor = std::min(block->free_cursor, index / 64);
+    LOX_POISON_MEMORY(cell, block->cell_size);
+    makeAvailable(block);
+}
+
+auto SlabAllocator::NeedsNewBlock(size_t size) const -> bool
+{
+    auto const size_class = SizeClassOf(size);
+    auto const has_free_cell = [](Block const* block) { return block->HasFreeCell(); };
+    auto const* current = m_current_blocks[size_class];
+    return (current == nullptr || !has_free_cell(current)) && std::ranges::none_of(m_available_blocks[size_class], has_free_cell);
+}
+
+auto SlabAllocator::TakeYoungBlocks() -> std::vector<Block*>
+{
+    for (auto* block : m_young_blocks) {
+        block->has_young = false;
+    }
+    return std::exchange(m_young_blocks, {});
+}
+
+auto SlabAllocator::ReleaseEmptyBlocks() -> void
+{
+    auto const empty = [](Block const* block) { return block->live_cells == 0 && block->retired_cells == 0; };
+    if (std::ranges::none_of(m_blocks, empty)) {
+        return;
+    }
+    for (auto& current : m_current_blocks) {
+        if (current != nullptr && empty(current)) {
+            current = nullptr;
+        }
+    }
+    for (auto& available_blocks : m_available_blocks) {
+        std::erase_if(available_blocks, empty);
+    }
+    std::erase_if(m_young_blocks, empty);
+    std::erase_if(m_blocks, [this, &empty](Block* block) {
+        if (!empty(block)) {
+            return false;
+        }
+        releaseBlock(block);
+        return true;
+    });
+}
+
+auto SlabAllocator::ReleaseAll() -> void
+{
+    for (auto* block : m_blocks) {
+        for (auto& word : block->mark_state->marked) {
+            word.store(0, std::memory_order_relaxed);
+        }
+        m_free_mark_states.push_back(block->mark_state);
+    }
+    m_current_blocks = {};
+    for (auto& available_blocks : m_available_blocks) {
+        available_blocks.clear();
+    }
+    m_young_blocks.clear();
+    freeBlockMemory();
+}
+
+auto SlabAllocator::startNewBlock(size_t size_class) -> Block*
+{
+    void* memory = nullptr;
+    if (!m_spare_blocks.empty()) {
+        memory = m_spare_blocks.back();
+        m_spare_blocks.pop_back();
+        LOX_UNPOISON_MEMORY(memory, FIRST_OFFSET);
+    } else {
+        // Arenas are aligned to their size, which lets the kernel back them with huge pages
+        memory = AllocateBlocks(m_blocks_per_arena);
+#ifdef __linux__
+        if (m_blocks_per_arena > 1) {
+            madvise(memory, m_blocks_per_arena * BLOCK_SIZE, MADV_HUGEPAGE);
+        }
+#endif
+        LOX_POISON_MEMORY(static_cast<std::byte*>(memory) + FIRST_OFFSET, m_blocks_per_arena * BLOCK_SIZE - FIRST_OFFSET);
+        if (m_blocks_per_arena > 1) {
+            // The arena's other blocks are handed out before the next arena is allocated
+            m_arenas.push_back(memory);
+            for (auto i = m_blocks_per_arena; i-- > 1;) {
+                m_spare_blocks.push_back(reinterpret_cast<Block*>(static_cast<std::byte*>(memory) + i * BLOCK_SIZE));
+            }
+        }
+    }
+    auto* block = new (memory) Block { .mark_state = takeMarkState() };
+    block->size_class = static_cast<uint32_t>(size_class);
+    block->cell_size = static_cast<uint32_t>((size_class + 1) * GRANULE);
+    block->cell_reciprocal = static_cast<uint32_t>(((uint64_t { 1 } << 32) + block->cell_size - 1) / block->cell_size);
+    block->cell_count = static_cast<uint32_t>((BLOCK_SIZE - FIRST_OFFSET) / block->cell_size);
+    m_blocks.push_back(block);
+    return block;
+}
+
+auto SlabAllocator::releaseBlock(Block* block) -> void
+{
+    m_free_mark_states.push_back(block->mark_state);
+    if (m_blocks_per_arena > 1 || m_spare_blocks.size() < MAX_SPARE_BLOCKS) {
+        LOX_POISON_MEMORY(block, BLOCK_SIZE);
+        m_spare_blocks.push_back(block);
+    } else {
+        LOX_UNPOISON_MEMORY(block, BLOCK_SIZE);
+        FreeBlocks(block, 1);
+    }
+}
+
+auto SlabAllocator::takeMarkState() -> MarkState*
+{
+    if (m_free_mark_states.empty()) {
+        auto& chunk = m_mark_state_chunks.emplace_back(std::make_unique<MarkState[]>(MARK_STATES_PER_CHUNK));
+        for (size_t i = MARK_STATES_PER_CHUNK; i-- > 0;) {
+            m_free_mark_states.push_back(&chunk[i]);
+        }
+    }
+    auto* mark_state = m_free_mark_states.back();
+    m_free_mark_states.pop_back();
+    // The cells of a released block were unmarked by the sweep that freed them
+    LOX_ASSERT(std::ranges::none_of(mark_state->marked, [](auto const& word) { return word.load(std::memory_order_relaxed) != 0; }));
+    mark_state->unswept = false;
+    return mark_state;
+}
+
+auto SlabAllocator::makeAvailable(Block* block) -> void
+{
+    if (!block->available && block != m_current_blocks[block->size_class]) {
+        block->available = true;
+        m_available_blocks[block->size_class].push_back(block);
+    }
+}
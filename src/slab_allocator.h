@@ -0,0 +1,186 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_SLAB_ALLOCATOR_H
+#define LOX_CPP_SLAB_ALLOCATOR_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Segregated-fit allocator for GC objects. Memory comes in BLOCK_SIZE aligned blocks that are each carved into cells of a
+// single size class. A block hands out its never used cells first and then its freed ones, blocks with free cells are kept
+// per size class. Every block has bitmaps of its allocated, free and young cells at its start, which lets the collector
+// sweep a block by walking its bitmaps and lets objects do without a pointer to the next one. Freeing a cell only sets
+// its bit, the dead cell's memory is not touched. The state the collector writes, the mark bitmap above all, is kept apart
+// from the blocks(see MarkState) so that a collection writes to neither the objects nor the blocks that survive it: a
+// process forked off the interpreter shares its heap copy-on-write, a collection in it only copies the mark states.
+class SlabAllocator {
+public:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    static constexpr size_t GRANULE = 16; // Cell sizes are multiples of the granule
+    static constexpr size_t MAX_CELL_SIZE = 512;
+    static constexpr size_t SIZE_CLASS_COUNT = MAX_CELL_SIZE / GRANULE;
+    static constexpr size_t BITMAP_WORDS = BLOCK_SIZE / GRANULE / 64;
+
+    // Packed next to the states of other blocks
+    struct MarkState {
+        std::array<std::atomic<uint64_t>, BITMAP_WORDS> marked {}; // Also written by the marker threads
+        bool unswept = false; // Set by the collector while the block's old cells have yet to be swept
+    };
+
+    struct Block {
+        uint32_t size_class = 0;
+        uint32_t cell_size = 0;
+        uint32_t cell_reciprocal = 0; // 2^32 / cell_size rounded up, turns the division in CellIndex into a multiplication
+        uint32_t cell_count = 0;
+        uint32_t live_cells = 0;
+        uint32_t retired_cells = 0; // Dead cells that are not free yet, see Retire
+        uint32_t bump_index = 0;    // Cells from here on have never been handed out
+        uint32_t free_cells = 0;
+        uint32_t free_cursor = 0; // No word before this one has a free cell
+        bool available = false; // On the list of blocks with free cells of its size class
+        bool has_young = false; // On the list of blocks with young cells
+        std::array<uint64_t, BITMAP_WORDS> allocated {};
+        std::array<uint64_t, BITMAP_WORDS> free {};
+        std::array<uint64_t, BITMAP_WORDS> young {}; // Allocated cells that have not been promoted yet
+        MarkState* mark_state = nullptr;
+
+        [[nodiscard]] auto CellIndex(void const* cell) const -> uint32_t
+        {
+            auto const offset = reinterpret_cast<uintptr_t>(cell) - reinterpret_cast<uintptr_t>(this) - FIRST_OFFSET;
+            return static_cast<uint32_t>((uint64_t { offset } * cell_reciprocal) >> 32);
+        }
+        [[nodiscard]] auto HasFreeCell() const -> bool
+        {
+            return free_cells > 0 || bump_index < cell_count;
+        }
+        [[nodiscard]] auto Cell(uint32_t index) -> void*
+        {
+            return reinterpret_cast<std::byte*>(this) + FIRST_OFFSET + size_t { index } * cell_size;
+        }
+        // Calls "visitor" with every cell whose bit is set in "bitmap(word_index)", in address order
+        template<typename Bitmap, typename Visitor>
+        auto ForEachCell(Bitmap&& bitmap, Visitor&& visitor) -> void
+        {
+            for (uint32_t word = 0; word * 64 < bump_index; ++word) {
+                for (auto bits = uint64_t { bitmap(word) }; bits != 0; bits &= bits - 1) {
+                    visitor(Cell(word * 64 + static_cast<uint32_t>(std::countr_zero(bits))));
+                }
+            }
+        }
+    };
+
+    // With more than one block per arena the blocks are carved out of arenas of that many, an emptied block is kept for
+    // reuse and the memory is only given back by ReleaseAll or the destructor
+    explicit SlabAllocator(size_t blocks_per_arena = 1);
+    SlabAllocator(SlabAllocator const&) = delete;
+    auto operator=(SlabAllocator const&) -> SlabAllocator& = delete;
+    ~SlabAllocator();
+
+    // The new cell is allocated, young and unmarked
+    [[nodiscard]] auto Allocate(size_t size) -> void*;
+    // Allocates a cell in the given block, which must have a free one. Lets the collector choose where an object moves to.
+    [[nodiscard]] auto AllocateIn(Block* block) -> void*;
+    auto Free(void* cell) -> void;
+    // Frees the cell in two steps: a retired cell no longer counts as allocated but is not reused until it is reclaimed,
+    // which leaves the time in between to destroy its object on another thread
+    auto Retire(void* cell) -> void;
+    auto Reclaim(void* cell) -> void;
+    // True if allocating "size" bytes has to start a new block
+    [[nodiscard]] auto NeedsNewBlock(size_t size) const -> bool;
+    // Returns the blocks that were given young cells since the last call
+    [[nodiscard]] auto TakeYoungBlocks() -> std::vector<Block*>;
+    // Gives the blocks without any allocated or retired cells back, no Block pointers may be held on to across the call
+    auto ReleaseEmptyBlocks() -> void;
+    // Gives every block back without freeing its cells one by one, the objects in them must have been destroyed
+    auto ReleaseAll() -> void;
+    [[nodiscard]] auto Blocks() const -> std::vector<Block*> const&
+    {
+        return m_blocks;
+    }
+    [[nodiscard]] auto BlocksInUse() const -> size_t
+    {
+        return m_blocks.size();
+    }
+    [[nodiscard]] static constexpr auto SizeClassOf(size_t size) -> size_t
+    {
+        return (size + GRANULE - 1) / GRANULE - 1;
+    }
+
+    [[nodiscard]] static auto BlockOf(void const* cell) -> Block*
+    {
+        return reinterpret_cast<Block*>(reinterpret_cast<uintptr_t>(cell) & ~(uintptr_t { BLOCK_SIZE } - 1));
+    }
+    [[nodiscard]] static auto IsMarked(void const* cell) -> bool
+    {
+        auto const* block = BlockOf(cell);
+        auto const index = block->CellIndex(cell);
+        return (block->mark_state->marked[index / 64].load(std::memory_order_relaxed) & (uint64_t { 1 } << (index % 64))) != 0;
+    }
+    // Returns false if the cell already was marked, of several threads marking a cell at once only one succeeds
+    [[nodiscard]] static auto TryMark(void const* cell) -> bool
+    {
+        auto* block = BlockOf(cell);
+        auto const index = block->CellIndex(cell);
+        auto const bit = uint64_t { 1 } << (index % 64);
+        auto& word = block->mark_state->marked[index / 64];
+        return (word.load(std::memory_order_relaxed) & bit) == 0 && (word.fetch_or(bit, std::memory_order_relaxed) & bit) == 0;
+    }
+    static auto Unmark(void const* cell) -> void
+    {
+        auto* block = BlockOf(cell);
+        auto const index = block->CellIndex(cell);
+        block->mark_state->marked[index / 64].fetch_and(~(uint64_t { 1 } << (index % 64)), std::memory_order_relaxed);
+    }
+
+    static constexpr size_t FIRST_OFFSET = (sizeof(Block) + GRANULE - 1) & ~(GRANULE - 1);
+
+private:
+    static constexpr size_t MAX_SPARE_BLOCKS = 4; // Empty blocks kept around to avoid churning through the system allocator
+
+    // Mark states are allocated in chunks of this many, the chunks are only given back by the destructor
+    static constexpr size_t MARK_STATES_PER_CHUNK = 64;
+
+    [[nodiscard]] auto allocateCell(Block* block) -> void*;
+    auto startNewBlock(size_t size_class) -> Block*;
+    auto releaseBlock(Block* block) -> void;
+    auto freeBlockMemory() -> void;
+    auto makeAvailable(Block* block) -> void;
+    [[nodiscard]] auto takeMarkState() -> MarkState*;
+
+    std::array<Block*, SIZE_CLASS_COUNT> m_current_blocks {}; // The block each size class allocates from
+    std::array<std::vector<Block*>, SIZE_CLASS_COUNT> m_available_blocks {};
+    std::vector<Block*> m_blocks {};
+    std::vector<Block*> m_young_blocks {};
+    std::vector<Block*> m_spare_blocks {};
+    size_t m_blocks_per_arena = 1;
+    std::vector<void*> m_arenas {};
+    std::vector<std::unique_ptr<MarkState[]>> m_mark_state_chunks {};
+    std::vector<MarkState*> m_free_mark_states {};
+};
+
+#endif // LOX_CPP_SLAB_ALLOCATOR_H
@@ -24,11 +24,17 @@
 
 #include "object.h"
 
+#ifndef NAN_BOXING
 auto Value::IsNil() const -> bool
 {
     return std::holds_alternative<NilType>(*this);
 }
 
+auto Value::IsUndefined() const -> bool
+{
+    return std::holds_alternative<UndefinedType>(*this);
+}
+
 auto Value::IsDouble() const -> bool
 {
     return std::holds_alternative<double>(*this);
@@ -44,24 +50,18 @@ auto Value::IsObject() const -> bool
     return std::holds_alternative<Object*>(*this);
 }
 
-auto Value::AsDouble() -> double&
+auto Value::AsDouble() const -> double
 {
     LOX_ASSERT(IsDouble());
     return *std::get_if<double>(this);
 }
 
-auto Value::AsBool() -> bool&
+auto Value::AsBool() const -> bool
 {
     LOX_ASSERT(IsBool());
     return *std::get_if<bool>(this);
 }
 
-auto Value::AsDouble() const -> double const&
-{
-    LOX_ASSERT(IsDouble());
-    return *std::get_if<double>(this);
-}
-
 auto Value::AsObject() const -> Object const&
 {
     LOX_ASSERT(IsObject());
@@ -85,29 +85,24 @@ auto Value::AsObjectPtr() const -> Object const*
     LOX_ASSERT(IsObject());
     return (*std::get_if<Object*>(this));
 }
-
-auto Value::AsBool() const -> bool const&
-{
-    LOX_ASSERT(IsBool());
-    return *std::get_if<bool>(this);
-}
+#endif
 
 auto Value::operator==(Value const& other) const -> bool
 {
-    if (this->index() != other.index()) {
-        return false;
-    }
-    if (this->IsBool()) {
-        return *std::get_if<bool>(this) == *std::get_if<bool>(&other);
-    } else if (this->IsDouble()) {
-        return std::abs(*std::get_if<double>(this) - *std::get_if<double>(&other)) < std::numeric_limits<double>::epsilon();
+    if (this->IsDouble()) {
+        return other.IsDouble() && std::abs(this->AsDouble() - other.AsDouble()) < std::numeric_limits<double>::epsilon();
+    } else if (this->IsBool()) {
+        return other.IsBool() && this->AsBool() == other.AsBool();
     } else if (this->IsNil()) {
-        // Implicitly means that "other" is also Nil as we already checked if the variant index is the same above.
-        return true;
+        return other.IsNil();
     } else if (this->IsObject()) {
+        if (!other.IsObject() || this->AsObject().GetType() != other.AsObject().GetType()) {
+            return false;
+        }
         switch (this->AsObject().GetType()) {
         case ObjectType::STRING: {
-            return static_cast<StringObject const*>(this->AsObjectPtr())->data == static_cast<StringObject const*>(other.AsObjectPtr())->data;
+            // Strings are interned, equal strings are the same object
+            return this->AsObjectPtr() == other.AsObjectPtr();
         }
         case ObjectType::FUNCTION: {
             auto function_ptr = static_cast<FunctionObject const*>(this->AsObjectPtr());
@@ -23,6 +23,10 @@
 #ifndef LOX_CPP_VALUE_H
 #define LOX_CPP_VALUE_H
 
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
 #include <variant>
 
 #include "error.h"
@@ -30,32 +34,140 @@
 struct Object;
 
 struct NilType { };
+// Marks global variable slots that were resolved by the compiler but have not been defined yet, never visible to scripts
+struct UndefinedType { };
 
-struct Value : public std::variant<NilType, double, bool, Object*> {
+#ifdef NAN_BOXING
+// A Value is a single 64 bit word. Doubles are stored as-is, every other type lives in the payload of a quiet NaN:
+//
+//   double   : any bit pattern that does not have all of the QNAN bits set
+//   nil      : QNAN | TAG_NIL
+//   bool     : QNAN | TAG_FALSE or QNAN | TAG_TRUE
+//   undefined: QNAN | TAG_UNDEFINED
+//   Object*  : SIGN_BIT | QNAN | <48 bit pointer>
+//
+// NaNs produced by arithmetic are canonicalized on construction so that they can never be confused for a tagged value.
+struct Value {
+    Value()
+        : m_bits(QNAN | TAG_NIL)
+    {
+    }
+    Value(NilType)
+        : Value()
+    {
+    }
+    Value(UndefinedType)
+        : m_bits(QNAN | TAG_UNDEFINED)
+    {
+    }
+    Value(double value)
+        : m_bits(std::isnan(value) ? CANONICAL_NAN : std::bit_cast<uint64_t>(value))
+    {
+    }
+    Value(bool value)
+        : m_bits(value ? (QNAN | TAG_TRUE) : (QNAN | TAG_FALSE))
+    {
+    }
+    template<typename T>
+        requires std::is_base_of_v<Object, T>
+    Value(T* object)
+        : m_bits(SIGN_BIT | QNAN | static_cast<uint64_t>(reinterpret_cast<uintptr_t>(static_cast<Object*>(object))))
+    {
+    }
+
+    [[nodiscard]] auto IsNil() const -> bool
+    {
+        return m_bits == (QNAN | TAG_NIL);
+    }
+    [[nodiscard]] auto IsUndefined() const -> bool
+    {
+        return m_bits == (QNAN | TAG_UNDEFINED);
+    }
+    [[nodiscard]] auto IsBool() const -> bool
+    {
+        return (m_bits | 1) == (QNAN | TAG_TRUE);
+    }
+    [[nodiscard]] auto IsDouble() const -> bool
+    {
+        return (m_bits & QNAN) != QNAN;
+    }
+    [[nodiscard]] auto IsObject() const -> bool
+    {
+        return (m_bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT);
+    }
+
+    [[nodiscard]] auto AsBool() const -> bool
+    {
+        LOX_ASSERT(IsBool());
+        return m_bits == (QNAN | TAG_TRUE);
+    }
+    [[nodiscard]] auto AsDouble() const -> double
+    {
+        LOX_ASSERT(IsDouble());
+        return std::bit_cast<double>(m_bits);
+    }
+    [[nodiscard]] auto AsObject() const -> Object const&
+    {
+        return *AsObjectPtr();
+    }
+    [[nodiscard]] auto AsObject() -> Object&
+    {
+        return *AsObjectPtr();
+    }
+    [[nodiscard]] auto AsObjectPtr() -> Object*
+    {
+        LOX_ASSERT(IsObject());
+        return reinterpret_cast<Object*>(static_cast<uintptr_t>(m_bits & ~(SIGN_BIT | QNAN)));
+    }
+    [[nodiscard]] auto AsObjectPtr() const -> Object const*
+    {
+        LOX_ASSERT(IsObject());
+        return reinterpret_cast<Object const*>(static_cast<uintptr_t>(m_bits & ~(SIGN_BIT | QNAN)));
+    }
+
+    [[nodiscard]] auto operator==(Value const& other) const -> bool;
+    [[nodiscard]] auto operator!=(Value const& other) const -> bool;
+
+private:
+    static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+    static constexpr uint64_t QNAN = 0x7ffc000000000000;
+    static constexpr uint64_t CANONICAL_NAN = 0x7ff8000000000000;
+    static constexpr uint64_t TAG_NIL = 1;
+    static constexpr uint64_t TAG_FALSE = 2;
+    static constexpr uint64_t TAG_TRUE = 3;
+    static constexpr uint64_t TAG_UNDEFINED = 4;
+    static_assert(sizeof(uintptr_t) == sizeof(uint64_t), "NaN-boxing assumes 64 bit pointers");
+
+    uint64_t m_bits;
+};
+static_assert(sizeof(Value) == sizeof(uint64_t));
+#else
+// Debugging representation of a Value, a tagged union that is twice the size of the NaN-boxed one.
+struct Value : public std::variant<NilType, double, bool, Object*, UndefinedType> {
     template<typename T>
     Value(T&& value)
-        : std::variant<NilType, double, bool, Object*>(static_cast<variant const>(std::forward<T>(value)))
+        : std::variant<NilType, double, bool, Object*, UndefinedType>(static_cast<variant const>(std::forward<T>(value)))
     {
     }
     Value()
-        : std::variant<NilType, double, bool, Object*>(NilType {})
+        : std::variant<NilType, double, bool, Object*, UndefinedType>(NilType {})
     {
     }
     [[nodiscard]] auto IsNil() const -> bool;
+    [[nodiscard]] auto IsUndefined() const -> bool;
     [[nodiscard]] auto IsBool() const -> bool;
     [[nodiscard]] auto IsDouble() const -> bool;
     [[nodiscard]] auto IsObject() const -> bool;
 
-    [[nodiscard]] auto AsBool() -> bool&;
-    [[nodiscard]] auto AsDouble() -> double&;
-    [[nodiscard]] auto AsDouble() const -> double const&;
+    [[nodiscard]] auto AsBool() const -> bool;
+    [[nodiscard]] auto AsDouble() const -> double;
     [[nodiscard]] auto AsObject() const -> Object const&;
     [[nodiscard]] auto AsObject() -> Object&;
     [[nodiscard]] auto AsObjectPtr() -> Object*;
     [[nodiscard]] auto AsObjectPtr() const -> Object const*;
-    [[nodiscard]] auto AsBool() const -> bool const&;
 
     [[nodiscard]] auto operator==(Value const& other) const -> bool;
     [[nodiscard]] auto operator!=(Value const& other) const -> bool;
 };
+#endif
 #endif // LOX_CPP_VALUE_H
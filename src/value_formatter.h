@@ -39,62 +39,55 @@ struct fmt::formatter<Value> {
     template<typename FormatContext>
     auto format(Value const& value, FormatContext& ctx)
     {
-        switch (value.index()) {
-        case 0:
+        if (value.IsNil()) {
             return fmt::format_to(ctx.out(), "Nil");
-        case 1: {
-            double const* double_pointer = std::get_if<double>(&value);
-            LOX_ASSERT(double_pointer != nullptr);
-            return fmt::format_to(ctx.out(), "{}", *double_pointer);
         }
-        case 2: {
-            bool const* bool_pointer = std::get_if<bool>(&value);
-            LOX_ASSERT(bool_pointer != nullptr);
-            return fmt::format_to(ctx.out(), "{}", *bool_pointer);
+        if (value.IsUndefined()) {
+            return fmt::format_to(ctx.out(), "Undefined");
         }
-        case 3: {
-            auto const object_ptr = value.AsObjectPtr();
-            switch (object_ptr->GetType()) {
-            case ObjectType::FUNCTION: {
-                auto function_object = *static_cast<FunctionObject const*>(object_ptr);
-                return fmt::format_to(ctx.out(), "function<{}, arity={}>", function_object.function_name, function_object.arity);
-            }
-            case ObjectType::STRING: {
-                auto string_object = *static_cast<StringObject const*>(object_ptr);
-                return fmt::format_to(ctx.out(), "{}", string_object.data);
-            }
-            case ObjectType::CLOSURE: {
-                auto closure_object = *static_cast<ClosureObject const*>(object_ptr);
-                return fmt::format_to(ctx.out(), "closure<{}, arity={}>", closure_object.function->function_name, closure_object.function->arity);
-            }
-            case ObjectType::NATIVE_FUNCTION: {
-                return fmt::format_to(ctx.out(), "native_function");
-            }
-            case ObjectType::UPVALUE: {
-                return fmt::format_to(ctx.out(), "upvalue_object");
-            }
-            case ObjectType::CLASS: {
-                auto class_object = *static_cast<ClassObject const*>(object_ptr);
-                return fmt::format_to(ctx.out(), "class_object[{}]", class_object.class_name);
-            }
-            case ObjectType::INSTANCE: {
-                // TODO: Figure out how to print the fields as well
-                auto const& instance = *static_cast<InstanceObject const*>(object_ptr);
-                return fmt::format_to(ctx.out(), "instance[class[{}]]", instance.class_->class_name);
-            }
-            case ObjectType::BOUND_METHOD: {
-                auto const& bound_method = *static_cast<BoundMethodObject const*>(object_ptr);
-                return fmt::format_to(ctx.out(), "bound_method[name={},instance[class={}]]",
-                    bound_method.method->function->function_name,
-                    bound_method.receiver->class_->class_name);
-            }
-            }
-            [[fallthrough]];
+        if (value.IsDouble()) {
+            return fmt::format_to(ctx.out(), "{}", value.AsDouble());
         }
-        default: {
-            LOX_ASSERT(false);
+        if (value.IsBool()) {
+            return fmt::format_to(ctx.out(), "{}", value.AsBool());
         }
+        auto const object_ptr = value.AsObjectPtr();
+        switch (object_ptr->GetType()) {
+        case ObjectType::FUNCTION: {
+            auto const& function_object = *static_cast<FunctionObject const*>(object_ptr);
+            return fmt::format_to(ctx.out(), "function<{}, arity={}>", function_object.function_name, function_object.arity);
         }
+        case ObjectType::STRING: {
+            auto const& string_object = *static_cast<StringObject const*>(object_ptr);
+            return fmt::format_to(ctx.out(), "{}", string_object.data);
+        }
+        case ObjectType::CLOSURE: {
+            auto const& closure_object = *static_cast<ClosureObject const*>(object_ptr);
+            return fmt::format_to(ctx.out(), "closure<{}, arity={}>", closure_object.function->function_name, closure_object.function->arity);
+        }
+        case ObjectType::NATIVE_FUNCTION: {
+            return fmt::format_to(ctx.out(), "native_function");
+        }
+        case ObjectType::UPVALUE: {
+            return fmt::format_to(ctx.out(), "upvalue_object");
+        }
+        case ObjectType::CLASS: {
+            auto const& class_object = *static_cast<ClassObject const*>(object_ptr);
+            return fmt::format_to(ctx.out(), "class_object[{}]", class_object.class_name);
+        }
+        case ObjectType::INSTANCE: {
+            // TODO: Figure out how to print the fields as well
+            auto const& instance = *static_cast<InstanceObject const*>(object_ptr);
+            return fmt::format_to(ctx.out(), "instance[class[{}]]", instance.class_->class_name);
+        }
+        case ObjectType::BOUND_METHOD: {
+            auto const& bound_method = *static_cast<BoundMethodObject const*>(object_ptr);
+            return fmt::format_to(ctx.out(), "bound_method[name={},instance[class={}]]",
+                bound_method.method->function->function_name,
+                bound_method.receiver->class_->class_name);
+        }
+        }
+        LOX_ASSERT(false);
     };
 };
 
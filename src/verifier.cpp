@@ -0,0 +1,305 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "verifier.h"
+
+#include "chunk.h"
+#include "object.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace {
+enum class OperandKind : uint8_t {
+    NONE,
+    CONSTANT,
+    STRING_CONSTANT,
+    LOCAL,
+    UPVALUE,
+    GLOBAL,
+    JUMP_FORWARD,
+    JUMP_BACKWARD,
+    ARGUMENT_COUNT,
+    CLOSURE,
+    PROPERTY, // A string constant followed by a property cache index
+    INVOKE,   // A string constant, the argument count and a property cache index
+};
+
+struct InstructionInfo {
+    OperandKind operand = OperandKind::NONE;
+    int32_t pops = 0;   // Number of values that must be present on the stack(and are removed) when executing the instruction
+    int32_t pushes = 0; // Number of values pushed after the pops
+    bool terminates = false;
+};
+
+consteval auto GenerateInstructionTable() -> std::array<InstructionInfo, NUMBER_OF_OPCODES>
+{
+    std::array<InstructionInfo, NUMBER_OF_OPCODES> table {};
+    // clang-format off
+    table[OP_RETURN]         = { .operand = OperandKind::NONE,            .pops = 1, .pushes = 0, .terminates = true };
+    table[OP_CONSTANT]       = { .operand = OperandKind::CONSTANT,        .pops = 0, .pushes = 1 };
+    table[OP_NEGATE]         = { .operand = OperandKind::NONE,            .pops = 1, .pushes = 1 };
+    table[OP_ADD]            = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_SUBTRACT]       = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_MULTIPLY]       = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_DIVIDE]         = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_NIL]            = { .operand = OperandKind::NONE,            .pops = 0, .pushes = 1 };
+    table[OP_TRUE]           = { .operand = OperandKind::NONE,            .pops = 0, .pushes = 1 };
+    table[OP_FALSE]          = { .operand = OperandKind::NONE,            .pops = 0, .pushes = 1 };
+    table[OP_NOT]            = { .operand = OperandKind::NONE,            .pops = 1, .pushes = 1 };
+    table[OP_EQUAL]          = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_GREATER]        = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_LESS]           = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_LESS_EQUAL]     = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_GREATER_EQUAL]  = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_NOT_EQUAL]      = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_PRINT]          = { .operand = OperandKind::NONE,            .pops = 1, .pushes = 0 };
+    table[OP_POP]            = { .operand = OperandKind::NONE,            .pops = 1, .pushes = 0 };
+    table[OP_DEFINE_GLOBAL]  = { .operand = OperandKind::GLOBAL,          .pops = 1, .pushes = 0 };
+    table[OP_GET_GLOBAL]     = { .operand = OperandKind::GLOBAL,          .pops = 0, .pushes = 1 };
+    table[OP_SET_GLOBAL]     = { .operand = OperandKind::GLOBAL,          .pops = 1, .pushes = 1 };
+    table[OP_GET_LOCAL]      = { .operand = OperandKind::LOCAL,           .pops = 0, .pushes = 1 };
+    table[OP_SET_LOCAL]      = { .operand = OperandKind::LOCAL,           .pops = 1, .pushes = 1 };
+    table[OP_GET_UPVALUE]    = { .operand = OperandKind::UPVALUE,         .pops = 0, .pushes = 1 };
+    table[OP_SET_UPVALUE]    = { .operand = OperandKind::UPVALUE,         .pops = 1, .pushes = 1 };
+    table[OP_JUMP_IF_FALSE]  = { .operand = OperandKind::JUMP_FORWARD,    .pops = 1, .pushes = 1 };
+    table[OP_JUMP]           = { .operand = OperandKind::JUMP_FORWARD,    .pops = 0, .pushes = 0, .terminates = true };
+    table[OP_LOOP]           = { .operand = OperandKind::JUMP_BACKWARD,   .pops = 0, .pushes = 0, .terminates = true };
+    table[OP_CALL]           = { .operand = OperandKind::ARGUMENT_COUNT,  .pops = 1, .pushes = 1 };
+    table[OP_CLOSURE]        = { .operand = OperandKind::CLOSURE,         .pops = 0, .pushes = 1 };
+    table[OP_CLOSE_UPVALUE]  = { .operand = OperandKind::NONE,            .pops = 1, .pushes = 0 };
+    table[OP_CLASS]          = { .operand = OperandKind::STRING_CONSTANT, .pops = 0, .pushes = 1 };
+    table[OP_GET_PROPERTY]   = { .operand = OperandKind::PROPERTY,        .pops = 1, .pushes = 1 };
+    table[OP_SET_PROPERTY]   = { .operand = OperandKind::PROPERTY,        .pops = 2, .pushes = 1 };
+    table[OP_METHOD]         = { .operand = OperandKind::STRING_CONSTANT, .pops = 2, .pushes = 1 };
+    table[OP_INVOKE]         = { .operand = OperandKind::INVOKE,          .pops = 1, .pushes = 1 };
+    table[OP_ADD_NUM]           = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_SUBTRACT_NUM]      = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_MULTIPLY_NUM]      = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_DIVIDE_NUM]        = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_LESS_NUM]          = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_LESS_EQUAL_NUM]    = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_GREATER_NUM]       = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    table[OP_GREATER_EQUAL_NUM] = { .operand = OperandKind::NONE,            .pops = 2, .pushes = 1 };
+    // clang-format on
+    return table;
+}
+
+constexpr auto INSTRUCTION_TABLE = GenerateInstructionTable();
+
+auto ReadIndex(std::vector<uint8_t> const& byte_code, uint64_t offset) -> uint16_t
+{
+    return static_cast<uint16_t>(byte_code[offset] | (byte_code[offset + 1] << 8));
+}
+
+auto IsObjectOfType(Value const& value, ObjectType type) -> bool
+{
+    return value.IsObject() && value.AsObject().GetType() == type;
+}
+}
+
+auto VerifyFunction(FunctionObject& function, bool has_callee_slot, size_t number_of_globals) -> CompilationErrorOr<VoidType>
+{
+    auto const& chunk = function.chunk;
+    auto const& byte_code = chunk.byte_code;
+    auto const fail = [&function](uint64_t offset, std::string_view reason) {
+        return std::unexpected(CompilationError { fmt::format("Bytecode verification failed in {} at offset {:#06x}: {}", function.function_name, offset, reason) });
+    };
+
+    // Pass 1: Decode the chunk linearly to find the instruction boundaries and check the operands that do not depend
+    // on the state of the stack.
+    std::vector<bool> is_instruction_start(byte_code.size(), false);
+    uint64_t offset = 0;
+    while (offset < byte_code.size()) {
+        is_instruction_start[offset] = true;
+        if (byte_code[offset] >= NUMBER_OF_OPCODES) {
+            return fail(offset, "Unknown opcode");
+        }
+        auto const& info = INSTRUCTION_TABLE[byte_code[offset]];
+        if (info.operand == OperandKind::NONE) {
+            offset += 1;
+            continue;
+        }
+        if (offset + 3 > byte_code.size()) {
+            return fail(offset, "Truncated operand");
+        }
+        auto const operand = ReadIndex(byte_code, offset + 1);
+        auto length = uint64_t { 3 };
+        switch (info.operand) {
+        case OperandKind::CONSTANT:
+            if (operand >= chunk.constant_pool.size()) {
+                return fail(offset, "Constant index out of range");
+            }
+            break;
+        case OperandKind::STRING_CONSTANT:
+            if (operand >= chunk.constant_pool.size() || !IsObjectOfType(chunk.constant_pool[operand], ObjectType::STRING)) {
+                return fail(offset, "Expected a string constant");
+            }
+            break;
+        case OperandKind::PROPERTY:
+        case OperandKind::INVOKE: {
+            if (operand >= chunk.constant_pool.size() || !IsObjectOfType(chunk.constant_pool[operand], ObjectType::STRING)) {
+                return fail(offset, "Expected a string constant");
+            }
+            length += (info.operand == OperandKind::INVOKE) ? 4 : 2;
+            if (offset + length > byte_code.size()) {
+                return fail(offset, "Truncated operand");
+            }
+            if (ReadIndex(byte_code, offset + length - 2) >= chunk.property_caches.size()) {
+                return fail(offset, "Property cache index out of range");
+            }
+            break;
+        }
+        case OperandKind::UPVALUE:
+            if (operand >= function.upvalue_count) {
+                return fail(offset, "Upvalue index out of range");
+            }
+            break;
+        case OperandKind::GLOBAL:
+            if (operand >= number_of_globals) {
+                return fail(offset, "Global slot out of range");
+            }
+            break;
+        case OperandKind::CLOSURE: {
+            if (operand >= chunk.constant_pool.size() || !IsObjectOfType(chunk.constant_pool[operand], ObjectType::FUNCTION)) {
+                return fail(offset, "Expected a function constant");
+            }
+            auto const* closed_function = static_cast<FunctionObject const*>(chunk.constant_pool[operand].AsObjectPtr());
+            if (!closed_function->verified) {
+                return fail(offset, "Closure over an unverified function");
+            }
+            length += 3U * closed_function->upvalue_count;
+            if (offset + length > byte_code.size()) {
+                return fail(offset, "Truncated upvalue operands");
+            }
+            for (uint64_t upvalue_offset = offset + 3; upvalue_offset < offset + length; upvalue_offset += 3) {
+                auto const is_local = byte_code[upvalue_offset];
+                if (is_local > 1) {
+                    return fail(upvalue_offset, "Malformed upvalue descriptor");
+                }
+                if (!is_local && ReadIndex(byte_code, upvalue_offset + 1) >= function.upvalue_count) {
+                    return fail(upvalue_offset, "Captured upvalue index out of range");
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        offset += length;
+    }
+
+    // Pass 2: Walk every path through the chunk tracking the stack depth relative to the frame's first slot.
+    static constexpr auto UNVISITED = int32_t { -1 };
+    std::vector<int32_t> depth_at(byte_code.size(), UNVISITED);
+    std::vector<uint64_t> worklist;
+    auto max_depth = static_cast<int32_t>(function.arity);
+
+    auto const isValidLocal = [has_callee_slot](uint16_t local_index, int32_t depth) {
+        // Local "i" lives at slot + i - 1, local zero is the callee(or the receiver for methods)
+        return (local_index == 0) ? has_callee_slot : local_index <= depth;
+    };
+    auto const enqueue = [&](uint64_t from, uint64_t target, int32_t depth) -> CompilationErrorOr<VoidType> {
+        if (target >= byte_code.size()) {
+            return fail(from, "Execution runs past the end of the chunk");
+        }
+        if (!is_instruction_start[target]) {
+            return fail(from, "Jump into the middle of an instruction");
+        }
+        if (depth_at[target] == UNVISITED) {
+            depth_at[target] = depth;
+            worklist.push_back(target);
+        } else if (depth_at[target] != depth) {
+            return fail(target, fmt::format("Inconsistent stack depth, {} vs {}", depth_at[target], depth));
+        }
+        return VoidType {};
+    };
+
+    if (byte_code.empty()) {
+        return fail(0, "Empty chunk");
+    }
+    if (auto result = enqueue(0, 0, static_cast<int32_t>(function.arity)); !result) {
+        return result;
+    }
+    while (!worklist.empty()) {
+        auto const current = worklist.back();
+        worklist.pop_back();
+        auto const opcode = static_cast<OpCode>(byte_code[current]);
+        auto const& info = INSTRUCTION_TABLE[opcode];
+        auto depth = depth_at[current];
+        auto const operand = (info.operand == OperandKind::NONE) ? uint16_t { 0 } : ReadIndex(byte_code, current + 1);
+
+        auto pops = info.pops;
+        if (info.operand == OperandKind::ARGUMENT_COUNT) {
+            pops += operand; // The callee and its arguments
+        } else if (info.operand == OperandKind::INVOKE) {
+            pops += ReadIndex(byte_code, current + 3); // The receiver and the arguments
+        }
+        if (depth < pops) {
+            return fail(current, "Stack underflow");
+        }
+        if (info.operand == OperandKind::LOCAL && !isValidLocal(operand, depth)) {
+            return fail(current, "Local slot out of range");
+        }
+        auto next = current + ((info.operand == OperandKind::NONE) ? 1 : 3);
+        if (info.operand == OperandKind::PROPERTY) {
+            next += 2;
+        } else if (info.operand == OperandKind::INVOKE) {
+            next += 4;
+        }
+        if (opcode == OP_CLOSURE) {
+            auto const* closed_function = static_cast<FunctionObject const*>(chunk.constant_pool[operand].AsObjectPtr());
+            for (auto i = 0; i < closed_function->upvalue_count; ++i, next += 3) {
+                if (byte_code[next] == 1 && !isValidLocal(ReadIndex(byte_code, next + 1), depth)) {
+                    return fail(next, "Captured local slot out of range");
+                }
+            }
+        }
+        depth = depth - pops + info.pushes;
+        max_depth = std::max(max_depth, depth);
+
+        if (info.operand == OperandKind::JUMP_FORWARD) {
+            if (auto result = enqueue(current, next + operand, depth); !result) {
+                return result;
+            }
+        } else if (info.operand == OperandKind::JUMP_BACKWARD) {
+            if (operand > next) {
+                return fail(current, "Loop target before the start of the chunk");
+            }
+            if (auto result = enqueue(current, next - operand, depth); !result) {
+                return result;
+            }
+        }
+        if (!info.terminates) {
+            if (auto result = enqueue(current, next, depth); !result) {
+                return result;
+            }
+        }
+    }
+
+    function.max_stack_depth = static_cast<uint32_t>(max_depth);
+    function.verified = true;
+    return VoidType {};
+}
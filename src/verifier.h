@@ -0,0 +1,39 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOX_CPP_VERIFIER_H
+#define LOX_CPP_VERIFIER_H
+
+#include <cstddef>
+
+#include "error.h"
+#include "object.h"
+
+// Proves that every reachable instruction of the function's chunk decodes to a known opcode, that jump targets land on
+// instruction boundaries, that constant/local/upvalue operands are in range and that the stack never underflows and
+// has the same depth on every path reaching an instruction. On success the maximum stack depth is recorded on the
+// function and the function is marked as verified, which lets the VM execute it without bounds checks.
+// "has_callee_slot" is false for the top-level script, which does not have the callee(or receiver) below its first
+// local slot. Global slots must be below "number_of_globals", the global table never shrinks so they stay valid.
+[[nodiscard]] auto VerifyFunction(FunctionObject& function, bool has_callee_slot, size_t number_of_globals) -> CompilationErrorOr<VoidType>;
+
+#endif // LOX_CPP_VERIFIER_H
@@ -21,21 +21,52 @@
 // SOFTWARE.
 
 #include <__expected/unexpected.h>
+#include <array>
 #include <cstdio>
 #include <cstdlib>
 #include <fmt/core.h>
 #include <iterator>
 #include <memory>
+#include <optional>
 #include <ranges>
+#include <utility>
 
 #include "error.h"
 #include "heap.h"
+#include "heap_snapshot.h"
 #include "native_function.h"
 #include "object.h"
 #include "value.h"
 #include "value_formatter.h"
 #include "virtual_machine.h"
 
+#if defined(THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+// Labels-as-values is a GNU extension, every other compiler falls back to the switch based dispatch loop
+#    define LOX_COMPUTED_GOTO 1
+#endif
+
+namespace {
+// Accumulates the number of dispatched instructions in a local that is flushed to the VM whenever the frame's state is
+// stored(before calls, which includes native functions reading the metrics) and when the interpreter loop exits
+struct InstructionCounter {
+    explicit InstructionCounter(uint64_t& total)
+        : total(total)
+    {
+    }
+    ~InstructionCounter()
+    {
+        Flush();
+    }
+    auto Flush() -> void
+    {
+        total += count;
+        count = 0;
+    }
+    uint64_t& total;
+    uint64_t count = 0;
+};
+}
+
 static auto IsFalsy(Value const& value) -> bool
 {
     return value.IsNil() || (value.IsBool() && !value.AsBool());
@@ -43,8 +74,21 @@ static auto IsFalsy(Value const& value) -> bool
 
 auto VirtualMachine::registerNativeFunctions() -> void
 {
-    this->m_globals["SystemTimeNow"] = m_heap->AllocateNativeFunctionObject(SystemTimeNow);
-    this->m_globals["Echo"] = m_heap->AllocateNativeFunctionObject(Echo);
+    static constexpr auto NATIVE_FUNCTIONS = std::array {
+        std::pair<std::string_view, NativeFunction> { "SystemTimeNow", SystemTimeNow },
+        std::pair<std::string_view, NativeFunction> { "Echo", Echo },
+        std::pair<std::string_view, NativeFunction> { "Metric", Metric },
+        std::pair<std::string_view, NativeFunction> { "HeapSnapshot", DumpHeapSnapshot },
+    };
+    // Native function objects are immortal, the first run allocates them and every run defines them again
+    for (size_t i = 0; i < NATIVE_FUNCTIONS.size(); ++i) {
+        auto const [name, function] = NATIVE_FUNCTIONS[i];
+        if (m_native_functions.size() == i) {
+            m_native_functions.push_back(m_heap->AllocateNativeFunctionObject(function));
+        }
+        auto const slot = m_globals.Resolve(m_heap->AllocateStringObject(name));
+        m_globals.Values()[slot] = m_native_functions[i];
+    }
 }
 
 auto VirtualMachine::Interpret(Source const& source) -> ErrorOr<VoidType>
@@ -54,135 +98,325 @@ auto VirtualMachine::Interpret(Source const& source) -> ErrorOr<VoidType>
         return std::unexpected(compiled_function_result.error());
     }
     auto new_closure = m_heap->AllocateClosureObject(compiled_function_result.value());
+    // Start from a clean slate, a previous run may have left its top-level frame(or a failed call chain) behind. Closures
+    // that outlive a failed run keep the values they captured, their upvalues are closed before the stack goes away.
+    closeUpvalues(0);
+    m_frames.clear();
+    m_value_stack.clear();
+    if (!hasStackSpaceFor(*new_closure->function, 0)) {
+        return std::unexpected(runtimeError("Stack overflow"));
+    }
     m_frames.emplace_back(new_closure, 0, 0);
+    ++m_frames_pushed;
     registerNativeFunctions();
     return this->run();
 }
 auto VirtualMachine::run() -> RuntimeErrorOr<VoidType>
 {
-    while (true) {
-        if (isAtEnd()) {
-            LOX_ASSERT(m_value_stack.empty()); // Remove me once we add statements that produce side - effects
-            return VoidType {};
+    InstructionCounter instruction_counter { m_instructions_executed };
+
+    // The state of the executing call frame lives in locals for the duration of the loop. It is written back to the
+    // CallFrame only when switching frames, before anything that can trigger a garbage collection and on errors.
+    CallFrame* frame = nullptr;
+    uint8_t* ip = nullptr;
+    Value const* constants = nullptr;
+    PropertyCache* property_caches = nullptr;
+    Value* slots = nullptr;
+    Value* const globals = m_globals.Values(); // No new globals can be resolved while running
+
+    auto const loadFrame = [&]() {
+        frame = &m_frames.back();
+        auto& chunk = frame->closure->function->chunk;
+        ip = chunk.byte_code.data() + frame->instruction_pointer;
+        constants = chunk.constant_pool.data();
+        property_caches = chunk.property_caches.data();
+        slots = m_value_stack.data() + frame->slot;
+    };
+    auto const storeFrame = [&]() {
+        frame->instruction_pointer = static_cast<uint64_t>(ip - frame->closure->function->chunk.byte_code.data());
+        instruction_counter.Flush();
+    };
+    auto const readByte = [&]() -> uint8_t {
+        return *ip++;
+    };
+    auto const readIndex = [&]() -> uint16_t {
+        auto const index = static_cast<uint16_t>(ip[0] | (ip[1] << 8));
+        ip += 2;
+        return index;
+    };
+    auto const readConstant = [&]() -> Value const& {
+        return constants[readIndex()];
+    };
+    auto const error = [&](std::string error_message) {
+        storeFrame();
+        return std::unexpected(runtimeError(std::move(error_message)));
+    };
+    // Quickening: rewrites the instruction that was just read to its number-only variant when both operands are
+    // numbers. A function whose instructions keep flipping between the two forms stops being quickened.
+    auto const quickenIfNumbers = [&](OpCode specialized_op) {
+        auto& stats = frame->closure->function->quickening;
+        if (peekStack(0).IsDouble() && peekStack(1).IsDouble() && stats.despecialized < MAX_DESPECIALIZATIONS_PER_FUNCTION) {
+            ip[-1] = specialized_op;
+            ++stats.specialized;
         }
+    };
+    auto const despecialize = [&](OpCode generic_op) {
+        ip[-1] = generic_op;
+        ++frame->closure->function->quickening.despecialized;
+    };
+    // Resolves a property read to a field slot or a method through the instruction's inline cache, empty if the
+    // instance has neither
+    auto const resolveProperty = [this](InstanceObject* instance, StringObject const* name, PropertyCache& cache) -> std::optional<PropertyCacheEntry> {
+        auto const shape_id = instance->shape->Id();
+        if (auto const* entry = cache.Find(shape_id); entry != nullptr) {
+            ++m_property_cache_stats.hits;
+            return *entry;
+        }
+        ++m_property_cache_stats.misses;
+        m_property_cache_stats.megamorphic_misses += cache.megamorphic ? 1 : 0;
+        auto entry = PropertyCacheEntry {};
+        if (auto index = instance->shape->Lookup(name); index.has_value()) {
+            entry = PropertyCacheEntry::Field(shape_id, *index);
+        } else if (auto method = instance->class_->methods.find(name); method != instance->class_->methods.end()) {
+            entry = PropertyCacheEntry::Method(shape_id, method->second);
+        } else {
+            return {};
+        }
+        cache.Insert(entry);
+        return entry;
+    };
+
+#ifdef LOX_COMPUTED_GOTO
+    // One label per opcode, indexed by the opcode value. Every handler ends by jumping straight to the handler of the
+    // next instruction, which gives each opcode its own indirect branch for the predictor to learn.
+    static void* const DISPATCH_TABLE[] = {
+        &&LABEL_OP_RETURN,
+        &&LABEL_OP_CONSTANT,
+        &&LABEL_OP_NEGATE,
+        &&LABEL_OP_ADD,
+        &&LABEL_OP_SUBTRACT,
+        &&LABEL_OP_MULTIPLY,
+        &&LABEL_OP_DIVIDE,
+        &&LABEL_OP_NIL,
+        &&LABEL_OP_TRUE,
+        &&LABEL_OP_FALSE,
+        &&LABEL_OP_NOT,
+        &&LABEL_OP_EQUAL,
+        &&LABEL_OP_GREATER,
+        &&LABEL_OP_LESS,
+        &&LABEL_OP_LESS_EQUAL,
+        &&LABEL_OP_GREATER_EQUAL,
+        &&LABEL_OP_NOT_EQUAL,
+        &&LABEL_OP_PRINT,
+        &&LABEL_OP_POP,
+        &&LABEL_OP_DEFINE_GLOBAL,
+        &&LABEL_OP_GET_GLOBAL,
+        &&LABEL_OP_SET_GLOBAL,
+        &&LABEL_OP_GET_LOCAL,
+        &&LABEL_OP_SET_LOCAL,
+        &&LABEL_OP_GET_UPVALUE,
+        &&LABEL_OP_SET_UPVALUE,
+        &&LABEL_OP_JUMP_IF_FALSE,
+        &&LABEL_OP_JUMP,
+        &&LABEL_OP_LOOP,
+        &&LABEL_OP_CALL,
+        &&LABEL_OP_CLOSURE,
+        &&LABEL_OP_CLOSE_UPVALUE,
+        &&LABEL_OP_CLASS,
+        &&LABEL_OP_GET_PROPERTY,
+        &&LABEL_OP_SET_PROPERTY,
+        &&LABEL_OP_METHOD,
+        &&LABEL_OP_INVOKE,
+        &&LABEL_OP_ADD_NUM,
+        &&LABEL_OP_SUBTRACT_NUM,
+        &&LABEL_OP_MULTIPLY_NUM,
+        &&LABEL_OP_DIVIDE_NUM,
+        &&LABEL_OP_LESS_NUM,
+        &&LABEL_OP_LESS_EQUAL_NUM,
+        &&LABEL_OP_GREATER_NUM,
+        &&LABEL_OP_GREATER_EQUAL_NUM,
+    };
+    static_assert(std::size(DISPATCH_TABLE) == NUMBER_OF_OPCODES, "Every opcode needs an entry in the dispatch table");
+#    define VM_CASE(op) \
+        case op:        \
+        LABEL_##op
+#    define VM_DISPATCH()                     \
+        do {                                  \
+            VM_TRACE_INSTRUCTION();           \
+            ++instruction_counter.count;      \
+            goto* DISPATCH_TABLE[readByte()]; \
+        } while (0)
+#else
+#    define VM_CASE(op) case op
+#    define VM_DISPATCH() continue
+#endif
+
 #ifdef DEBUG_TRACE_EXECUTION
-        Disassemble_instruction(currentChunk(), m_frames.rbegin()->instruction_pointer);
+#    define VM_TRACE_INSTRUCTION() \
+        Disassemble_instruction(frame->closure->function->chunk, static_cast<uint64_t>(ip - frame->closure->function->chunk.byte_code.data()))
+#else
+#    define VM_TRACE_INSTRUCTION() \
+        do {                       \
+        } while (0)
 #endif
 
-        auto const instruction = static_cast<OpCode>(readByte());
-        switch (instruction) {
-        case OP_RETURN: {
+    // Number-only variant of a binary instruction. The guard is the only branch on the fast path, an operand of any other
+    // type reverts the instruction to its generic form, which then handles the operation(and reports any error).
+#define VM_NUMBER_BINARY_OP(op, generic_op, operator_token)                                            \
+    VM_CASE(op):                                                                                       \
+    {                                                                                                  \
+        auto& lhs = m_value_stack[m_value_stack.size() - 2];                                           \
+        auto const rhs = m_value_stack.back();                                                         \
+        if (!(lhs.IsDouble() & rhs.IsDouble())) [[unlikely]] {                                         \
+            despecialize(generic_op);                                                                  \
+            storeFrame();                                                                              \
+            if (auto result = binaryOperation(generic_op); !result) {                                  \
+                return error(std::move(result.error().error_message));                                 \
+            }                                                                                          \
+            VM_DISPATCH();                                                                             \
+        }                                                                                              \
+        lhs = Value { lhs.AsDouble() operator_token rhs.AsDouble() };                                  \
+        m_value_stack.pop_back();                                                                      \
+        VM_DISPATCH();                                                                                 \
+    }
+
+    loadFrame();
+#ifdef LOX_COMPUTED_GOTO
+    VM_DISPATCH();
+#endif
+    while (true) {
+        VM_TRACE_INSTRUCTION();
+        ++instruction_counter.count;
+        switch (static_cast<OpCode>(readByte())) {
+        VM_CASE(OP_RETURN): {
             if (m_frames.size() == 1) {
+                storeFrame();
                 return VoidType {};
             }
-            auto return_value = popStack();
-
-            // Discarding the call frame
-            auto num_to_pop = static_cast<int32_t>(m_frames.back().closure->function->arity + 1);
-            while (num_to_pop > 0) {
-                auto _ = popStack();
-                static_cast<void>(_);
-                --num_to_pop;
-            }
+            auto const return_value = popStack();
+
+            // Discard the callee/receiver, the arguments and any locals still on the stack, closing the upvalues that
+            // captured them first.
+            auto const frame_base = frame->slot - 1;
+            LOX_ASSERT(frame_base <= MAX_INDEX_SIZE);
+            closeUpvalues(static_cast<uint16_t>(frame_base));
+            m_value_stack.resize(frame_base);
 
             m_frames.pop_back(); // Reset the call frame
-            m_value_stack.push_back(return_value);
-            break;
+            pushStack(return_value);
+            loadFrame();
+            VM_DISPATCH();
         }
-        case OP_CONSTANT: {
-            m_value_stack.push_back(readConstant());
-            break;
+        VM_CASE(OP_CONSTANT): {
+            pushStack(readConstant());
+            VM_DISPATCH();
         }
-        case OP_NEGATE: {
+        VM_CASE(OP_NEGATE): {
             Value value = popStack();
             if (!value.IsDouble()) {
-                return std::unexpected(runtimeError(fmt::format("Cannot negate non-number type, line number:{}", currentChunk().lines[m_frames.rbegin()->instruction_pointer])));
+                return error("Cannot negate non-number type");
             }
-            m_value_stack.emplace_back(-value.AsDouble());
-            break;
+            pushStack(-value.AsDouble());
+            VM_DISPATCH();
         }
-        case OP_ADD: {
+        VM_CASE(OP_ADD): {
+            quickenIfNumbers(OP_ADD_NUM);
+            storeFrame(); // String concatenation allocates
             auto result = binaryOperation(OP_ADD);
             if (!result) {
-                return std::unexpected(result.error());
+                return error(std::move(result.error().error_message));
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_SUBTRACT: {
+        VM_CASE(OP_SUBTRACT): {
+            quickenIfNumbers(OP_SUBTRACT_NUM);
             auto result = binaryOperation(OP_SUBTRACT);
             if (!result) {
-                return std::unexpected(result.error());
+                return error(std::move(result.error().error_message));
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_MULTIPLY: {
+        VM_CASE(OP_MULTIPLY): {
+            quickenIfNumbers(OP_MULTIPLY_NUM);
             auto result = binaryOperation(OP_MULTIPLY);
             if (!result) {
-                return std::unexpected(result.error());
+                return error(std::move(result.error().error_message));
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_DIVIDE: {
+        VM_CASE(OP_DIVIDE): {
+            quickenIfNumbers(OP_DIVIDE_NUM);
             auto result = binaryOperation(OP_DIVIDE);
             if (!result) {
-                return std::unexpected(result.error());
+                return error(std::move(result.error().error_message));
             }
-            break;
-        }
-        case OP_NIL:
-            m_value_stack.emplace_back(NilType {});
-            break;
-        case OP_TRUE:
-            m_value_stack.emplace_back(true);
-            break;
-        case OP_FALSE:
-            m_value_stack.emplace_back(false);
-            break;
-        case OP_NOT:
-            m_value_stack.emplace_back(IsFalsy(popStack()));
-            break;
-        case OP_EQUAL: {
+            VM_DISPATCH();
+        }
+        VM_NUMBER_BINARY_OP(OP_ADD_NUM, OP_ADD, +);
+        VM_NUMBER_BINARY_OP(OP_SUBTRACT_NUM, OP_SUBTRACT, -);
+        VM_NUMBER_BINARY_OP(OP_MULTIPLY_NUM, OP_MULTIPLY, *);
+        VM_NUMBER_BINARY_OP(OP_DIVIDE_NUM, OP_DIVIDE, /);
+        VM_NUMBER_BINARY_OP(OP_LESS_NUM, OP_LESS, <);
+        VM_NUMBER_BINARY_OP(OP_LESS_EQUAL_NUM, OP_LESS_EQUAL, <=);
+        VM_NUMBER_BINARY_OP(OP_GREATER_NUM, OP_GREATER, >);
+        VM_NUMBER_BINARY_OP(OP_GREATER_EQUAL_NUM, OP_GREATER_EQUAL, >=);
+        VM_CASE(OP_NIL):
+            pushStack(NilType {});
+            VM_DISPATCH();
+        VM_CASE(OP_TRUE):
+            pushStack(true);
+            VM_DISPATCH();
+        VM_CASE(OP_FALSE):
+            pushStack(false);
+            VM_DISPATCH();
+        VM_CASE(OP_NOT):
+            pushStack(IsFalsy(popStack()));
+            VM_DISPATCH();
+        VM_CASE(OP_EQUAL): {
             Value rhs = popStack();
             Value lhs = popStack();
-            m_value_stack.emplace_back(rhs == lhs);
-            break;
+            pushStack(rhs == lhs);
+            VM_DISPATCH();
         }
-        case OP_NOT_EQUAL: {
+        VM_CASE(OP_NOT_EQUAL): {
             Value rhs = popStack();
             Value lhs = popStack();
-            m_value_stack.emplace_back(rhs != lhs);
-            break;
+            pushStack(rhs != lhs);
+            VM_DISPATCH();
         }
-        case OP_GREATER: {
+        VM_CASE(OP_GREATER): {
+            quickenIfNumbers(OP_GREATER_NUM);
             auto result = binaryOperation(OP_GREATER);
             if (!result) {
-                return std::unexpected(result.error());
+                return error(std::move(result.error().error_message));
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_LESS: {
+        VM_CASE(OP_LESS): {
+            quickenIfNumbers(OP_LESS_NUM);
             auto result = binaryOperation(OP_LESS);
             if (!result) {
-                return std::unexpected(result.error());
+                return error(std::move(result.error().error_message));
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_LESS_EQUAL: {
+        VM_CASE(OP_LESS_EQUAL): {
+            quickenIfNumbers(OP_LESS_EQUAL_NUM);
             auto result = binaryOperation(OP_LESS_EQUAL);
             if (!result) {
-                return std::unexpected(result.error());
+                return error(std::move(result.error().error_message));
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_GREATER_EQUAL: {
+        VM_CASE(OP_GREATER_EQUAL): {
+            quickenIfNumbers(OP_GREATER_EQUAL_NUM);
             auto result = binaryOperation(OP_GREATER_EQUAL);
             if (!result) {
-                return std::unexpected(result.error());
+                return error(std::move(result.error().error_message));
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_PRINT: {
-            LOX_ASSERT(!m_value_stack.empty());
+        VM_CASE(OP_PRINT): {
             auto value = popStack();
             if (m_external_stream) {
                 fmt::format_to(std::back_inserter(*m_external_stream), "{}\n", value);
@@ -190,209 +424,277 @@ auto VirtualMachine::run() -> RuntimeErrorOr<VoidType>
                 fmt::print("{}\n", value);
                 fflush(stdout); // Force flush
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_POP: {
+        VM_CASE(OP_POP): {
             auto _ = popStack();
             static_cast<void>(_);
-            break;
+            VM_DISPATCH();
         }
-        case OP_DEFINE_GLOBAL: {
-            // Need to get the variable name from the constant pool
-            auto identifier_name_value = currentChunk().constant_pool.at(readIndex());
-            LOX_ASSERT(identifier_name_value.IsObject() && identifier_name_value.AsObjectPtr()->GetType() == ObjectType::STRING);
-            auto string_object = static_cast<StringObject*>(identifier_name_value.AsObjectPtr());
-            m_globals[string_object->data] = popStack();
-            break;
+        VM_CASE(OP_DEFINE_GLOBAL): {
+            globals[readIndex()] = popStack();
+            VM_DISPATCH();
         }
-        case OP_GET_GLOBAL: {
-            auto identifier_name_value = currentChunk().constant_pool.at(readIndex());
-            LOX_ASSERT(identifier_name_value.IsObject() && identifier_name_value.AsObjectPtr()->GetType() == ObjectType::STRING);
-            auto identifier_string_object = static_cast<StringObject*>(identifier_name_value.AsObjectPtr());
-            if (m_globals.count(identifier_string_object->data) == 0) {
-                return std::unexpected(runtimeError(fmt::format("Undefined variable:{}", identifier_string_object->data)));
+        VM_CASE(OP_GET_GLOBAL): {
+            auto const slot = readIndex();
+            if (globals[slot].IsUndefined()) [[unlikely]] {
+                return error(fmt::format("Undefined variable:{}", m_globals.Name(slot)->data));
             }
-            m_value_stack.push_back(m_globals.at(identifier_string_object->data));
-            break;
+            pushStack(globals[slot]);
+            VM_DISPATCH();
         }
-        case OP_SET_GLOBAL: {
-            auto identifier_name_value = currentChunk().constant_pool.at(readIndex());
-            LOX_ASSERT(identifier_name_value.IsObject() && identifier_name_value.AsObjectPtr()->GetType() == ObjectType::STRING);
-            auto identifier_string_object = static_cast<StringObject*>(identifier_name_value.AsObjectPtr());
-            if (m_globals.count(identifier_string_object->data) == 0) {
-                return std::unexpected(runtimeError(fmt::format("Undefined variable:{}", identifier_string_object->data)));
+        VM_CASE(OP_SET_GLOBAL): {
+            auto const slot = readIndex();
+            if (globals[slot].IsUndefined()) [[unlikely]] {
+                return error(fmt::format("Undefined variable:{}", m_globals.Name(slot)->data));
             }
-            m_globals[identifier_string_object->data] = peekStack(0); // Over-write existing value
-            break;
+            globals[slot] = peekStack(0); // Over-write existing value
+            VM_DISPATCH();
         }
-        case OP_GET_LOCAL: {
-            auto const slotIndex = m_frames.rbegin()->slot + readIndex() - 1;
-            m_value_stack.push_back(m_value_stack.at(slotIndex));
-            break;
+        VM_CASE(OP_GET_LOCAL): {
+            pushStack(slots[readIndex() - 1]);
+            VM_DISPATCH();
         }
-        case OP_SET_LOCAL: {
-            auto const slotIndex = m_frames.rbegin()->slot + readIndex() - 1;
-            m_value_stack.at(slotIndex) = peekStack(0);
-            break;
+        VM_CASE(OP_SET_LOCAL): {
+            slots[readIndex() - 1] = peekStack(0);
+            VM_DISPATCH();
         }
-        case OP_JUMP_IF_FALSE: {
-            auto condition_value = peekStack(0); // Not popping it off yet
-            auto offset = readIndex();
-            if (IsFalsy(condition_value)) {
-                m_frames.rbegin()->instruction_pointer += offset;
+        VM_CASE(OP_JUMP_IF_FALSE): {
+            auto const offset = readIndex();
+            if (IsFalsy(peekStack(0))) { // Not popping it off yet
+                ip += offset;
             }
-            break;
-        }
-        case OP_JUMP: {
-            m_frames.rbegin()->instruction_pointer += readIndex();
-            break;
-        }
-        case OP_LOOP: {
-            m_frames.rbegin()->instruction_pointer -= readIndex();
-            break;
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_JUMP): {
+            auto const offset = readIndex();
+            ip += offset;
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_LOOP): {
+            auto const offset = readIndex();
+            ip -= offset;
+            // Compactions and requested heap snapshots run on loop back-edges, where the frame's state is all the
+            // interpreter holds and that only points into buffers that stay put when their objects move
+            if (m_heap->CompactionDue() || m_heap_snapshot_requested.load(std::memory_order_relaxed)) [[unlikely]] {
+                storeFrame();
+                runLoopSafepoint();
+            }
+            VM_DISPATCH();
         }
-        case OP_CALL: {
+        VM_CASE(OP_CALL): {
             auto const num_arguments = readIndex();
             auto callable_object = peekStack(num_arguments);
+            storeFrame();
             auto function_dispatch_status = call(callable_object, num_arguments);
             if (!function_dispatch_status) {
-                return std::unexpected(runtimeError(function_dispatch_status.error().error_message));
+                return error(std::move(function_dispatch_status.error().error_message));
             }
-            break;
+            loadFrame(); // Either a new frame was pushed or the value stack changed underneath the current one
+            // Requested heap snapshots are also written on calls, a program without loops would otherwise never get one.
+            // Taking a snapshot does not move objects, it needs no more than the stored frame.
+            if (m_heap_snapshot_requested.load(std::memory_order_relaxed)) [[unlikely]] {
+                writeRequestedHeapSnapshot();
+            }
+            VM_DISPATCH();
         }
-        case OP_CLOSURE: {
-            auto value = readConstant();
-            LOX_ASSERT(value.IsObject());
-            auto object_ptr = value.AsObjectPtr();
-            LOX_ASSERT(object_ptr->GetType() == ObjectType::FUNCTION);
-            auto function_ptr = static_cast<FunctionObject*>(object_ptr);
-            std::vector<UpvalueObject*> upvalues;
+        VM_CASE(OP_CLOSURE): {
+            auto function_ptr = const_cast<FunctionObject*>(static_cast<FunctionObject const*>(readConstant().AsObjectPtr()));
+            storeFrame(); // Capturing upvalues and creating the closure allocate
+            std::vector<ObjectRef<UpvalueObject>> upvalues;
             for (auto i = 0; i < function_ptr->upvalue_count; ++i) {
                 auto const is_local = static_cast<bool>(readByte());
                 auto const index = readIndex();
                 if (is_local) {
-                    upvalues.push_back(captureUpvalue(static_cast<uint16_t>(m_frames.back().slot) + index - 1));
+                    upvalues.push_back(captureUpvalue(static_cast<uint16_t>(frame->slot + index - 1)));
                 } else {
-                    upvalues.push_back(m_frames.back().closure->upvalues.at(index));
+                    upvalues.push_back(frame->closure->upvalues[index]);
                 }
             }
             auto closure = m_heap->AllocateClosureObject(function_ptr);
             closure->upvalues = std::move(upvalues);
-            m_value_stack.push_back(closure);
-            break;
+            m_heap->UpdateFootprint(closure);
+            pushStack(closure);
+            VM_DISPATCH();
         }
-        case OP_GET_UPVALUE: {
+        VM_CASE(OP_GET_UPVALUE): {
             auto upvalue_index = readIndex();
-            auto* const upvalue = m_frames.back().closure->upvalues.at(upvalue_index);
+            auto* const upvalue = frame->closure->upvalues[upvalue_index].Get();
             if (upvalue->IsClosed()) {
-                m_value_stack.push_back(upvalue->GetClosedValue());
+                pushStack(upvalue->GetClosedValue());
             } else {
-                m_value_stack.push_back(m_value_stack.at(upvalue->GetStackIndex()));
+                pushStack(m_value_stack[upvalue->GetStackIndex()]);
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_SET_UPVALUE: {
+        VM_CASE(OP_SET_UPVALUE): {
             auto upvalue_index = readIndex();
-            auto* const upvalue = m_frames.back().closure->upvalues.at(upvalue_index);
+            auto* const upvalue = frame->closure->upvalues[upvalue_index].Get();
             if (upvalue->IsClosed()) {
+                auto const marker_lock = m_heap->LockForStore(upvalue);
+                m_heap->PreWriteBarrier(upvalue, upvalue->GetClosedValue());
                 upvalue->SetClosedValue(peekStack(0));
+                m_heap->WriteBarrier(upvalue, peekStack(0));
             } else {
-                m_value_stack.at(upvalue->GetStackIndex()) = peekStack(0);
+                m_value_stack[upvalue->GetStackIndex()] = peekStack(0);
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_CLOSE_UPVALUE: {
+        VM_CASE(OP_CLOSE_UPVALUE): {
             auto index = m_value_stack.size() - 1;
             LOX_ASSERT(index <= MAX_INDEX_SIZE);
             closeUpvalues(static_cast<uint16_t>(index));
             auto _ = popStack();
             static_cast<void>(_);
-            break;
+            VM_DISPATCH();
         }
-        case OP_CLASS: {
-            auto value = readConstant();
-            LOX_ASSERT(value.IsObject());
-            auto string_object_ptr = static_cast<StringObject*>(value.AsObjectPtr());
-            m_value_stack.push_back(m_heap->AllocateClassObject(string_object_ptr->data));
-            break;
+        VM_CASE(OP_CLASS): {
+            auto string_object_ptr = static_cast<StringObject const*>(readConstant().AsObjectPtr());
+            storeFrame();
+            pushStack(m_heap->AllocateClassObject(string_object_ptr->data));
+            VM_DISPATCH();
         }
-        case OP_GET_PROPERTY: {
+        VM_CASE(OP_GET_PROPERTY): {
             auto instance = peekStack(0);
             if (not(instance.IsObject() && instance.AsObject().GetType() == ObjectType::INSTANCE)) {
-                return std::unexpected(RuntimeError { .error_message = "Can only get property for instance types" });
+                return error("Can only get property for instance types");
             }
             auto instance_object_ptr = static_cast<InstanceObject*>(instance.AsObjectPtr());
-            auto property = readConstant();
-            LOX_ASSERT(property.IsObject() && property.AsObject().GetType() == ObjectType::STRING);
-            auto const& property_name = static_cast<StringObject&>(property.AsObject()).data;
-            if (instance_object_ptr->fields.contains(property_name)) {
-                static_cast<void>(popStack());
-                m_value_stack.push_back(instance_object_ptr->fields.at(property_name));
-                break;
+            auto const* property_name = static_cast<StringObject const*>(readConstant().AsObjectPtr());
+            auto const entry = resolveProperty(instance_object_ptr, property_name, property_caches[readIndex()]);
+            if (!entry.has_value()) {
+                return error(fmt::format("{} not found", property_name->data));
             }
-            // The field was not found in the instance property table
-            // Check if this is a class method
-            if (not instance_object_ptr->class_->methods.contains(property_name)) {
-                return std::unexpected(RuntimeError { .error_message = fmt::format("{} not found", property_name) });
+            if (entry->kind == PropertyCacheEntry::Kind::FIELD) {
+                m_value_stack.back() = instance_object_ptr->Field(entry->slot);
+                VM_DISPATCH();
             }
-            auto bound_method = m_heap->AllocateBoundMethodObject(instance_object_ptr, instance_object_ptr->class_->methods.at(property_name));
-            static_cast<void>(popStack());
-            m_value_stack.push_back(bound_method);
-            break;
+            storeFrame();
+            auto bound_method = m_heap->AllocateBoundMethodObject(instance_object_ptr, entry->method);
+            m_value_stack.back() = Value { bound_method };
+            VM_DISPATCH();
         }
-        case OP_SET_PROPERTY: {
+        VM_CASE(OP_SET_PROPERTY): {
             auto const rhs = popStack();
             auto instance = popStack();
             if (not(instance.IsObject() && instance.AsObject().GetType() == ObjectType::INSTANCE)) {
-                return std::unexpected(RuntimeError { .error_message = "Can only set property for instance types" });
+                return error("Can only set property for instance types");
             }
             auto instance_object_ptr = static_cast<InstanceObject*>(instance.AsObjectPtr());
-            auto property = readConstant();
-            LOX_ASSERT(property.IsObject() && property.AsObject().GetType() == ObjectType::STRING);
-            instance_object_ptr->fields[static_cast<StringObject&>(property.AsObject()).data] = rhs; // Will either add/update the propery to the instance
-            m_value_stack.push_back(rhs);
-            break;
+            auto const* property_name = static_cast<StringObject const*>(readConstant().AsObjectPtr());
+            auto& cache = property_caches[readIndex()];
+            {
+                // Covers the instance and its class' shape tree, the class of an old instance is old as well. Scoped, a
+                // computed goto does not run destructors.
+                auto const marker_lock = m_heap->LockForStore(instance_object_ptr->class_);
+                auto const store_field = [&](uint32_t slot) {
+                    m_heap->PreWriteBarrier(instance_object_ptr, instance_object_ptr->Field(slot));
+                    instance_object_ptr->Field(slot) = rhs;
+                };
+                auto* const shape = instance_object_ptr->shape;
+                if (auto const* entry = cache.Find(shape->Id()); entry != nullptr) {
+                    ++m_property_cache_stats.hits;
+                    if (entry->kind == PropertyCacheEntry::Kind::FIELD) {
+                        store_field(entry->slot);
+                    } else {
+                        instance_object_ptr->AddField(entry->transition, rhs);
+                        m_heap->UpdateFootprint(instance_object_ptr);
+                    }
+                } else {
+                    ++m_property_cache_stats.misses;
+                    m_property_cache_stats.megamorphic_misses += cache.megamorphic ? 1 : 0;
+                    if (auto index = shape->Lookup(property_name); index.has_value()) {
+                        cache.Insert(PropertyCacheEntry::Field(shape->Id(), *index));
+                        store_field(*index);
+                    } else {
+                        auto* const transition = shape->Transition(property_name);
+                        cache.Insert(PropertyCacheEntry::AddField(shape->Id(), transition, transition->FieldCount() - 1));
+                        instance_object_ptr->AddField(transition, rhs);
+                        m_heap->UpdateFootprint(instance_object_ptr);
+                        m_heap->UpdateFootprint(instance_object_ptr->class_); // The shape tree may have grown
+                        m_heap->WriteBarrier(instance_object_ptr->class_, property_name); // The shape tree holds the name
+                    }
+                }
+                m_heap->WriteBarrier(instance_object_ptr, rhs);
+            }
+            pushStack(rhs);
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_METHOD): {
+            // The compiler only emits OP_METHOD with the method's closure on top of its class
+            auto closure_object_ptr = static_cast<ClosureObject*>(popStack().AsObjectPtr());
+            auto class_object_ptr = static_cast<ClassObject*>(m_value_stack.back().AsObjectPtr());
+            auto method_name = static_cast<StringObject const*>(readConstant().AsObjectPtr());
+            {
+                auto const marker_lock = m_heap->LockForStore(class_object_ptr);
+                auto& method = class_object_ptr->methods[method_name];
+                m_heap->PreWriteBarrier(class_object_ptr, method); // A method can be redefined
+                method = closure_object_ptr;
+                m_heap->UpdateFootprint(class_object_ptr);
+                m_heap->WriteBarrier(class_object_ptr, closure_object_ptr);
+                m_heap->WriteBarrier(class_object_ptr, method_name);
+            }
+            VM_DISPATCH();
         }
-        case OP_METHOD: {
-            auto object = peekStack(0);
-            LOX_ASSERT(object.IsObject() && object.AsObject().GetType() == ObjectType::CLOSURE);
-            auto closure_object_ptr = static_cast<ClosureObject*>(object.AsObjectPtr());
-            object = peekStack(1);
-            LOX_ASSERT(object.IsObject() && object.AsObject().GetType() == ObjectType::CLASS);
-            auto class_object_ptr = static_cast<ClassObject*>(object.AsObjectPtr());
-            object = readConstant();
-            LOX_ASSERT(object.IsObject() && object.AsObject().GetType() == ObjectType::STRING);
-            auto method_name = static_cast<StringObject*>(object.AsObjectPtr()); // Will add the  to the instance
-            class_object_ptr->methods[method_name->data] = closure_object_ptr;
-            break;
+        VM_CASE(OP_INVOKE): {
+            auto const* method_name = static_cast<StringObject const*>(readConstant().AsObjectPtr());
+            auto const num_arguments = readIndex();
+            auto& cache = property_caches[readIndex()];
+            auto receiver = peekStack(num_arguments);
+            if (not(receiver.IsObject() && receiver.AsObject().GetType() == ObjectType::INSTANCE)) {
+                return error("Only instances have methods");
+            }
+            auto instance_object_ptr = static_cast<InstanceObject*>(receiver.AsObjectPtr());
+            auto const entry = resolveProperty(instance_object_ptr, method_name, cache);
+            if (!entry.has_value()) {
+                return error(fmt::format("{} not found", method_name->data));
+            }
+            storeFrame();
+            auto call_status = RuntimeErrorOr<VoidType> {};
+            if (entry->kind == PropertyCacheEntry::Kind::FIELD) {
+                // A callable stored in a field, it replaces the receiver and is called like any other value
+                auto& callee = m_value_stack[m_value_stack.size() - num_arguments - 1];
+                callee = instance_object_ptr->Field(entry->slot);
+                call_status = call(callee, num_arguments);
+            } else {
+                // The receiver is already where the method expects "this"
+                call_status = callClosure(entry->method, num_arguments);
+            }
+            if (!call_status) {
+                return error(std::move(call_status.error().error_message));
+            }
+            loadFrame();
+            if (m_heap_snapshot_requested.load(std::memory_order_relaxed)) [[unlikely]] {
+                writeRequestedHeapSnapshot();
+            }
+            VM_DISPATCH();
         }
         }
     }
+#undef VM_NUMBER_BINARY_OP
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_TRACE_INSTRUCTION
 }
 
-auto VirtualMachine::readByte() -> uint8_t
-{
-    LOX_ASSERT(m_frames.rbegin()->instruction_pointer < currentChunk().byte_code.size());
-    return currentChunk().byte_code.at(m_frames.rbegin()->instruction_pointer++);
-}
-
-auto VirtualMachine::readConstant() -> Value
+// The stack accessors below are unchecked. Every chunk is verified before it is executed which proves that the stack
+// never underflows, and call()/Interpret() make sure a frame's maximum depth fits in the reserved capacity before it is
+// pushed. The stack therefore never grows past its reserved capacity, the interpreter loop holds pointers into it.
+auto VirtualMachine::pushStack(Value value) -> void
 {
-    return currentChunk().constant_pool.at(readIndex());
+    m_value_stack.push_back(value);
 }
 
 auto VirtualMachine::popStack() -> Value
 {
-    LOX_ASSERT(!m_value_stack.empty());
-    auto value = m_value_stack.at(m_value_stack.size() - 1);
+    auto value = m_value_stack.back();
     m_value_stack.pop_back();
     return value;
 }
 
 auto VirtualMachine::peekStack(uint32_t index_from_top) -> Value const&
 {
-    LOX_ASSERT(m_value_stack.size() > index_from_top);
-    return m_value_stack.at(m_value_stack.size() - 1 - index_from_top);
+    return m_value_stack[m_value_stack.size() - 1 - index_from_top];
 }
 
 auto VirtualMachine::binaryOperation(OpCode op) -> ErrorOr<VoidType>
@@ -432,7 +734,7 @@ auto VirtualMachine::binaryOperation(OpCode op) -> ErrorOr<VoidType>
             return std::unexpected(runtimeError(fmt::format("LHS of \"{}\" is not a number type. Is {}", getOperatorString(_operator), lhs)));
         }
 
-        m_value_stack.emplace_back(_operator(lhs.AsDouble(), rhs.AsDouble()));
+        pushStack(_operator(lhs.AsDouble(), rhs.AsDouble()));
         return VoidType {};
     };
 
@@ -450,9 +752,14 @@ auto VirtualMachine::binaryOperation(OpCode op) -> ErrorOr<VoidType>
         if (lhs_object.GetType() != ObjectType::STRING) {
             return std::unexpected(runtimeError(fmt::format("LHS of \"+\" is not a string type.")));
         }
-        auto lhs_string_object = static_cast<StringObject*>(&lhs_object);
-        lhs_string_object->data += static_cast<StringObject const*>(&rhs_object)->data;
-        m_value_stack.emplace_back(static_cast<Object*>(lhs_string_object));
+        // Strings are interned and immutable, the result is a new(or an existing interned) string. It is built in a buffer
+        // of its final size that a new string object takes over, a long string is allocated once.
+        auto const& lhs_data = static_cast<StringObject const*>(&lhs_object)->data;
+        auto const& rhs_data = static_cast<StringObject const*>(&rhs_object)->data;
+        auto concatenated = LoxString {};
+        concatenated.reserve(lhs_data.size() + rhs_data.size());
+        concatenated.append(lhs_data).append(rhs_data);
+        pushStack(m_heap->AllocateStringObjectFromBuffer(std::move(concatenated)));
         return VoidType {};
     };
 
@@ -491,16 +798,34 @@ auto VirtualMachine::binaryOperation(OpCode op) -> ErrorOr<VoidType>
     }
 }
 
-VirtualMachine::VirtualMachine(std::string* external_stream)
+VirtualMachine::VirtualMachine(std::string* external_stream, HeapOptions const& heap_options)
     : m_external_stream(external_stream)
 {
-    m_heap = std::make_unique<Heap>(*this);
-    m_compiler = std::make_unique<Compiler>(*m_heap, m_parser_state);
-    m_heap->SetCompilerContext(m_compiler.get());
+    m_frames.reserve(MAX_CALL_FRAMES);
+    m_value_stack.reserve(VALUE_STACK_CAPACITY);
+    m_heap = std::make_unique<Heap>(*this, heap_options);
+    m_init_string = m_heap->AllocateStringObject("init");
+    m_compiler = std::make_unique<Compiler>(*m_heap, m_parser_state, m_globals);
 }
-auto VirtualMachine::isAtEnd() -> bool
+
+auto VirtualMachine::WriteHeapSnapshot(std::string_view path) const -> bool
+{
+    return ::WriteHeapSnapshot(m_heap->TakeSnapshot(), path);
+}
+
+auto VirtualMachine::writeRequestedHeapSnapshot() -> void
 {
-    return m_frames.rbegin()->instruction_pointer == currentChunk().byte_code.size();
+    if (m_heap_snapshot_requested.exchange(false, std::memory_order_relaxed) && !WriteHeapSnapshot(m_heap_snapshot_path)) {
+        fmt::print(stderr, "Could not write the heap snapshot to {}\n", m_heap_snapshot_path);
+    }
+}
+
+auto VirtualMachine::runLoopSafepoint() -> void
+{
+    writeRequestedHeapSnapshot();
+    if (m_heap->CompactionDue()) {
+        m_heap->CollectGarbage();
+    }
 }
 
 auto VirtualMachine::call(Value& callable, uint16_t num_arguments) -> RuntimeErrorOr<VoidType>
@@ -510,28 +835,17 @@ auto VirtualMachine::call(Value& callable, uint16_t num_arguments) -> RuntimeErr
     }
     auto const object_ptr = callable.AsObjectPtr();
     switch (object_ptr->GetType()) {
-    case ObjectType::CLOSURE: {
-        auto closure_object = static_cast<ClosureObject*>(object_ptr);
-        auto function_object_ptr = closure_object->function;
-        if (function_object_ptr->arity != num_arguments) {
-            return std::unexpected(RuntimeError { .error_message = "Number of arguments provided does not match the number of function parameters" });
-        }
-        // At this point the state of the stack is as follows:
-        // | | | | ... | <CALLABLE_OBJECT> | param_1 | param_2 | ... | param_n |
-
-        // Set up the new call frame
-        m_frames.emplace_back(closure_object, 0, m_value_stack.size() - num_arguments);
-        return VoidType {};
-    }
+    case ObjectType::CLOSURE:
+        return callClosure(static_cast<ClosureObject*>(object_ptr), num_arguments);
     case ObjectType::NATIVE_FUNCTION: {
         auto native_function_object_ptr = static_cast<NativeFunctionObject const*>(object_ptr);
         RuntimeErrorOr<Value> return_value;
         if (num_arguments == 0) {
-            return_value = native_function_object_ptr->native_function(num_arguments, nullptr);
+            return_value = native_function_object_ptr->native_function(*this, num_arguments, nullptr);
         } else {
             auto stack_top_ptr = m_value_stack.data() + m_value_stack.size() - 1;
             auto first_arg_ptr = stack_top_ptr - (num_arguments - 1);
-            return_value = native_function_object_ptr->native_function(num_arguments, first_arg_ptr);
+            return_value = native_function_object_ptr->native_function(*this, num_arguments, first_arg_ptr);
         }
         // This is ugly and the perfect candidate for std::expected::and_then
         // P2505R1 Monadic Functions for std::expected
@@ -546,7 +860,7 @@ auto VirtualMachine::call(Value& callable, uint16_t num_arguments) -> RuntimeErr
                        static_cast<void>(_);
                        --num_to_pop;
                    }
-                   m_value_stack.push_back(value);
+                   pushStack(value);
                    return VoidType {};
                }()
                : /* Error branch*/
@@ -555,9 +869,9 @@ auto VirtualMachine::call(Value& callable, uint16_t num_arguments) -> RuntimeErr
     case ObjectType::CLASS: {
         auto class_ptr = static_cast<ClassObject*>(object_ptr);
         auto new_instance = m_heap->AllocateInstanceObject(class_ptr);
-        m_value_stack.at(m_value_stack.size() - num_arguments - 1) = new_instance;
-        if (new_instance->class_->methods.contains("init")) {
-            Value method = new_instance->class_->methods.at("init");
+        m_value_stack[m_value_stack.size() - num_arguments - 1] = new_instance;
+        if (auto initializer = new_instance->class_->methods.find(m_init_string); initializer != new_instance->class_->methods.end()) {
+            Value method = initializer->second;
             return this->call(method, num_arguments);
         } else if (num_arguments != 0) {
             return std::unexpected { RuntimeError { .error_message = "Number of arguments given to initializer does not match" } };
@@ -566,41 +880,58 @@ auto VirtualMachine::call(Value& callable, uint16_t num_arguments) -> RuntimeErr
     }
     case ObjectType::BOUND_METHOD: {
         auto bound_object_ptr = static_cast<BoundMethodObject*>(object_ptr);
-        if (bound_object_ptr->method->function->arity != num_arguments) {
-            return std::unexpected(RuntimeError { .error_message = "Number of arguments provided does not match the number of function parameters" });
-        }
-
-        // At this point the state of the stack is as follows:
-        // | | | | ... | <ClosureObject> | param_1 | param_2 | ... | param_n |
-
-        // Set up the new call frame
-        m_value_stack.at(m_value_stack.size() - num_arguments - 1) = bound_object_ptr->receiver;
-        // At this point the state of the stack is as follows:
-        // | | | | ... | InstanceObject | param_1 | param_2 | ... | param_n |
-        m_frames.emplace_back(bound_object_ptr->method, 0, m_value_stack.size() - num_arguments);
-        return VoidType {};
+        // The receiver replaces the bound method so that it becomes local zero("this") of the method
+        m_value_stack[m_value_stack.size() - num_arguments - 1] = bound_object_ptr->receiver.Get();
+        return callClosure(bound_object_ptr->method, num_arguments);
     }
     default:
         return std::unexpected(RuntimeError { .error_message = "Not a callable_object" });
     }
 }
 
-auto VirtualMachine::runtimeError(std::string error_message) -> RuntimeError
+auto VirtualMachine::QuickeningReport() const -> std::vector<FunctionQuickeningStats>
 {
-    m_frames.rbegin()->instruction_pointer = currentChunk().byte_code.size();
-    return RuntimeError { std::move(error_message) };
+    std::vector<FunctionQuickeningStats> report;
+    m_heap->ForEachObject([&report](Object const& object) {
+        if (object.GetType() != ObjectType::FUNCTION) {
+            return;
+        }
+        auto const& function = static_cast<FunctionObject const&>(object);
+        if (function.quickening.specialized != 0 || function.quickening.despecialized != 0) {
+            report.push_back({ .function_name = function.function_name, .stats = function.quickening });
+        }
+    });
+    return report;
+}
+
+auto VirtualMachine::callClosure(ClosureObject* closure, uint16_t num_arguments) -> RuntimeErrorOr<VoidType>
+{
+    auto function_object_ptr = closure->function;
+    if (function_object_ptr->arity != num_arguments) {
+        return std::unexpected(RuntimeError { .error_message = "Number of arguments provided does not match the number of function parameters" });
+    }
+    if (m_frames.size() == MAX_CALL_FRAMES || !hasStackSpaceFor(*function_object_ptr, num_arguments)) {
+        return std::unexpected(RuntimeError { .error_message = "Stack overflow" });
+    }
+    // At this point the state of the stack is as follows:
+    // | | | | ... | <CALLABLE_OBJECT> | param_1 | param_2 | ... | param_n |
+
+    // Set up the new call frame
+    m_frames.emplace_back(closure, 0, m_value_stack.size() - num_arguments);
+    ++m_frames_pushed;
+    return VoidType {};
 }
 
-auto VirtualMachine::readIndex() -> uint16_t
+auto VirtualMachine::hasStackSpaceFor(FunctionObject const& function, uint16_t num_arguments) const -> bool
 {
-    auto lsb = readByte();
-    auto hsb = static_cast<uint16_t>(readByte() << 8);
-    return static_cast<uint16_t>(hsb + lsb);
+    LOX_ASSERT(function.verified);
+    auto const slot = m_value_stack.size() - num_arguments;
+    return slot + function.max_stack_depth <= VALUE_STACK_CAPACITY;
 }
 
-auto VirtualMachine::currentChunk() -> Chunk const&
+auto VirtualMachine::runtimeError(std::string error_message) -> RuntimeError
 {
-    return m_frames.rbegin()->closure->function->chunk;
+    return RuntimeError { std::move(error_message) };
 }
 
 auto VirtualMachine::dumpCallFrameStack() -> void
@@ -638,7 +969,9 @@ auto VirtualMachine::closeUpvalues(uint16_t stack_index) -> void
 {
     auto it = m_open_upvalues.begin();
     while (it != m_open_upvalues.end() && (*it)->GetStackIndex() >= stack_index) {
-        (*it)->Close(m_value_stack.at((*it)->GetStackIndex()));
+        auto const marker_lock = m_heap->LockForStore(*it);
+        (*it)->Close(m_value_stack[(*it)->GetStackIndex()]);
+        m_heap->WriteBarrier(*it, (*it)->GetClosedValue());
         auto next = std::next(it);
         m_open_upvalues.erase(it);
         it = next;
@@ -23,42 +23,147 @@
 #ifndef LOX_CPP_VIRTUAL_MACHINE_H
 #define LOX_CPP_VIRTUAL_MACHINE_H
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <list>
 #include <memory>
 #include <stack>
+#include <string>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include "chunk.h"
 #include "compiler.h"
 #include "error.h"
+#include "global_table.h"
 #include "heap.h"
+#include "inline_cache.h"
+#include "metrics.h"
 #include "object.h"
 #include "source.h"
 
+static constexpr auto MAX_CALL_FRAMES = 1024U;
+// Quickening is turned off for a function once its instructions have been reverted to their generic form this many times
+static constexpr auto MAX_DESPECIALIZATIONS_PER_FUNCTION = 64U;
+// Stack slots are addressed with 16 bit indices(see UpvalueObject), the stack is reserved up-front and never reallocated.
+static constexpr auto VALUE_STACK_CAPACITY = static_cast<size_t>(MAX_INDEX_SIZE) + 1;
+
+struct FunctionQuickeningStats {
+    std::string function_name;
+    QuickeningStats stats;
+};
+
 class VirtualMachine {
 public:
-    VirtualMachine(std::string* external_stream = nullptr);
+    VirtualMachine(std::string* external_stream = nullptr, HeapOptions const& heap_options = {});
 
     [[nodiscard]] auto Interpret(Source const& source_code) -> ErrorOr<VoidType>;
+    [[nodiscard]] auto InstructionsExecuted() const -> uint64_t
+    {
+        return m_instructions_executed;
+    }
+    // Bytes of the heap's objects including the buffers they own
+    [[nodiscard]] auto HeapBytes() const -> uint64_t
+    {
+        return m_heap->BytesAllocated();
+    }
+    [[nodiscard]] auto ObjectsAllocated() const -> uint64_t
+    {
+        return m_heap->TotalObjectsAllocated();
+    }
+    [[nodiscard]] auto GarbageCollections() const -> CollectionStats const&
+    {
+        return m_heap->Collections();
+    }
+    // Counters of the VM and its heap, see metrics.h
+    [[nodiscard]] auto Metrics() const -> RuntimeMetrics
+    {
+        return RuntimeMetrics {
+            .instructions_executed = m_instructions_executed,
+            .frames_pushed = m_frames_pushed,
+            .heap_bytes = m_heap->BytesAllocated(),
+            .objects_allocated = m_heap->TotalObjectsAllocated(),
+            .collections = m_heap->Collections(),
+            .allocations = m_heap->Allocations(),
+            .large_objects = LargeObjectSpace::Instance().GetStats(),
+        };
+    }
+    // Upper bound on the time a slice of an incremental major collection takes, zero collects without interruptions
+    auto SetGCPauseBudget(std::chrono::microseconds budget) -> void
+    {
+        m_heap->SetPauseBudget(budget);
+    }
+    // Marks the old generation on a background thread instead of in slices on the interpreter's thread
+    auto SetConcurrentGC(bool enabled) -> void
+    {
+        m_heap->SetConcurrentMarking(enabled);
+    }
+    // Number of threads that trace stop-the-world major collections of heaps of at least "min_heap_bytes"
+    auto SetGCMarkThreads(uint32_t threads, uint64_t min_heap_bytes = DEFAULT_PARALLEL_MARK_THRESHOLD) -> void
+    {
+        m_heap->SetParallelMarking(threads, min_heap_bytes);
+    }
+    // Leaves the old generation to be swept on demand after stop-the-world major collections, on by default
+    auto SetGCLazySweeping(bool enabled) -> void
+    {
+        m_heap->SetLazySweeping(enabled);
+    }
+    // Destroys dead objects on a background thread instead of in the collection's pause
+    auto SetGCBackgroundFreeing(bool enabled) -> void
+    {
+        m_heap->SetBackgroundFreeing(enabled);
+    }
+    // Moves the objects of sparsely used blocks together once the heap is fragmented, see Heap
+    auto SetGCCompaction(bool enabled) -> void
+    {
+        m_heap->SetCompaction(enabled);
+    }
+    // Collects all garbage right away, see Heap::CollectGarbage
+    auto CollectGarbage() -> void
+    {
+        m_heap->CollectGarbage();
+    }
+    [[nodiscard]] auto PropertyCacheCounters() const -> PropertyCacheStats const&
+    {
+        return m_property_cache_stats;
+    }
+    // Writes the objects reachable from the roots to "path", see heap_snapshot.h
+    [[nodiscard]] auto WriteHeapSnapshot(std::string_view path) const -> bool;
+    auto SetHeapSnapshotPath(std::string path) -> void
+    {
+        m_heap_snapshot_path = std::move(path);
+    }
+    // Writes a heap snapshot to the path set by SetHeapSnapshotPath on the next loop back-edge or call. Safe to call from a
+    // signal handler.
+    auto RequestHeapSnapshot() -> void
+    {
+        m_heap_snapshot_requested.store(true, std::memory_order_relaxed);
+    }
+    // Quickening counters of every live function that had at least one instruction rewritten
+    [[nodiscard]] auto QuickeningReport() const -> std::vector<FunctionQuickeningStats>;
+    [[nodiscard]] auto Globals() -> GlobalTable&
+    {
+        return m_globals;
+    }
 
 private:
-    [[nodiscard]] auto currentChunk() -> Chunk const&;
-    [[nodiscard]] auto isAtEnd() -> bool;
     [[nodiscard]] auto run() -> RuntimeErrorOr<VoidType>;
-    [[nodiscard]] auto readByte() -> uint8_t;
-    [[nodiscard]] auto readConstant() -> Value;
-    [[nodiscard]] auto readIndex() -> uint16_t;
+    auto pushStack(Value value) -> void;
     [[nodiscard]] auto popStack() -> Value;
     [[nodiscard]] auto peekStack(uint32_t index_from_top) -> Value const&;
     [[nodiscard]] auto captureUpvalue(uint16_t index) -> UpvalueObject*;
     [[nodiscard]] auto binaryOperation(OpCode op) -> RuntimeErrorOr<VoidType>;
+    [[nodiscard]] auto hasStackSpaceFor(FunctionObject const& function, uint16_t num_arguments) const -> bool;
     [[nodiscard]] auto runtimeError(std::string error_message) -> RuntimeError;
     [[nodiscard]] auto call(Value& callable, uint16_t num_arguments) -> RuntimeErrorOr<VoidType>;
+    [[nodiscard]] auto callClosure(ClosureObject* closure, uint16_t num_arguments) -> RuntimeErrorOr<VoidType>;
     auto closeUpvalues(uint16_t stack_index) -> void;
     [[maybe_unused]] auto dumpCallFrameStack() -> void;
     auto registerNativeFunctions() -> void;
+    auto runLoopSafepoint() -> void;
+    auto writeRequestedHeapSnapshot() -> void;
 
 private:
     struct CallFrame {
@@ -79,8 +184,15 @@ private:
     std::string* const m_external_stream = nullptr;
 
     std::vector<Value> m_value_stack;
-    Table m_globals;
+    GlobalTable m_globals;
+    StringObject const* m_init_string = nullptr; // Interned "init", used to look up initializers
+    std::vector<NativeFunctionObject*> m_native_functions; // Allocated once, see registerNativeFunctions
     std::list<UpvalueObject*> m_open_upvalues;
+    uint64_t m_instructions_executed = 0;
+    uint64_t m_frames_pushed = 0;
+    std::string m_heap_snapshot_path = "heap.loxsnapshot";
+    std::atomic<bool> m_heap_snapshot_requested = false;
+    PropertyCacheStats m_property_cache_stats;
     // Make sure the heap is the last object that's destroyed as it's the owner of all lox Objects
     std::unique_ptr<Heap> m_heap { nullptr };
     // This is an unfortuante intertwining dependency that's being injected. TODO: Refactor this
@@ -39,8 +39,7 @@ protected:
     {
         m_heap = std::make_unique<Heap>(m_dummy_vm);
         m_compiler
-            = std::make_unique<Compiler>(*m_heap, m_parser_state);
-        m_heap->SetCompilerContext(m_compiler.get());
+            = std::make_unique<Compiler>(*m_heap, m_parser_state, m_dummy_vm.Globals());
     }
     std::unique_ptr<Compiler> m_compiler;
     std::unique_ptr<Heap> m_heap;
@@ -65,6 +64,16 @@ bool ValidateByteCode(std::vector<uint8_t> expected, std::vector<uint8_t> const&
     return success;
 }
 
+// The expected strings are built on the stack so they are not interned, compare those by contents
+static bool ConstantsMatch(Value const& expected, Value const& generated)
+{
+    auto isString = [](Value const& value) { return value.IsObject() && value.AsObject().GetType() == ObjectType::STRING; };
+    if (isString(expected) && isString(generated)) {
+        return static_cast<StringObject const*>(expected.AsObjectPtr())->data == static_cast<StringObject const*>(generated.AsObjectPtr())->data;
+    }
+    return expected == generated;
+}
+
 bool ValidateConstants(std::vector<Value> expected, std::vector<Value> const& generated_constants)
 {
     if (expected.size() != generated_constants.size()) {
@@ -76,7 +85,7 @@ bool ValidateConstants(std::vector<Value> expected, std::vector<Value> const& ge
     }
     bool success = true;
     for (size_t i = 0; i < expected.size(); i++) {
-        if (expected[i] != generated_constants[i]) {
+        if (!ConstantsMatch(expected[i], generated_constants[i])) {
             fmt::print(stderr, "Invalid constant at index:{} Expected:{} Got:{}\n", i, expected[i], generated_constants[i]);
             success = false;
         }
@@ -144,20 +153,22 @@ TEST_F(CompilerTest, VaraibleDeclaration)
     ASSERT_TRUE(compilation_result.has_value());
     auto const& compiled_function = compilation_result.value();
     ASSERT_TRUE(ValidateByteCode(std::vector<uint8_t> {
+                                     OP_CONSTANT, 0, 0,
                                      OP_CONSTANT, 1, 0,
+                                     OP_ADD,
                                      OP_CONSTANT, 2, 0,
                                      OP_ADD,
                                      OP_CONSTANT, 3, 0,
-                                     OP_ADD,
                                      OP_CONSTANT, 4, 0,
-                                     OP_CONSTANT, 5, 0,
                                      OP_MULTIPLY,
                                      OP_ADD,
                                      OP_DEFINE_GLOBAL, 0, 0,
                                      OP_NIL,
                                      OP_RETURN },
         compiled_function->chunk.byte_code));
-    ASSERT_TRUE(ValidateConstants(std::vector<Value> { m_heap->AllocateStringObject("a"), 1.0, 2.0, 3.0, 3.0, 20.0 }, compiled_function->chunk.constant_pool));
+    ASSERT_TRUE(ValidateConstants(std::vector<Value> { 1.0, 2.0, 3.0, 3.0, 20.0 }, compiled_function->chunk.constant_pool));
+    ASSERT_EQ(m_dummy_vm.Globals().Size(), 1);
+    ASSERT_EQ(m_dummy_vm.Globals().Name(0), m_heap->AllocateStringObject("a"));
 }
 
 TEST_F(CompilerTest, StringConcatenation)
@@ -171,24 +182,27 @@ TEST_F(CompilerTest, StringConcatenation)
     auto const& compiled_function = compilation_result.value();
 
     ASSERT_TRUE(ValidateByteCode(std::vector<uint8_t> {
-                                     OP_CONSTANT, 1, 0,
+                                     OP_CONSTANT, 0, 0,
                                      OP_DEFINE_GLOBAL, 0, 0,
-                                     OP_GET_GLOBAL, 3, 0,
-                                     OP_CONSTANT, 4, 0,
+                                     OP_GET_GLOBAL, 0, 0,
+                                     OP_CONSTANT, 1, 0,
                                      OP_ADD,
-                                     OP_DEFINE_GLOBAL, 2, 0,
+                                     OP_DEFINE_GLOBAL, 1, 0,
                                      OP_NIL, OP_RETURN },
         compiled_function->chunk.byte_code));
     auto string_objects = std::vector<StringObject> {
-        "a"sv, "Hello world"sv, "b"sv, "a"sv, "FooBar"sv
+        "Hello world"sv, "FooBar"sv
     };
     ASSERT_TRUE(ValidateConstants(std::vector<Value> {
                                       &string_objects[0],
-                                      &string_objects[1],
-                                      &string_objects[2],
-                                      &string_objects[3],
-                                      &string_objects[4] },
+                                      &string_objects[1] },
         compiled_function->chunk.constant_pool));
+    // String literals are interned
+    ASSERT_EQ(m_heap->AllocateStringObject("Hello world"), compiled_function->chunk.constant_pool[0].AsObjectPtr());
+    // Both occurrences of the identifier "a" resolve to the same global slot
+    ASSERT_EQ(m_dummy_vm.Globals().Size(), 2);
+    ASSERT_EQ(m_dummy_vm.Globals().Name(0), m_heap->AllocateStringObject("a"));
+    ASSERT_EQ(m_dummy_vm.Globals().Name(1), m_heap->AllocateStringObject("b"));
 }
 
 TEST_F(CompilerTest, PrintStatements)
@@ -222,25 +236,20 @@ TEST_F(CompilerTest, AssignmentStatements)
     ASSERT_TRUE(compilation_result.has_value());
     auto const& compiled_function = compilation_result.value();
     ASSERT_TRUE(ValidateByteCode(std::vector<uint8_t> {
-                                     OP_CONSTANT, 1, 0,
+                                     OP_CONSTANT, 0, 0,
                                      OP_DEFINE_GLOBAL, 0, 0,
-                                     OP_GET_GLOBAL, 2, 0,
+                                     OP_GET_GLOBAL, 0, 0,
                                      OP_PRINT,
-                                     OP_CONSTANT, 4, 0,
-                                     OP_SET_GLOBAL, 3, 0,
+                                     OP_CONSTANT, 1, 0,
+                                     OP_SET_GLOBAL, 0, 0,
                                      OP_POP,
                                      OP_NIL,
                                      OP_RETURN },
         compiled_function->chunk.byte_code));
-    auto string_objects = std::vector<StringObject> {
-        "a"sv, "Hello World"sv
-    };
+    auto string_object = StringObject { "Hello World"sv };
     ASSERT_TRUE(ValidateConstants(std::vector<Value> {
-                                      &string_objects[0],
                                       10.0,
-                                      &string_objects[0],
-                                      &string_objects[0],
-                                      &string_objects[1] },
+                                      &string_object },
         compiled_function->chunk.constant_pool));
 }
 
@@ -263,16 +272,10 @@ TEST_F(CompilerTest, InvalidBinaryOp)
     auto compilation_result = m_compiler->CompileSource(m_source);
     ASSERT_TRUE(compilation_result.has_value());
     auto const& compiled_function = compilation_result.value();
-    auto string_objects = std::vector<StringObject> {
-        "a"sv, "b"sv, "String"sv
-    };
+    auto string_object = StringObject { "String"sv };
     ASSERT_TRUE(ValidateConstants(std::vector<Value> {
-                                      &string_objects[0],
                                       10.0,
-                                      &string_objects[1],
-                                      &string_objects[2],
-                                      &string_objects[0],
-                                      &string_objects[1],
+                                      &string_object,
                                   },
         compiled_function->chunk.constant_pool));
 }
@@ -554,20 +557,16 @@ fun MyFunction() {
     ASSERT_TRUE(compilation_result.has_value());
     auto const& compiled_function = compilation_result.value();
     ASSERT_TRUE(ValidateByteCode(std::vector<uint8_t> {
-                                     OP_CLOSURE, 1, 0,
+                                     OP_CLOSURE, 0, 0,
                                      OP_DEFINE_GLOBAL, 0, 0,
                                      OP_NIL,
                                      OP_RETURN },
         compiled_function->chunk.byte_code));
-    auto string_object = StringObject {
-        "MyFunction"sv,
-    };
     auto function_object = FunctionObject {
         "MyFunction"sv,
         0
     };
     ASSERT_TRUE(ValidateConstants(std::vector<Value> {
-                                      &string_object,
                                       &function_object },
         compiled_function->chunk.constant_pool));
 }
@@ -584,20 +583,16 @@ fun MyFunction(a, b, c) {
     ASSERT_TRUE(compilation_result.has_value());
     auto const& compiled_function = compilation_result.value();
     ASSERT_TRUE(ValidateByteCode(std::vector<uint8_t> {
-                                     OP_CLOSURE, 1, 0,
+                                     OP_CLOSURE, 0, 0,
                                      OP_DEFINE_GLOBAL, 0, 0,
                                      OP_NIL,
                                      OP_RETURN },
         compiled_function->chunk.byte_code));
-    auto string_object = StringObject {
-        "MyFunction"sv,
-    };
     auto function_object = FunctionObject {
         "MyFunction"sv,
         3
     };
     ASSERT_TRUE(ValidateConstants(std::vector<Value> {
-                                      &string_object,
                                       &function_object },
         compiled_function->chunk.constant_pool));
 }
@@ -613,10 +608,10 @@ MyFunction(1);
     auto compilation_result = m_compiler->CompileSource(m_source);
     ASSERT_TRUE(compilation_result.has_value());
     ASSERT_TRUE(ValidateByteCode(std::vector<uint8_t> {
-                                     OP_CLOSURE, 1, 0,
+                                     OP_CLOSURE, 0, 0,
                                      OP_DEFINE_GLOBAL, 0, 0,
-                                     OP_GET_GLOBAL, 2, 0,
-                                     OP_CONSTANT, 3, 0,
+                                     OP_GET_GLOBAL, 0, 0,
+                                     OP_CONSTANT, 1, 0,
                                      OP_CALL, 1, 0,
                                      OP_POP,
                                      OP_NIL,
@@ -647,10 +642,10 @@ Fib(1);
     auto compilation_result = m_compiler->CompileSource(m_source);
     ASSERT_TRUE(compilation_result.has_value());
     ASSERT_TRUE(ValidateByteCode(std::vector<uint8_t> {
-                                     OP_CLOSURE, 1, 0,
+                                     OP_CLOSURE, 0, 0,
                                      OP_DEFINE_GLOBAL, 0, 0,
-                                     OP_GET_GLOBAL, 2, 0,
-                                     OP_CONSTANT, 3, 0,
+                                     OP_GET_GLOBAL, 0, 0,
+                                     OP_CONSTANT, 1, 0,
                                      OP_CALL, 1, 0,
                                      OP_POP,
                                      OP_NIL,
@@ -668,14 +663,14 @@ Fib(1);
                                      OP_RETURN,
                                      OP_JUMP, 1, 0,
                                      OP_POP,
-                                     OP_GET_GLOBAL, 1, 0,
+                                     OP_GET_GLOBAL, 0, 0,
                                      OP_GET_LOCAL, 1, 0,
-                                     OP_CONSTANT, 2, 0,
+                                     OP_CONSTANT, 1, 0,
                                      OP_SUBTRACT,
                                      OP_CALL, 1, 0,
-                                     OP_GET_GLOBAL, 3, 0,
+                                     OP_GET_GLOBAL, 0, 0,
                                      OP_GET_LOCAL, 1, 0,
-                                     OP_CONSTANT, 4, 0,
+                                     OP_CONSTANT, 2, 0,
                                      OP_SUBTRACT,
                                      OP_CALL, 1, 0,
                                      OP_ADD,
@@ -685,6 +680,39 @@ Fib(1);
         function_map.begin()->second->chunk.byte_code));
 }
 
+TEST_F(CompilerTest, PropertyAccessAndInvoke)
+{
+    m_source.Append(R"(
+var a;
+a.x = 1;
+print a.x;
+a.m(2);
+)");
+    auto const compilation_result = m_compiler->CompileSource(m_source);
+    ASSERT_TRUE(compilation_result.has_value());
+    ASSERT_TRUE(ValidateByteCode(std::vector<uint8_t> {
+                                     OP_NIL,
+                                     OP_DEFINE_GLOBAL, 0, 0,
+                                     OP_GET_GLOBAL, 0, 0,
+                                     OP_CONSTANT, 1, 0,
+                                     OP_SET_PROPERTY, 0, 0, 0 /*Cache_index*/, 0,
+                                     OP_POP,
+                                     OP_GET_GLOBAL, 0, 0,
+                                     OP_GET_PROPERTY, 2, 0, 1 /*Cache_index*/, 0,
+                                     OP_PRINT,
+                                     OP_GET_GLOBAL, 0, 0,
+                                     OP_CONSTANT, 4, 0,
+                                     OP_INVOKE, 3, 0, 1 /*Num_args*/, 0, 2 /*Cache_index*/, 0,
+                                     OP_POP,
+                                     OP_NIL,
+                                     OP_RETURN },
+        compilation_result.value()->chunk.byte_code));
+    auto x = StringObject { "x"sv };
+    auto m = StringObject { "m"sv };
+    ASSERT_TRUE(ValidateConstants(std::vector<Value> { &x, 1.0, &x, &m, 2.0 }, compilation_result.value()->chunk.constant_pool));
+    ASSERT_EQ(compilation_result.value()->chunk.property_caches.size(), 3);
+}
+
 TEST_F(CompilerTest, InvalidReturnStatement)
 {
     m_source.Append(R"(
@@ -712,27 +740,22 @@ outer();
     auto const compilation_result = m_compiler->CompileSource(m_source);
     ASSERT_TRUE(compilation_result.has_value());
     ASSERT_TRUE(ValidateByteCode(std::vector<uint8_t> {
-                                     OP_CLOSURE, 1, 0,
+                                     OP_CLOSURE, 0, 0,
                                      OP_DEFINE_GLOBAL, 0, 0,
-                                     OP_GET_GLOBAL, 2, 0,
+                                     OP_GET_GLOBAL, 0, 0,
                                      OP_CALL, 0, 0,
                                      OP_POP,
                                      OP_NIL,
                                      OP_RETURN },
         compilation_result.value()->chunk.byte_code));
     {
-        auto string_object = StringObject {
-            "outer"sv,
-        };
         auto function_object = FunctionObject {
             "outer"sv,
             0
         };
 
         ASSERT_TRUE(ValidateConstants(std::vector<Value> {
-                                          &string_object,
                                           &function_object,
-                                          &string_object,
                                       },
             compilation_result.value()->chunk.constant_pool));
     }
@@ -0,0 +1,191 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "gtest/gtest.h"
+
+#include "chunk.h"
+#include "object.h"
+#include "verifier.h"
+
+// The functions under test are built by hand, they live on the stack to keep the garbage collector out of the picture
+class VerifierTest : public ::testing::Test {
+protected:
+    auto emit(std::initializer_list<uint8_t> bytes) -> void
+    {
+        m_function.chunk.byte_code.insert(m_function.chunk.byte_code.end(), bytes);
+    }
+    auto addConstant(Value value) -> uint8_t
+    {
+        m_function.chunk.constant_pool.push_back(value);
+        return static_cast<uint8_t>(m_function.chunk.constant_pool.size() - 1);
+    }
+    FunctionObject m_function { "test", 0 };
+    StringObject m_name { "name" };
+};
+
+TEST_F(VerifierTest, ValidChunk)
+{
+    auto constant = addConstant(1.0);
+    emit({ OP_CONSTANT, constant, 0, OP_CONSTANT, constant, 0, OP_ADD, OP_PRINT, OP_NIL, OP_RETURN });
+    ASSERT_TRUE(VerifyFunction(m_function, true, 0).has_value());
+    ASSERT_TRUE(m_function.verified);
+    ASSERT_EQ(m_function.max_stack_depth, 2);
+}
+
+TEST_F(VerifierTest, ArgumentsCountTowardsStackDepth)
+{
+    m_function.arity = 2;
+    emit({ OP_GET_LOCAL, 1, 0, OP_GET_LOCAL, 2, 0, OP_ADD, OP_RETURN });
+    ASSERT_TRUE(VerifyFunction(m_function, true, 0).has_value());
+    ASSERT_EQ(m_function.max_stack_depth, 4);
+}
+
+TEST_F(VerifierTest, UnknownOpcode)
+{
+    emit({ static_cast<uint8_t>(NUMBER_OF_OPCODES), OP_NIL, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+    ASSERT_FALSE(m_function.verified);
+}
+
+TEST_F(VerifierTest, TruncatedOperand)
+{
+    emit({ OP_NIL, OP_RETURN, OP_CONSTANT, 0 });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, ConstantOutOfRange)
+{
+    emit({ OP_CONSTANT, 0, 0, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, PropertyNameMustBeString)
+{
+    auto constant = addConstant(1.0);
+    m_function.chunk.property_caches.emplace_back();
+    emit({ OP_NIL, OP_GET_PROPERTY, constant, 0, 0, 0, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+    m_function.chunk.constant_pool[constant] = Value { static_cast<Object*>(&m_name) };
+    ASSERT_TRUE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, PropertyCacheOutOfRange)
+{
+    auto constant = addConstant(Value { static_cast<Object*>(&m_name) });
+    emit({ OP_NIL, OP_GET_PROPERTY, constant, 0, 1, 0, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+    m_function.chunk.property_caches.resize(2);
+    ASSERT_TRUE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, InvokeArgumentsUnderflow)
+{
+    auto constant = addConstant(Value { static_cast<Object*>(&m_name) });
+    m_function.chunk.property_caches.emplace_back();
+    emit({ OP_NIL, OP_NIL, OP_INVOKE, constant, 0, 2, 0, 0, 0, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+    m_function.chunk.byte_code[5] = 1;
+    ASSERT_TRUE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, GlobalSlotOutOfRange)
+{
+    emit({ OP_GET_GLOBAL, 1, 0, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 1).has_value());
+    ASSERT_TRUE(VerifyFunction(m_function, true, 2).has_value());
+}
+
+TEST_F(VerifierTest, StackUnderflow)
+{
+    emit({ OP_NIL, OP_ADD, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, CallArgumentsUnderflow)
+{
+    emit({ OP_NIL, OP_CALL, 1, 0, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, LocalOutOfRange)
+{
+    emit({ OP_GET_LOCAL, 1, 0, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, CalleeSlotOnlyInFunctions)
+{
+    emit({ OP_GET_LOCAL, 0, 0, OP_RETURN });
+    ASSERT_TRUE(VerifyFunction(m_function, true, 0).has_value());
+    ASSERT_FALSE(VerifyFunction(m_function, false, 0).has_value());
+}
+
+TEST_F(VerifierTest, UpvalueOutOfRange)
+{
+    emit({ OP_GET_UPVALUE, 0, 0, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+    m_function.upvalue_count = 1;
+    ASSERT_TRUE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, JumpIntoInstruction)
+{
+    auto constant = addConstant(1.0);
+    emit({ OP_JUMP, 1, 0, OP_CONSTANT, constant, 0, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, JumpPastEnd)
+{
+    emit({ OP_JUMP, 8, 0, OP_NIL, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, FallsOffEnd)
+{
+    emit({ OP_NIL, OP_POP });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, InconsistentStackDepthAtMerge)
+{
+    // The taken branch skips the push of the second nil
+    emit({ OP_TRUE, OP_JUMP_IF_FALSE, 1, 0, OP_NIL, OP_NIL, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, LoopBeforeStart)
+{
+    emit({ OP_LOOP, 10, 0, OP_NIL, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+}
+
+TEST_F(VerifierTest, ClosureOverUnverifiedFunction)
+{
+    FunctionObject inner { "inner", 0 };
+    inner.chunk.byte_code = { OP_NIL, OP_RETURN };
+    auto constant = addConstant(Value { static_cast<Object*>(&inner) });
+    emit({ OP_CLOSURE, constant, 0, OP_RETURN });
+    ASSERT_FALSE(VerifyFunction(m_function, true, 0).has_value());
+    ASSERT_TRUE(VerifyFunction(inner, true, 0).has_value());
+    ASSERT_TRUE(VerifyFunction(m_function, true, 0).has_value());
+}
@@ -4,7 +4,10 @@
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+
 #include "fmt/core.h"
+#include "heap_snapshot.h"
 #include "virtual_machine.h"
 
 class VMTest : public ::testing::Test {
@@ -876,3 +879,910 @@ print instance.b;
     static constexpr auto EXPECTED_OUTPUT = "1\n2\n";
     ASSERT_EQ(m_vm_output_stream, EXPECTED_OUTPUT);
 }
+
+TEST_F(VMTest, ReturnClosesUpvalues)
+{
+    m_source.Append(R"(
+fun makeCounter() {
+    var count = 0;
+    var unused = "unused";
+    fun increment() {
+        count = count + 1;
+        return count;
+    }
+    return increment;
+}
+var counter = makeCounter();
+var other = makeCounter();
+counter();
+print counter();
+print other();
+)");
+    auto result = m_vm->Interpret(m_source);
+    ASSERT_TRUE(result.has_value());
+    static constexpr auto EXPECTED_OUTPUT = "2\n1\n";
+    ASSERT_EQ(m_vm_output_stream, EXPECTED_OUTPUT);
+}
+
+TEST_F(VMTest, StackOverflow)
+{
+    m_source.Append(R"(
+fun recurse(n) {
+    return recurse(n + 1);
+}
+recurse(0);
+)");
+    auto result = m_vm->Interpret(m_source);
+    ASSERT_FALSE(result.has_value());
+    ASSERT_EQ(result.error().error_message, "Stack overflow");
+}
+
+TEST_F(VMTest, InterpretTwice)
+{
+    m_source.Append(R"(
+var greeting = "Hello";
+print greeting;
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    Source second_source;
+    second_source.Append(R"(
+print greeting + " again";
+)");
+    ASSERT_TRUE(m_vm->Interpret(second_source).has_value());
+    static constexpr auto EXPECTED_OUTPUT = "Hello\nHello again\n";
+    ASSERT_EQ(m_vm_output_stream, EXPECTED_OUTPUT);
+}
+
+TEST_F(VMTest, InterpretAfterRuntimeError)
+{
+    m_source.Append(R"(
+var f;
+fun outer() {
+    var a = "A";
+    var b = "B";
+    var x = 42;
+    fun inner() { return x; }
+    f = inner;
+    nil + 1;
+}
+outer();
+)");
+    ASSERT_FALSE(m_vm->Interpret(m_source).has_value());
+    // The closure kept in the global still sees the value it captured, not whatever now occupies its old stack slot
+    Source second_source;
+    second_source.Append(R"(
+{
+    var p = "P";
+    var q = "Q";
+    var r = "R";
+    print f();
+}
+)");
+    ASSERT_TRUE(m_vm->Interpret(second_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "42\n");
+}
+
+TEST_F(VMTest, ClassWithMultipleMethods)
+{
+    m_source.Append(R"(
+class Pair {
+    init(a, b) {
+        this.a = a;
+        this.b = b;
+    }
+    first() {
+        return this.a;
+    }
+    second() {
+        return this.b;
+    }
+}
+var pair = Pair(1, 2);
+print pair.first();
+print pair.second();
+)");
+    auto result = m_vm->Interpret(m_source);
+    ASSERT_TRUE(result.has_value());
+    static constexpr auto EXPECTED_OUTPUT = "1\n2\n";
+    ASSERT_EQ(m_vm_output_stream, EXPECTED_OUTPUT);
+}
+
+TEST_F(VMTest, NaNIsANumber)
+{
+    // NaNs must stay numbers no matter how the Value is represented
+    m_source.Append(R"(
+var n = 0 / 0;
+print n == n;
+print -n == n;
+print n + 1 == 1;
+)");
+    auto result = m_vm->Interpret(m_source);
+    ASSERT_TRUE(result.has_value());
+    static constexpr auto EXPECTED_OUTPUT = "false\nfalse\nfalse\n";
+    ASSERT_EQ(m_vm_output_stream, EXPECTED_OUTPUT);
+}
+
+TEST_F(VMTest, StringInterning)
+{
+    m_source.Append(R"(
+var a = "Hello";
+var b = a + " world";
+print a;
+print b;
+print b == "Hello world";
+print b == a;
+)");
+    auto result = m_vm->Interpret(m_source);
+    ASSERT_TRUE(result.has_value());
+    static constexpr auto EXPECTED_OUTPUT = "Hello\nHello world\ntrue\nfalse\n";
+    ASSERT_EQ(m_vm_output_stream, EXPECTED_OUTPUT);
+}
+
+TEST_F(VMTest, GlobalsResolvedBeforeDefinition)
+{
+    m_source.Append(R"(
+fun get() {
+    return later;
+}
+var later = "defined later";
+print get();
+print missing;
+)");
+    auto result = m_vm->Interpret(m_source);
+    ASSERT_FALSE(result.has_value());
+    ASSERT_EQ(result.error().error_message, "Undefined variable:missing");
+    static constexpr auto EXPECTED_OUTPUT = "defined later\n";
+    ASSERT_EQ(m_vm_output_stream, EXPECTED_OUTPUT);
+}
+
+TEST_F(VMTest, InstanceFieldsAndShapes)
+{
+    // Fields are added in different orders and past the inline capacity of an instance
+    m_source.Append(R"(
+class Bag {}
+var first = Bag();
+first.a = 1;
+first.b = 2;
+var second = Bag();
+second.b = 20;
+second.a = 10;
+var third = Bag();
+third.f1 = 1;
+third.f2 = 2;
+third.f3 = 3;
+third.f4 = 4;
+third.f5 = 5;
+third.f6 = 6;
+third.f2 = 22;
+print first.a + first.b;
+print second.a + second.b;
+print third.f1 + third.f2 + third.f3 + third.f4 + third.f5 + third.f6;
+print second.f1;
+)");
+    auto result = m_vm->Interpret(m_source);
+    ASSERT_FALSE(result.has_value());
+    ASSERT_EQ(result.error().error_message, "f1 not found");
+    static constexpr auto EXPECTED_OUTPUT = "3\n30\n41\n";
+    ASSERT_EQ(m_vm_output_stream, EXPECTED_OUTPUT);
+}
+
+TEST_F(VMTest, MonomorphicPropertyCache)
+{
+    // Each property access misses once to fill its cache and hits on every later execution
+    m_source.Append(R"(
+class Point {
+  init(x) { this.x = x; }
+  get() { return this.x; }
+}
+var p = Point(1);
+var sum = 0;
+for (var i = 0; i < 10; i = i + 1) {
+  sum = sum + p.x + p.get();
+}
+print sum;
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "20\n");
+    auto const& counters = m_vm->PropertyCacheCounters();
+    ASSERT_EQ(counters.misses, 4);
+    ASSERT_EQ(counters.hits, 27);
+    ASSERT_EQ(counters.megamorphic_misses, 0);
+}
+
+TEST_F(VMTest, MegamorphicPropertyCache)
+{
+    // Six shapes flow through the same accesses, which is more than a cache will hold
+    m_source.Append(R"(
+class A {} class B {} class C {} class D {} class E {} class F {}
+fun make(cls, v) {
+  var o = cls();
+  o.v = v;
+  return o;
+}
+fun read(o) { return o.v; }
+var a = make(A, 1); var b = make(B, 2); var c = make(C, 3);
+var d = make(D, 4); var e = make(E, 5); var f = make(F, 6);
+var sum = 0;
+for (var i = 0; i < 2; i = i + 1) {
+  sum = sum + read(a) + read(b) + read(c) + read(d) + read(e) + read(f);
+}
+print sum;
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "42\n");
+    auto const& counters = m_vm->PropertyCacheCounters();
+    ASSERT_EQ(counters.hits, 4);
+    ASSERT_EQ(counters.misses, 14);
+    ASSERT_EQ(counters.megamorphic_misses, 4);
+}
+
+TEST_F(VMTest, PropertyCacheFollowsShapeChanges)
+{
+    // A field added after the method lookup was cached shadows the method
+    m_source.Append(R"(
+class A {
+  m() { return 1; }
+}
+fun two() { return 2; }
+fun call(o) { return o.m(); }
+var a = A();
+print call(a);
+a.m = two;
+print call(a);
+print call(A());
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "1\n2\n1\n");
+}
+
+TEST_F(VMTest, MethodInvocationDoesNotAllocate)
+{
+    static constexpr auto SCRIPT = R"(
+class Counter {{
+  init() {{ this.count = 0; }}
+  increment(by) {{ this.count = this.count + by; }}
+}}
+var counter = Counter();
+for (var i = 0; i < {}; i = i + 1) {{
+  counter.increment(2);
+}}
+print counter.count;
+)";
+    auto const objectsAllocated = [](uint32_t iterations) {
+        std::string output;
+        VirtualMachine vm(&output);
+        Source source;
+        source.Append(fmt::format(SCRIPT, iterations));
+        EXPECT_TRUE(vm.Interpret(source).has_value());
+        EXPECT_EQ(output, fmt::format("{}\n", 2 * iterations));
+        return vm.ObjectsAllocated();
+    };
+    ASSERT_EQ(objectsAllocated(1), objectsAllocated(100));
+}
+
+TEST_F(VMTest, InvokeCallsClosureStoredInField)
+{
+    m_source.Append(R"(
+class Box {
+  method() { return "method"; }
+}
+fun field(a, b) { return a + b; }
+var box = Box();
+print box.method();
+box.method = field;
+print box.method(1, 2);
+box.other = Box;
+print box.other().method();
+print box.missing();
+)");
+    auto result = m_vm->Interpret(m_source);
+    ASSERT_FALSE(result.has_value());
+    ASSERT_EQ(result.error().error_message, "missing not found");
+    ASSERT_EQ(m_vm_output_stream, "method\n3\nmethod\n");
+}
+
+TEST_F(VMTest, QuickeningSpecializesNumberOperations)
+{
+    m_source.Append(R"(
+fun sum(n) {
+  var total = 0;
+  for (var i = 0; i < n; i = i + 1) {
+    total = total + i * 2 - 1;
+  }
+  return total;
+}
+print sum(10);
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "80\n");
+    auto const report = m_vm->QuickeningReport();
+    auto const it = std::ranges::find(report, "sum", &FunctionQuickeningStats::function_name);
+    ASSERT_NE(it, report.end());
+    // i < n, i + 1, total + ..., i * 2 and ... - 1 are each rewritten once
+    ASSERT_EQ(it->stats.specialized, 5);
+    ASSERT_EQ(it->stats.despecialized, 0);
+}
+
+TEST_F(VMTest, QuickeningRevertsOnTypeMismatch)
+{
+    m_source.Append(R"(
+fun add(a, b) { return a + b; }
+print add(1, 2);
+print add("a", "b");
+print add(3, 4);
+fun subtract(a, b) { return a - b; }
+print subtract(3, 1);
+print subtract(nil, 1);
+)");
+    auto result = m_vm->Interpret(m_source);
+    ASSERT_FALSE(result.has_value());
+    ASSERT_EQ(m_vm_output_stream, "3\nab\n7\n2\n");
+
+    // The reverted instruction reports the same error as one that was never quickened
+    std::string output;
+    VirtualMachine generic_vm(&output);
+    Source source;
+    source.Append("print nil - 1;");
+    auto generic_result = generic_vm.Interpret(source);
+    ASSERT_FALSE(generic_result.has_value());
+    ASSERT_EQ(result.error().error_message, generic_result.error().error_message);
+
+    auto const report = m_vm->QuickeningReport();
+    auto const add = std::ranges::find(report, "add", &FunctionQuickeningStats::function_name);
+    ASSERT_NE(add, report.end());
+    ASSERT_EQ(add->stats.specialized, 2);
+    ASSERT_EQ(add->stats.despecialized, 1);
+    auto const subtract = std::ranges::find(report, "subtract", &FunctionQuickeningStats::function_name);
+    ASSERT_NE(subtract, report.end());
+    ASSERT_EQ(subtract->stats.specialized, 1);
+    ASSERT_EQ(subtract->stats.despecialized, 1);
+}
+
+TEST_F(VMTest, GenerationalWriteBarriers)
+{
+    // The box and the closed upvalue are promoted by the first churn, they are then made to reference young objects
+    // that are only reachable through them
+    m_source.Append(R"(
+class Box {
+  init(value) { this.value = value; }
+}
+fun churn() {
+  for (var i = 0; i < 5000; i = i + 1) {
+    Box(i);
+  }
+}
+var box = Box(nil);
+fun makeVariable() {
+  var variable = "initial";
+  fun set(value) { variable = value; }
+  fun get() { return variable; }
+  box.set = set;
+  box.get = get;
+}
+makeVariable();
+churn();
+box.value = Box("young" + " box");
+box.set("young" + " upvalue");
+churn();
+print box.value.value;
+print box.get();
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "young box\nyoung upvalue\n");
+    auto const& collections = m_vm->GarbageCollections();
+    ASSERT_GT(collections.minor_collections, 0);
+    ASSERT_LT(collections.major_collections, collections.minor_collections);
+}
+
+static auto IncrementalCollectionSource(uint32_t node_count) -> std::string
+{
+    return fmt::format(R"(
+class Node {{
+  init(value, next) {{ this.value = value; this.next = next; }}
+}}
+var head = nil;
+for (var i = 0; i < {}; i = i + 1) {{
+  head = Node(i, head);
+}}
+// The nodes are old by now, give every one of them a reference to a new object while the collector is marking
+var node = head;
+while (node != nil) {{
+  node.value = Node(node.value, nil);
+  node = node.next;
+}}
+var sum = 0;
+node = head;
+while (node != nil) {{
+  sum = sum + node.value.value;
+  node = node.next;
+}}
+print sum;
+)",
+        node_count);
+}
+
+TEST_F(VMTest, IncrementalCollection)
+{
+    m_source.Append(IncrementalCollectionSource(20000));
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "199990000\n");
+    ASSERT_GT(m_vm->GarbageCollections().incremental_steps, 0);
+}
+
+TEST_F(VMTest, StopTheWorldCollectionWithoutPauseBudget)
+{
+    m_vm->SetGCPauseBudget(std::chrono::microseconds { 0 });
+    m_source.Append(IncrementalCollectionSource(2000));
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "1999000\n");
+    ASSERT_EQ(m_vm->GarbageCollections().incremental_steps, 0);
+}
+
+TEST_F(VMTest, ConcurrentMarking)
+{
+    m_vm->SetConcurrentGC(true);
+    m_source.Append(IncrementalCollectionSource(20000));
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "199990000\n");
+    ASSERT_GT(m_vm->GarbageCollections().concurrent_markings, 0);
+}
+
+// Allocates a short-lived instance per iteration
+static auto GarbageLoopSource(uint32_t iterations) -> std::string
+{
+    return fmt::format(R"(
+class Box {{
+  init(value) {{ this.value = value; }}
+}}
+var total = 0;
+for (var i = 0; i < {}; i = i + 1) {{
+  total = total + Box(i).value;
+}}
+print total;
+)",
+        iterations);
+}
+
+TEST_F(VMTest, ParallelMarking)
+{
+    m_vm->SetGCPauseBudget(std::chrono::microseconds { 0 });
+    m_vm->SetGCMarkThreads(4, 0);
+    m_source.Append(IncrementalCollectionSource(2000));
+    m_source.Append(GarbageLoopSource(2000));
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "1999000\n1999000\n");
+    // Without stress testing the heap stays below the major collection threshold
+    auto const& collections = m_vm->GarbageCollections();
+    ASSERT_EQ(collections.parallel_markings, collections.major_collections);
+}
+
+TEST_F(VMTest, LazySweeping)
+{
+    m_vm->SetGCPauseBudget(std::chrono::microseconds { 0 });
+    m_source.Append(IncrementalCollectionSource(2000));
+    m_source.Append(GarbageLoopSource(2000));
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "1999000\n1999000\n");
+    auto const& collections = m_vm->GarbageCollections();
+    ASSERT_EQ(collections.lazy_sweeps > 0, collections.major_collections > 0);
+}
+
+TEST_F(VMTest, BackgroundFreeing)
+{
+    m_vm->SetGCBackgroundFreeing(true);
+    m_source.Append(GarbageLoopSource(20000));
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "199990000\n");
+    ASSERT_GT(m_vm->GarbageCollections().objects_freed_in_background, 0);
+}
+
+// Doubles a string to 2MB and then makes copies of it, which only allocates a few objects but many bytes
+static constexpr auto LARGE_STRINGS_SOURCE = R"(
+var s = "ab";
+for (var i = 0; i < 20; i = i + 1) {
+    s = s + s;
+}
+var copy = nil;
+for (var i = 0; i < 8; i = i + 1) {
+    copy = s + "!";
+}
+print "done";
+)";
+
+TEST_F(VMTest, StringPayloadsCountTowardsHeap)
+{
+    m_source.Append(LARGE_STRINGS_SOURCE);
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "done\n");
+    ASSERT_GE(m_vm->HeapBytes(), 2 * 1024 * 1024);
+    ASSERT_GT(m_vm->GarbageCollections().major_collections, 0);
+}
+
+TEST_F(VMTest, MaxHeapBytesSchedulesMajorCollections)
+{
+    auto const major_collections = [](HeapOptions const& options) {
+        std::string output;
+        VirtualMachine vm(&output, options);
+        vm.SetGCPauseBudget(std::chrono::microseconds { 0 }); // An incremental major collection spans several collections
+        Source source;
+        source.Append(LARGE_STRINGS_SOURCE);
+        EXPECT_TRUE(vm.Interpret(source).has_value());
+        EXPECT_EQ(output, "done\n");
+        return vm.GarbageCollections().major_collections;
+    };
+    // The live string alone is above the maximum, every collection after it was built is a major one
+    ASSERT_GT(major_collections(HeapOptions { .min_heap_bytes = 512 * 1024, .max_heap_bytes = 1024 * 1024 }), major_collections(HeapOptions {}));
+}
+
+TEST_F(VMTest, CollectGarbageFreesUnreachableObjects)
+{
+    m_vm->SetConcurrentGC(true);
+    m_source.Append(R"(
+var s = "ab";
+for (var i = 0; i < 20; i = i + 1) {
+    s = s + s;
+}
+s = nil;
+)");
+    m_source.Append(GarbageLoopSource(2000));
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    m_vm->CollectGarbage();
+    ASSERT_LT(m_vm->HeapBytes(), 1024 * 1024);
+    auto const major_collections = m_vm->GarbageCollections().major_collections;
+    m_vm->CollectGarbage();
+    ASSERT_EQ(m_vm->GarbageCollections().major_collections, major_collections + 1);
+}
+
+// A list of "nodes" nodes that each own a closure and an upvalue, of which every tenth is kept. Leaves most of the blocks
+// the list was allocated from sparsely used.
+static auto SparseListSource(uint32_t nodes) -> std::string
+{
+    return fmt::format(R"(
+class Node {{
+  init(value, next) {{
+    this.value = value;
+    this.next = next;
+    fun get() {{ return value; }}
+    this.get = get;
+  }}
+  total() {{
+    var sum = 0;
+    var node = this;
+    while (node != nil) {{
+      sum = sum + node.get() + node.value;
+      node = node.next;
+    }}
+    return sum;
+  }}
+}}
+var head = nil;
+for (var i = 0; i < {}; i = i + 1) {{
+  head = Node(i, head);
+}}
+var last = head;
+var node = head.next;
+var k = 1;
+while (node != nil) {{
+  if (k == 10) {{
+    last.next = node;
+    last = node;
+    k = 0;
+  }}
+  node = node.next;
+  k = k + 1;
+}}
+last.next = nil;
+print head.total();
+)",
+        nodes);
+}
+
+TEST_F(VMTest, CompactionMovesObjectsOutOfSparseBlocks)
+{
+    m_vm->SetGCCompaction(true);
+    m_source.Append(SparseListSource(5000));
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    m_vm->CollectGarbage();
+    auto const& stats = m_vm->GarbageCollections();
+    ASSERT_GE(stats.compactions, 1U);
+    ASSERT_GT(stats.objects_moved, 0U);
+    ASSERT_GT(stats.blocks_compacted, 0U);
+    // The moved objects are reachable through the globals, the fields, the closures and the method tables
+    Source second_source;
+    second_source.Append(R"(
+print head.total();
+print head.next.get();
+)");
+    ASSERT_TRUE(m_vm->Interpret(second_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "2504000\n2504000\n4989\n");
+}
+
+TEST_F(VMTest, CompactionRunsOnLoopBackEdges)
+{
+    m_vm->SetGCCompaction(true);
+    m_vm->SetGCPauseBudget(std::chrono::microseconds { 0 });
+    m_vm->SetGCLazySweeping(false); // The heap is checked for fragmentation once the major collection has swept it
+    m_source.Append(SparseListSource(5000));
+    // The growing string brings on a major collection that finds the thinned out list, the compaction runs on one of the
+    // back-edges that follow
+    m_source.Append(R"(
+var s = "ab";
+for (var i = 0; i < 20; i = i + 1) {
+  s = s + s;
+}
+print head.total();
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "2504000\n2504000\n");
+    ASSERT_GE(m_vm->GarbageCollections().compactions, 1U);
+}
+
+TEST_F(VMTest, CompiledStringConstantsPinInternedStrings)
+{
+    // The string is allocated by the program before the compiler needs it as a constant
+    m_source.Append(R"(
+var a = "con" + "cat";
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    Source second_source;
+    second_source.Append(R"(
+a = nil;
+fun f() { return "concat"; }
+)");
+    ASSERT_TRUE(m_vm->Interpret(second_source).has_value());
+    // Nothing but the constant pool refers to the string now
+    m_vm->CollectGarbage();
+    m_vm->CollectGarbage();
+    Source third_source;
+    third_source.Append(R"(
+print f();
+print f() == "con" + "cat";
+)");
+    ASSERT_TRUE(m_vm->Interpret(third_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "concat\ntrue\n");
+}
+
+TEST_F(VMTest, MetricNativeFunctionReadsCounters)
+{
+    m_source.Append(R"(
+class Point {}
+var a = Point();
+var b = Point();
+fun f() {}
+f();
+f();
+print Metric("alloc.instance.objects");
+print Metric("vm.frames_pushed");
+print Metric("heap.peak_bytes") >= Metric("heap.bytes");
+for (var i = 0; i < 1000; i = i + 1) {}
+print Metric("vm.instructions_executed") > 1000;
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "2\n3\ntrue\ntrue\n");
+    Source unknown_metric;
+    unknown_metric.Append("print Metric(\"no.such.metric\");");
+    ASSERT_FALSE(m_vm->Interpret(unknown_metric).has_value());
+}
+
+TEST_F(VMTest, MetricsExportAsJson)
+{
+    m_source.Append(R"(
+class Point {}
+for (var i = 0; i < 10000; i = i + 1) {
+    var p = Point();
+}
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    auto const metrics = m_vm->Metrics();
+    ASSERT_EQ(metrics.allocations.objects[static_cast<size_t>(ObjectType::INSTANCE)], 10000U);
+    ASSERT_GE(metrics.allocations.peak_heap_bytes, m_vm->HeapBytes());
+    // Every pause lands in one bucket of the histogram, an incremental major collection pauses once per step
+    auto const& collections = metrics.collections;
+    auto pauses = uint64_t { 0 };
+    for (auto const count : collections.pause_histogram) {
+        pauses += count;
+    }
+    ASSERT_GE(pauses, collections.minor_collections + collections.incremental_steps);
+    ASSERT_LE(pauses, collections.minor_collections + collections.major_collections + collections.incremental_steps);
+    auto const json = MetricsToJson(metrics);
+    ASSERT_TRUE(json.starts_with("{\n"));
+    ASSERT_TRUE(json.ends_with("\n}\n"));
+    ASSERT_NE(json.find("\"alloc.instance.objects\": 10000,"), std::string::npos);
+    ASSERT_NE(json.find(fmt::format("\"vm.instructions_executed\": {},", m_vm->InstructionsExecuted())), std::string::npos);
+    ASSERT_NE(json.find("\"gc.pauses.0us\": "), std::string::npos);
+}
+
+TEST_F(VMTest, HeapSnapshotRetainedSizes)
+{
+    auto const path = ::testing::TempDir() + "retained.loxsnapshot";
+    m_source.Append(fmt::format(R"(
+class Node {{
+    init(next) {{
+        this.next = next;
+    }}
+}}
+var head = Node(Node(Node(nil)));
+HeapSnapshot("{}");
+)",
+        path));
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    auto const snapshot = ReadHeapSnapshot(path);
+    ASSERT_TRUE(snapshot.has_value());
+    auto const dominators = ComputeDominators(*snapshot);
+    ASSERT_EQ(dominators.immediate_dominators.size(), snapshot->nodes.size());
+
+    // The list is only reachable through "head", which retains exactly its three nodes
+    auto nodes_size = uint64_t { 0 };
+    auto nodes = 0;
+    for (auto const& node : snapshot->nodes) {
+        if (node.type == ObjectType::INSTANCE && node.name == "Node") {
+            nodes_size += node.shallow_size;
+            ++nodes;
+        }
+    }
+    ASSERT_EQ(nodes, 3);
+    auto const head = std::ranges::find_if(snapshot->roots, [](auto const& root) { return root.name == "head"; });
+    ASSERT_NE(head, snapshot->roots.end());
+    ASSERT_EQ(head->kind, SnapshotRootKind::GLOBAL);
+    ASSERT_EQ(dominators.root_retained_sizes[static_cast<size_t>(head - snapshot->roots.begin())], nodes_size);
+    ASSERT_EQ(dominators.retained_sizes[head->node], nodes_size);
+    auto const next_edges = std::ranges::count_if(snapshot->edges, [](auto const& edge) { return edge.name == "next"; });
+    ASSERT_EQ(next_edges, 2); // The last node's "next" is nil
+
+    // A snapshot survives a round trip, a file that is not one is rejected
+    auto const copy_path = ::testing::TempDir() + "copy.loxsnapshot";
+    ASSERT_TRUE(WriteHeapSnapshot(*snapshot, copy_path));
+    auto const copy = ReadHeapSnapshot(copy_path);
+    ASSERT_TRUE(copy.has_value());
+    ASSERT_EQ(copy->nodes.size(), snapshot->nodes.size());
+    ASSERT_EQ(copy->edges.size(), snapshot->edges.size());
+    ASSERT_EQ(copy->roots.size(), snapshot->roots.size());
+    ASSERT_EQ(copy->edges.back().name, snapshot->edges.back().name);
+    auto* file = std::fopen(copy_path.c_str(), "w");
+    ASSERT_NE(file, nullptr);
+    fmt::print(file, "LOXHEAP1 truncated");
+    std::fclose(file);
+    ASSERT_FALSE(ReadHeapSnapshot(copy_path).has_value());
+}
+
+TEST_F(VMTest, HeapSnapshotOnRequest)
+{
+    auto const path = ::testing::TempDir() + "requested.loxsnapshot";
+    std::remove(path.c_str());
+    m_vm->SetHeapSnapshotPath(path);
+    // A requested snapshot is written at the next loop back-edge
+    m_vm->RequestHeapSnapshot();
+    m_source.Append(R"(
+var list = nil;
+for (var i = 0; i < 2; i = i + 1) {
+    list = "item";
+}
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    auto const snapshot = ReadHeapSnapshot(path);
+    ASSERT_TRUE(snapshot.has_value());
+    ASSERT_TRUE(std::ranges::any_of(snapshot->roots, [](auto const& root) { return root.kind == SnapshotRootKind::FRAME; }));
+}
+
+TEST_F(VMTest, HeapSnapshotOnRequestWithoutLoops)
+{
+    auto const path = ::testing::TempDir() + "requested_recursive.loxsnapshot";
+    std::remove(path.c_str());
+    m_vm->SetHeapSnapshotPath(path);
+    // A program without back-edges gets its snapshot on the next call
+    m_vm->RequestHeapSnapshot();
+    m_source.Append(R"(
+fun build(n, list) {
+    if (n == 0) return list;
+    return build(n - 1, "item");
+}
+var list = build(3, nil);
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    auto const snapshot = ReadHeapSnapshot(path);
+    ASSERT_TRUE(snapshot.has_value());
+    ASSERT_TRUE(std::ranges::any_of(snapshot->roots, [](auto const& root) { return root.kind == SnapshotRootKind::FRAME; }));
+}
+
+TEST_F(VMTest, RegionHeapDefersCollections)
+{
+    auto const options = HeapOptions { .mode = HeapMode::REGION, .region_limit_bytes = 2 * 1024 * 1024 };
+    std::string output;
+    auto vm = std::make_unique<VirtualMachine>(&output, options);
+    auto const collections = [&vm] { return vm->GarbageCollections().minor_collections + vm->GarbageCollections().major_collections; };
+    Source below_limit;
+    below_limit.Append(R"(
+class Point {}
+for (var i = 0; i < 10000; i = i + 1) {
+    var p = Point();
+}
+)");
+    ASSERT_TRUE(vm->Interpret(below_limit).has_value());
+    ASSERT_EQ(collections(), 0U);
+    ASSERT_GT(vm->HeapBytes(), 10000U * sizeof(InstanceObject));
+    // Past the limit the heap collects as usual and stays well below what the program allocated
+    Source past_limit;
+    past_limit.Append(R"(
+for (var i = 0; i < 40000; i = i + 1) {
+    var p = Point();
+}
+print "done";
+)");
+    ASSERT_TRUE(vm->Interpret(past_limit).has_value());
+    ASSERT_EQ(output, "done\n");
+    ASSERT_GT(collections(), 0U);
+    ASSERT_LT(vm->HeapBytes(), 40000U * sizeof(InstanceObject));
+    // Tearing the heap down gives its arenas back with the objects still in them
+    vm.reset();
+}
+
+TEST_F(VMTest, LargeStringsLiveInTheLargeObjectSpace)
+{
+    if constexpr (!LARGE_OBJECT_SPACE_ENABLED) {
+        GTEST_SKIP();
+    }
+    auto const before = LargeObjectSpace::Instance().GetStats();
+    m_source.Append(R"(
+var s = "x";
+for (var i = 0; i < 16; i = i + 1) {
+    s = s + s;
+}
+print Metric("los.bytes_in_use") > 0;
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "true\n");
+    auto const built = LargeObjectSpace::Instance().GetStats();
+    // The strings of 32K characters and more
+    ASSERT_EQ(built.allocations, before.allocations + 2);
+    ASSERT_GE(built.bytes_in_use, before.bytes_in_use + 64 * 1024);
+    Source drop;
+    drop.Append("s = nil;");
+    ASSERT_TRUE(m_vm->Interpret(drop).has_value());
+    m_vm->CollectGarbage();
+    auto const freed = LargeObjectSpace::Instance().GetStats();
+    ASSERT_EQ(freed.bytes_in_use, before.bytes_in_use);
+    ASSERT_EQ(freed.frees, before.frees + 2);
+}
+
+TEST_F(VMTest, CompressedReferencesSurviveCompaction)
+{
+    if constexpr (POINTER_COMPRESSION_ENABLED) {
+        ASSERT_EQ(sizeof(ObjectRef<InstanceObject>), sizeof(uint32_t));
+    }
+    m_vm->SetGCCompaction(true);
+    // Every other instance is dropped, the survivors move with their overflow fields, bound methods and closures
+    m_source.Append(R"(
+class Node {
+  init(next, i) { this.next = next; this.a = i; this.b = i; this.c = i; this.d = i; this.e = i; }
+  sum() { return this.a + this.b + this.c + this.d + this.e; }
+}
+fun adder(n) {
+  fun add(x) { return x + n; }
+  return add;
+}
+var head = nil;
+var dropped = nil;
+for (var i = 0; i < 5000; i = i + 1) {
+  head = Node(head, i);
+  dropped = Node(dropped, i);
+}
+dropped = nil;
+var sum = head.sum;
+var add = adder(3);
+)");
+    ASSERT_TRUE(m_vm->Interpret(m_source).has_value());
+    m_vm->CollectGarbage();
+    ASSERT_GT(m_vm->GarbageCollections().objects_moved, 0U);
+    Source second_source;
+    second_source.Append(R"(
+var total = 0;
+for (var node = head; node != nil; node = node.next) {
+  total = total + node.e;
+}
+print total;
+print sum();
+print add(4);
+)");
+    ASSERT_TRUE(m_vm->Interpret(second_source).has_value());
+    ASSERT_EQ(m_vm_output_stream, "12497500\n24995\n7\n");
+}
@@ -0,0 +1,193 @@
+// MIT License
+
+// Copyright (c) 2023 Kevin Joseph
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Reads a heap snapshot written by the interpreter (see heap_snapshot.h) and reports what holds on to the memory: the
+// number of objects, their shallow and retained sizes by class and the retained size of every root. Objects other than
+// instances are grouped by their type. The retained size of a class counts every object kept alive by its instances once,
+// including instances of the class that are kept alive by other instances of it.
+
+#include "heap_snapshot.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/core.h>
+
+static constexpr auto USAGE =
+    R"(
+usage: lox_heap_analyzer SNAPSHOT_FILE [NUMBER_OF_ROWS]
+)";
+static constexpr auto DEFAULT_ROWS = size_t { 20 };
+
+struct Group {
+    std::string name;
+    uint64_t count = 0;
+    uint64_t shallow_size = 0;
+    uint64_t retained_size = 0;
+};
+
+[[nodiscard]] static auto TypeName(ObjectType type) -> std::string_view
+{
+    switch (type) {
+    case ObjectType::STRING:
+        return "(string)";
+    case ObjectType::FUNCTION:
+        return "(function)";
+    case ObjectType::CLOSURE:
+        return "(closure)";
+    case ObjectType::NATIVE_FUNCTION:
+        return "(native function)";
+    case ObjectType::UPVALUE:
+        return "(upvalue)";
+    case ObjectType::CLASS:
+        return "(class)";
+    case ObjectType::INSTANCE:
+        return "(instance)";
+    case ObjectType::BOUND_METHOD:
+        return "(bound method)";
+    }
+    __builtin_unreachable();
+}
+
+[[nodiscard]] static auto RootKindName(SnapshotRootKind kind) -> std::string_view
+{
+    switch (kind) {
+    case SnapshotRootKind::GLOBAL:
+        return "global";
+    case SnapshotRootKind::STACK:
+        return "stack";
+    case SnapshotRootKind::FRAME:
+        return "frame";
+    case SnapshotRootKind::OPEN_UPVALUE:
+        return "upvalue";
+    case SnapshotRootKind::VM:
+        return "vm";
+    }
+    __builtin_unreachable();
+}
+
+// Instances are grouped by their class, everything else by its type
+[[nodiscard]] static auto GroupObjects(HeapSnapshot const& snapshot, SnapshotDominators const& dominators) -> std::vector<Group>
+{
+    auto groups = std::vector<Group> {};
+    auto group_ids = std::unordered_map<std::string, uint32_t> {};
+    auto node_groups = std::vector<uint32_t>(snapshot.nodes.size());
+    for (size_t node = 0; node < snapshot.nodes.size(); ++node) {
+        auto const& [type, shallow_size, name] = snapshot.nodes[node];
+        auto group_name = type == ObjectType::INSTANCE ? name : std::string(TypeName(type));
+        auto [it, inserted] = group_ids.try_emplace(group_name, static_cast<uint32_t>(groups.size()));
+        if (inserted) {
+            groups.push_back({ .name = std::move(group_name) });
+        }
+        node_groups[node] = it->second;
+        ++groups[it->second].count;
+        groups[it->second].shallow_size += shallow_size;
+    }
+
+    // Walks the dominator tree, an object adds its retained size to its group unless an object of the same group
+    // dominates it
+    auto children = std::vector<std::vector<uint32_t>>(snapshot.nodes.size());
+    auto tree_roots = std::vector<uint32_t> {};
+    for (uint32_t node = 0; node < snapshot.nodes.size(); ++node) {
+        auto const dominator = dominators.immediate_dominators[node];
+        (dominator == SnapshotDominators::VIRTUAL_ROOT ? tree_roots : children[dominator]).push_back(node);
+    }
+    auto active = std::vector<uint32_t>(groups.size(), 0); // Objects of the group on the path from the tree's root
+    auto stack = std::vector<std::pair<uint32_t, bool>> {};
+    for (auto const tree_root : tree_roots) {
+        stack.emplace_back(tree_root, false);
+        while (!stack.empty()) {
+            auto const [node, leaving] = stack.back();
+            stack.pop_back();
+            auto const group = node_groups[node];
+            if (leaving) {
+                --active[group];
+                continue;
+            }
+            if (active[group] == 0) {
+                groups[group].retained_size += dominators.retained_sizes[node];
+            }
+            ++active[group];
+            stack.emplace_back(node, true);
+            for (auto const child : children[node]) {
+                stack.emplace_back(child, false);
+            }
+        }
+    }
+    return groups;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2 && argc != 3) {
+        fmt::print("{}", USAGE);
+        return 1;
+    }
+    auto rows = DEFAULT_ROWS;
+    if (argc == 3) {
+        auto const argument = std::string_view { argv[2] };
+        if (std::from_chars(argument.data(), argument.data() + argument.size(), rows).ec != std::errc {}) {
+            fmt::print("{}", USAGE);
+            return 1;
+        }
+    }
+    auto const snapshot = ReadHeapSnapshot(argv[1]);
+    if (!snapshot.has_value()) {
+        fmt::print(stderr, "Could not read a heap snapshot from {}\n", argv[1]);
+        return 1;
+    }
+    auto const dominators = ComputeDominators(*snapshot);
+    auto total_size = uint64_t { 0 };
+    for (auto const& node : snapshot->nodes) {
+        total_size += node.shallow_size;
+    }
+    fmt::print("{} objects, {} references and {} bytes reachable from {} roots\n", snapshot->nodes.size(), snapshot->edges.size(), total_size,
+        snapshot->roots.size());
+
+    auto groups = GroupObjects(*snapshot, dominators);
+    std::ranges::sort(groups, std::greater {}, &Group::retained_size);
+    fmt::print("\n{:>12} {:>14} {:>14}  {}\n", "objects", "shallow(B)", "retained(B)", "class");
+    for (auto const& group : groups | std::views::take(rows)) {
+        fmt::print("{:>12} {:>14} {:>14}  {}\n", group.count, group.shallow_size, group.retained_size, group.name);
+    }
+
+    auto roots = std::vector<uint32_t>(snapshot->roots.size());
+    for (uint32_t root = 0; root < roots.size(); ++root) {
+        roots[root] = root;
+    }
+    std::ranges::sort(roots, std::greater {}, [&dominators](uint32_t root) { return dominators.root_retained_sizes[root]; });
+    fmt::print("\n{:>14} {:>8}  {}\n", "retained(B)", "kind", "root");
+    for (auto const root : roots | std::views::take(rows)) {
+        auto const& [node, kind, name] = snapshot->roots[root];
+        fmt::print("{:>14} {:>8}  {} -> {} {}\n", dominators.root_retained_sizes[root], RootKindName(kind), name, TypeName(snapshot->nodes[node].type),
+            snapshot->nodes[node].name);
+    }
+    return 0;
+}